@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "log.h"
+
+struct arena_chunk {
+	struct arena_chunk	*next;
+	size_t			size;
+	char			data[];
+};
+
+void arena_create(struct arena *a)
+{
+	memset(a, 0, sizeof(*a));
+	a->chunk_size = ARENA_CHUNK_MIN;
+}
+
+void arena_destroy(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	arena_create(a);
+}
+
+/* Slow path of arena_alloc(), large allocations get a chunk of their own */
+void *arena_grow(struct arena *a, size_t size)
+{
+	size_t chunk_size = a->chunk_size;
+	struct arena_chunk *c;
+
+	if (size > chunk_size / 4) {
+		c = malloc(sizeof(*c) + size);
+		if (!c) {
+			pr_perror("Can't allocate %zu bytes", size);
+			return NULL;
+		}
+		c->size = size;
+		a->used += size;
+		/* Keep the current chunk for the next ones */
+		if (a->chunks) {
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		} else {
+			c->next = NULL;
+			a->chunks = c;
+		}
+		return c->data;
+	}
+
+	c = malloc(sizeof(*c) + chunk_size);
+	if (!c) {
+		pr_perror("Can't allocate %zu bytes", chunk_size);
+		return NULL;
+	}
+	c->size = chunk_size;
+	c->next = a->chunks;
+	a->chunks = c;
+	a->used += chunk_size;
+	a->pos = c->data + size;
+	a->end = c->data + chunk_size;
+
+	if (a->chunk_size < ARENA_CHUNK_MAX)
+		a->chunk_size *= 2;
+	return c->data;
+}
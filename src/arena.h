@@ -0,0 +1,42 @@
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include <stddef.h>
+
+enum {
+	/** The first chunk, the next ones double in size */
+	ARENA_CHUNK_MIN		= 64u << 10,
+	/** Chunks stop growing at this size */
+	ARENA_CHUNK_MAX		= 4u << 20,
+};
+
+struct arena_chunk;
+
+/*
+ * Bump allocator, memory is given back all at once.
+ * Allocations are not aligned, tuples don't need it.
+ */
+struct arena {
+	struct arena_chunk	*chunks;
+	char			*pos;
+	char			*end;
+	size_t			chunk_size;
+	/** Bytes taken by the chunks */
+	size_t			used;
+};
+
+extern void arena_create(struct arena *a);
+extern void arena_destroy(struct arena *a);
+extern void *arena_grow(struct arena *a, size_t size);
+
+static inline void *arena_alloc(struct arena *a, size_t size)
+{
+	char *p = a->pos;
+
+	if ((size_t)(a->end - p) < size)
+		return arena_grow(a, size);
+	a->pos = p + size;
+	return p;
+}
+
+#endif /* ARENA_H__ */
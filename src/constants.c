@@ -181,6 +181,30 @@ const char *iproto_key_strs[IPROTO_KEY_MAX] = {
 	"stmt id",          /* 0x43 */
 };
 
+const char *vy_run_info_key_name[vy_run_info_key_MAX] = {
+	[VY_RUN_INFO_MIN_KEY]		= "min key",
+	[VY_RUN_INFO_MAX_KEY]		= "max key",
+	[VY_RUN_INFO_MIN_LSN]		= "min lsn",
+	[VY_RUN_INFO_MAX_LSN]		= "max lsn",
+	[VY_RUN_INFO_PAGE_COUNT]	= "page count",
+	[VY_RUN_INFO_BLOOM_LEGACY_V1]	= "bloom legacy v1",
+	[VY_RUN_INFO_BLOOM]		= "bloom",
+	[VY_RUN_INFO_STMT_STAT]		= "stmt stat",
+};
+
+const char *vy_page_info_key_name[vy_page_info_key_MAX] = {
+	[VY_PAGE_INFO_OFFSET]		= "offset",
+	[VY_PAGE_INFO_SIZE]		= "size",
+	[VY_PAGE_INFO_UNPACKED_SIZE]	= "unpacked size",
+	[VY_PAGE_INFO_ROW_COUNT]	= "row count",
+	[VY_PAGE_INFO_MIN_KEY]		= "min key",
+	[VY_PAGE_INFO_ROW_INDEX_OFFSET]	= "row index offset",
+};
+
+const char *vy_row_index_key_name[vy_row_index_key_MAX] = {
+	[VY_ROW_INDEX_DATA]		= "row index",
+};
+
 const char *vy_log_key_name[vy_log_key_MAX] = {
 	[VY_LOG_KEY_LSM_ID]		= "lsm_id",
 	[VY_LOG_KEY_RANGE_ID]		= "range_id",
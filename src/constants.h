@@ -91,6 +91,10 @@ enum {
 enum {
 	/** Set for the last xrow in a transaction. */
 	IPROTO_FLAG_COMMIT = 0x01,
+	/** Set for the last row of a tx residing in limbo. */
+	IPROTO_FLAG_WAIT_SYNC = 0x02,
+	/** Set for the last row of a synchronous tx. */
+	IPROTO_FLAG_WAIT_ACK = 0x04,
 };
 
 /**
@@ -211,6 +215,56 @@ enum vy_log_record_type {
 	vy_log_record_type_MAX
 };
 
+/* Keys of VY_INDEX_RUN_INFO body */
+enum vy_run_info_key {
+	VY_RUN_INFO_MIN_KEY		= 1,
+	VY_RUN_INFO_MAX_KEY		= 2,
+	VY_RUN_INFO_MIN_LSN		= 3,
+	VY_RUN_INFO_MAX_LSN		= 4,
+	VY_RUN_INFO_PAGE_COUNT		= 5,
+	VY_RUN_INFO_BLOOM_LEGACY_V1	= 6,
+	VY_RUN_INFO_BLOOM		= 7,
+	VY_RUN_INFO_STMT_STAT		= 8,
+
+	vy_run_info_key_MAX
+};
+
+/* Keys of VY_INDEX_PAGE_INFO body */
+enum vy_page_info_key {
+	VY_PAGE_INFO_OFFSET		= 1,
+	VY_PAGE_INFO_SIZE		= 2,
+	VY_PAGE_INFO_UNPACKED_SIZE	= 3,
+	VY_PAGE_INFO_ROW_COUNT		= 4,
+	VY_PAGE_INFO_MIN_KEY		= 5,
+	VY_PAGE_INFO_ROW_INDEX_OFFSET	= 6,
+
+	vy_page_info_key_MAX
+};
+
+/* Keys of VY_RUN_ROW_INDEX body */
+enum vy_row_index_key {
+	VY_ROW_INDEX_DATA		= 1,
+
+	vy_row_index_key_MAX
+};
+
+/* Ids of system spaces, see schema_def.h */
+enum schema_id {
+	BOX_SPACE_ID			= 280,
+	BOX_INDEX_ID			= 288,
+	BOX_TRUNCATE_ID			= 330,
+	/** Ids of system spaces are up to this one */
+	BOX_SYSTEM_ID_MAX		= 511,
+};
+
+enum {
+	/** Replicas a vclock has components for */
+	VCLOCK_MAX			= 32,
+};
+
+extern const char *vy_run_info_key_name[vy_run_info_key_MAX];
+extern const char *vy_page_info_key_name[vy_page_info_key_MAX];
+extern const char *vy_row_index_key_name[vy_row_index_key_MAX];
 extern const char *vy_log_key_name[vy_log_key_MAX];
 extern const char *vy_log_type_name[vy_log_record_type_MAX];
 
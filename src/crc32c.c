@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "crc32c.h"
+#include "load.h"
+
+#if defined(__x86_64__)
+# include <nmmintrin.h>
+# include <wmmintrin.h>
+#endif
+
+#define CRC32C_POLY	0x82f63b78u
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const char *buf, size_t len)
+{
+	const unsigned char *p = (const void *)buf;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+
+	/* Slicing by 8, little endian only */
+	while (len >= 8) {
+		uint64_t v = load_u64(p) ^ crc;
+
+		crc = crc32c_table[7][v & 0xff] ^
+		      crc32c_table[6][(v >> 8) & 0xff] ^
+		      crc32c_table[5][(v >> 16) & 0xff] ^
+		      crc32c_table[4][(v >> 24) & 0xff] ^
+		      crc32c_table[3][(v >> 32) & 0xff] ^
+		      crc32c_table[2][(v >> 40) & 0xff] ^
+		      crc32c_table[1][(v >> 48) & 0xff] ^
+		      crc32c_table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+uint32_t (*crc32c)(uint32_t crc, const char *buf, size_t len) = crc32c_sw;
+
+#if defined(__x86_64__)
+
+enum {
+	/* Lane sizes of the three way interleaved computation */
+	CRC32C_LANE_LONG	= 8192,
+	CRC32C_LANE_SHORT	= 256,
+};
+
+/* x^(8 * lane - 33) mod P, see crc32c_shift() */
+static uint32_t crc32c_k_long;
+static uint32_t crc32c_k_short;
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const char *buf, size_t len)
+{
+	const unsigned char *p = (const void *)buf;
+	uint64_t c = crc;
+
+	while (len && ((uintptr_t)p & 7)) {
+		c = _mm_crc32_u8(c, *p++);
+		len--;
+	}
+
+	while (len >= 8) {
+		c = _mm_crc32_u64(c, load_u64(p));
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		c = _mm_crc32_u8(c, *p++);
+
+	return c;
+}
+
+/*
+ * Multiply @crc by x^(8 * lane) modulo P: the carry-less
+ * product of reflected values is off by one degree and the
+ * crc32 instruction multiplies by x^32, hence @k is
+ * x^(8 * lane - 33) mod P.
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc32c_shift(uint32_t crc, uint32_t k)
+{
+	__m128i v = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+					 _mm_cvtsi32_si128(k), 0);
+	return _mm_crc32_u64(0, _mm_cvtsi128_si64(v));
+}
+
+/*
+ * The crc32 instruction has 3 cycles latency and 1 cycle
+ * throughput, so three independent lanes are computed at
+ * once and folded together with carry-less multiplication.
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc32c_3way(uint32_t crc, const unsigned char **pp,
+				   size_t *len, size_t lane, uint32_t k)
+{
+	const unsigned char *p = *pp;
+
+	while (*len >= 3 * lane) {
+		const unsigned char *end = p + lane;
+		uint64_t c0 = crc, c1 = 0, c2 = 0;
+
+		do {
+			c0 = _mm_crc32_u64(c0, load_u64(p));
+			c1 = _mm_crc32_u64(c1, load_u64(p + lane));
+			c2 = _mm_crc32_u64(c2, load_u64(p + 2 * lane));
+			p += 8;
+		} while (p < end);
+
+		crc = crc32c_shift(c0, k) ^ c1;
+		crc = crc32c_shift(crc, k) ^ c2;
+
+		p += 2 * lane;
+		*len -= 3 * lane;
+	}
+
+	*pp = p;
+	return crc;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_pclmul(uint32_t crc, const char *buf, size_t len)
+{
+	const unsigned char *p = (const void *)buf;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+
+	crc = crc32c_3way(crc, &p, &len, CRC32C_LANE_LONG, crc32c_k_long);
+	crc = crc32c_3way(crc, &p, &len, CRC32C_LANE_SHORT, crc32c_k_short);
+
+	return crc32c_sse42(crc, (const char *)p, len);
+}
+
+/* x^n mod P in reflected form */
+static uint32_t crc32c_xpow(unsigned int n)
+{
+	uint32_t r = 0x80000000u;
+
+	while (n--)
+		r = (r & 1) ? (r >> 1) ^ CRC32C_POLY : r >> 1;
+	return r;
+}
+
+#endif /* __x86_64__ */
+
+void crc32c_init(void)
+{
+	for (unsigned int n = 0; n < 256; n++) {
+		uint32_t c = n;
+
+		for (int i = 0; i < 8; i++)
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc32c_table[0][n] = c;
+	}
+
+	for (unsigned int n = 0; n < 256; n++) {
+		for (int k = 1; k < 8; k++) {
+			uint32_t c = crc32c_table[k - 1][n];
+			crc32c_table[k][n] = (c >> 8) ^ crc32c_table[0][c & 0xff];
+		}
+	}
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.2"))
+		return;
+
+	if (__builtin_cpu_supports("pclmul")) {
+		crc32c_k_long = crc32c_xpow(8 * CRC32C_LANE_LONG - 33);
+		crc32c_k_short = crc32c_xpow(8 * CRC32C_LANE_SHORT - 33);
+		crc32c = crc32c_pclmul;
+	} else
+		crc32c = crc32c_sse42;
+#endif
+}
@@ -0,0 +1,15 @@
+#ifndef CRC32C_H__
+#define CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli) without pre and post inversion,
+ * the way xlog blocks are checksummed.
+ */
+extern uint32_t (*crc32c)(uint32_t crc, const char *buf, size_t len);
+
+extern void crc32c_init(void);
+
+#endif /* CRC32C_H__ */
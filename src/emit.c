@@ -1,7 +1,16 @@
+#include <time.h>
+
 #include "compiler.h"
 #include "constants.h"
 #include "xlog.h"
+#include "emit.h"
+#include "tx.h"
+#include "stats.h"
+#include "memtx.h"
+#include "vinyl.h"
+#include "vylog.h"
 #include "log.h"
+#include "update.h"
 
 #include "msgpuck/msgpuck.h"
 
@@ -27,109 +36,160 @@ static const char *pr_mp_type(unsigned int type)
 
 static const char *pr_iproto_type(unsigned int type)
 {
-	return type < IPROTO_TYPE_MAX ?
+	return type < IPROTO_TYPE_MAX && iproto_type_strs[type] ?
 		iproto_type_strs[type] : "UNKNOWN";
 }
 
-void emit_hr(void)
+/*
+ * Body key name of a row, vinyl service rows
+ * have their own keys. NULL if unknown.
+ */
+const char *emit_key_name(uint32_t type, uint64_t key)
 {
-	pr_info("-------\n");
+	switch (type) {
+	case VY_INDEX_RUN_INFO:
+		return key < vy_run_info_key_MAX ? vy_run_info_key_name[key] : NULL;
+	case VY_INDEX_PAGE_INFO:
+		return key < vy_page_info_key_MAX ? vy_page_info_key_name[key] : NULL;
+	case VY_RUN_ROW_INDEX:
+		return key < vy_row_index_key_MAX ? vy_row_index_key_name[key] : NULL;
+	default:
+		return key < IPROTO_KEY_MAX ? iproto_key_strs[key] : NULL;
+	}
 }
 
-void emit_xlog_fixheader(const struct xlog_fixheader *xhdr)
+void emit_hr(struct obuf *out)
 {
-	pr_info("fixed header\n");
-	emit_hr();
-	pr_info("  magic %#8x crc32p %#x crc32c %#x len %d\n",
-		xhdr->magic, xhdr->crc32p, xhdr->crc32c, xhdr->len);
-	emit_hr();
+	obuf_puts(out, "-------\n");
+}
+
+static void emit_meta(struct obuf *out, xlog_ctx_t *ctx)
+{
+	for (size_t i = 0; i < XLOG_META_MAX; i++) {
+		if (ctx->meta_values[i][0]) {
+			obuf_printf(out, "meta: %-20s: '%s'\n",
+				    xlog_meta_keys[i], ctx->meta_values[i]);
+		}
+	}
 }
 
-void emit_xlog_header(const struct xrow_header *hdr)
+static void emit_notice(struct obuf *out, xlog_ctx_t *ctx, const char *msg)
 {
-	pr_info("xrow header\n");
-	emit_hr();
-	pr_info("  type %#x (%s) replica_id %#x group_id %#x "
-		"sync %lld lsn %lld tm %3.4g tsn %lld is_commit %d "
-		"bodycnt %d schema_version %#x\n",
-		hdr->type, pr_iproto_type(hdr->type),
-		hdr->replica_id,
-		hdr->group_id,
-		hdr->sync,
-		hdr->lsn,
-		hdr->tm,
-		hdr->tsn,
-		hdr->is_commit,
-		hdr->bodycnt);
-	for (size_t i = 0; i < hdr->bodycnt; i++)
-		pr_info("    iov: len %zu\n", hdr->body[i].iov_len);
-	emit_hr();
+	obuf_puts(out, msg);
+	obuf_putc(out, '\n');
 }
 
-void emit_value(xlog_ctx_t *ctx, const char **pos, const char *end)
+static void emit_xlog_fixheader(struct obuf *out, xlog_ctx_t *ctx,
+				const struct xlog_fixheader *xhdr)
+{
+	obuf_puts(out, "fixed header\n");
+	emit_hr(out);
+	obuf_printf(out, "  magic %#8x crc32p %#x crc32c %#x len %d\n",
+		    xhdr->magic, xhdr->crc32p, xhdr->crc32c, xhdr->len);
+	emit_hr(out);
+}
+
+static void emit_xlog_header(struct obuf *out, xlog_ctx_t *ctx,
+			     const struct xrow_header *hdr)
+{
+	obuf_puts(out, "xrow header\n");
+	emit_hr(out);
+	obuf_puts(out, "  type ");
+	obuf_put_hex(out, hdr->type);
+	obuf_puts(out, " (");
+	obuf_puts(out, pr_iproto_type(hdr->type));
+	obuf_puts(out, ") replica_id ");
+	obuf_put_hex(out, hdr->replica_id);
+	obuf_puts(out, " group_id ");
+	obuf_put_hex(out, hdr->group_id);
+	obuf_puts(out, " sync ");
+	obuf_put_i64(out, hdr->sync);
+	obuf_puts(out, " lsn ");
+	obuf_put_i64(out, hdr->lsn);
+	obuf_printf(out, " tm %3.4g", hdr->tm);
+	obuf_puts(out, " tsn ");
+	obuf_put_i64(out, hdr->tsn);
+	obuf_puts(out, " is_commit ");
+	obuf_put_u64(out, hdr->is_commit);
+	obuf_puts(out, " bodycnt ");
+	obuf_put_i64(out, hdr->bodycnt);
+	obuf_puts(out, " schema_version ");
+	obuf_put_hex(out, hdr->schema_version);
+	obuf_putc(out, '\n');
+	for (size_t i = 0; i < hdr->bodycnt; i++) {
+		obuf_puts(out, "    iov: len ");
+		obuf_put_u64(out, hdr->body[i].iov_len);
+		obuf_putc(out, '\n');
+	}
+	emit_hr(out);
+}
+
+void emit_value(struct obuf *out, xlog_ctx_t *ctx, const char **pos, const char *end)
 {
-	char buf[4096];
 	int type = mp_typeof(**pos);
 	switch (type) {
 	case MP_NIL:
-		pr_info("nil");
+		obuf_puts(out, "nil");
 		mp_decode_nil(pos);
 		break;
 	case MP_UINT:
-		pr_info("%#llu", mp_decode_uint(pos));
+		obuf_put_u64(out, mp_decode_uint(pos));
 		break;
 	case MP_INT:
-		pr_info("%#lld", mp_decode_int(pos));
+		obuf_put_i64(out, mp_decode_int(pos));
 		break;
 	case MP_STR: {
 		uint32_t len;
 		const char *str = mp_decode_str(pos, &len);
-		if (len >= sizeof(buf))
-			len = sizeof(buf)-1;
-		memcpy(buf, str, len);
-		buf[len] = '\0';
-		pr_info("%s", buf);
+		if (len > EMIT_STR_MAX)
+			len = EMIT_STR_MAX;
+		obuf_put(out, str, strnlen(str, len));
 		break;
 	}
 	case MP_BIN: {
 		uint32_t len;
 		const char *str = mp_decode_bin(pos, &len);
-		pr_info("%*s", len, str);
+		size_t n = strnlen(str, len);
+		obuf_put(out, str, n);
+		for (; n < len; n++)
+			obuf_putc(out, ' ');
 		break;
 	}
 	case MP_ARRAY: {
 		uint32_t size = mp_decode_array(pos);
-		pr_info("{");
+		obuf_putc(out, '{');
 		for (size_t i = 0; i < size; i++) {
-			emit_value(ctx, pos, end);
-			pr_info("%s", i < size-1 ? ", " : "");
+			emit_value(out, ctx, pos, end);
+			if (i < size-1)
+				obuf_puts(out, ", ");
 		}
-		pr_info("}");
+		obuf_putc(out, '}');
 		break;
 	}
 	case MP_MAP: {
 		uint32_t size = mp_decode_map(pos);
-		pr_info("{");
+		obuf_putc(out, '{');
 		for (size_t i = 0; i < size; i++) {
-			emit_value(ctx, pos, end);
-			pr_info(": ");
-			emit_value(ctx, pos, end);
-			pr_info("%s", i < size-1 ? ", " : "");
+			emit_value(out, ctx, pos, end);
+			obuf_puts(out, ": ");
+			emit_value(out, ctx, pos, end);
+			if (i < size-1)
+				obuf_puts(out, ", ");
 		}
-		pr_info("}");
+		obuf_putc(out, '}');
 		break;
 	}
 	case MP_BOOL:
-		pr_info("%s", mp_decode_bool(pos) ? "true" : "false");
+		obuf_puts(out, mp_decode_bool(pos) ? "true" : "false");
 		break;
 	case MP_FLOAT:
-		pr_info("%g", mp_decode_float(pos));
+		obuf_put_double(out, mp_decode_float(pos));
 		break;
 	case MP_DOUBLE:
-		pr_info("%g", mp_decode_double(pos));
+		obuf_put_double(out, mp_decode_double(pos));
 		break;
 	case MP_EXT:
-		pr_info("ext");
+		obuf_puts(out, "ext");
 		mp_next(pos);
 		break;
 	default:
@@ -137,13 +197,116 @@ void emit_value(xlog_ctx_t *ctx, const char **pos, const char *end)
 	}
 }
 
-void emit_xlog_data(xlog_ctx_t *ctx, const char *pos, const char *end)
+static void emit_row_index(struct obuf *out, const char **pos)
 {
+	uint32_t len;
+	const char *data = mp_decode_bin(pos, &len);
+
+	obuf_putc(out, '{');
+	for (uint32_t i = 0; i < len / sizeof(uint32_t); i++) {
+		if (i)
+			obuf_puts(out, ", ");
+		obuf_put_u64(out, vy_row_index_get(data, i));
+	}
+	obuf_putc(out, '}');
+}
+
+/* Vylog record as type and its keys by names */
+static void emit_vylog_record(struct obuf *out, xlog_ctx_t *ctx, uint32_t type,
+			      const char *pos, const char *end)
+{
+	uint32_t size = mp_decode_map(&pos);
+
+	obuf_puts(out, "record: ");
+	if (type < vy_log_record_type_MAX && vy_log_type_name[type])
+		obuf_puts(out, vy_log_type_name[type]);
+	else
+		obuf_put_u64(out, type);
+
+	for (uint32_t i = 0; i < size; i++) {
+		obuf_puts(out, i ? ", " : " {");
+		if (mp_typeof(*pos) == MP_UINT) {
+			uint64_t key = mp_decode_uint(&pos);
+			if (key < vy_log_key_MAX && vy_log_key_name[key])
+				obuf_puts(out, vy_log_key_name[key]);
+			else
+				obuf_put_u64(out, key);
+		} else
+			emit_value(out, ctx, &pos, end);
+		obuf_puts(out, ": ");
+		emit_value(out, ctx, &pos, end);
+	}
+	obuf_puts(out, size ? "}\n" : "\n");
+}
+
+/* Operations as {#2 += 1, #3 = x, ...}, fields are numbered as given */
+static void emit_update_ops(struct obuf *out, xlog_ctx_t *ctx,
+			    const char **pos, const char *end)
+{
+	uint32_t nr = mp_decode_array(pos);
+	struct update_op op;
+	const char *arg;
+	uint32_t len;
+
+	obuf_putc(out, '{');
+	for (uint32_t i = 0; i < nr; i++) {
+		update_op_decode(&op, pos);
+		if (i)
+			obuf_puts(out, ", ");
+		obuf_putc(out, '#');
+		obuf_put_i64(out, op.field);
+		switch (op.opcode) {
+		case '#':
+			obuf_puts(out, " delete ");
+			obuf_put_i64(out, op.a);
+			break;
+		case ':':
+			len = op.arg_len > EMIT_STR_MAX ? EMIT_STR_MAX : op.arg_len;
+			obuf_puts(out, " splice at ");
+			obuf_put_i64(out, op.a);
+			obuf_puts(out, " cut ");
+			obuf_put_i64(out, op.b);
+			obuf_puts(out, " with ");
+			obuf_put(out, op.arg, strnlen(op.arg, len));
+			break;
+		case '!':
+			obuf_puts(out, " insert ");
+			goto value;
+		case '=':
+			obuf_puts(out, " = ");
+			goto value;
+		default:
+			obuf_putc(out, ' ');
+			obuf_putc(out, op.opcode);
+			obuf_puts(out, "= ");
+		value:
+			arg = op.arg;
+			emit_value(out, ctx, &arg, end);
+		}
+	}
+	obuf_putc(out, '}');
+}
+
+static void emit_xlog_data(struct obuf *out, xlog_ctx_t *ctx,
+			   const struct xrow_header *hdr,
+			   const char *pos, const char *end)
+{
+	const char *fields;
+	uint32_t type;
+	bool vinyl = hdr->type >= VY_INDEX_RUN_INFO &&
+		     hdr->type <= VY_RUN_ROW_INDEX;
+
 	if (mp_typeof(pos[0]) != MP_MAP) {
 		pr_err("map expected but got %d\n", mp_typeof(pos[0]));
 		return;
 	}
 
+	if (ctx->file_type == WAL_TYPE_VY_XLOG &&
+	    (fields = vy_log_record_fields(pos, &type))) {
+		emit_vylog_record(out, ctx, type, fields, end);
+		return;
+	}
+
 	uint32_t size = mp_decode_map(&pos);
 	for (uint32_t i = 0; i < size; i++) {
 		if (mp_typeof(*pos) != MP_UINT) {
@@ -152,15 +315,375 @@ void emit_xlog_data(xlog_ctx_t *ctx, const char *pos, const char *end)
 		}
 
 		uint64_t key = mp_decode_uint(&pos);
-		if (key >= IPROTO_KEY_MAX ||
-		    iproto_key_type[key] != mp_typeof(*pos)) {
-			pr_err("unknown key %#llx\n", key);
+		const char *name = emit_key_name(hdr->type, key);
+		if (!name || (!vinyl && iproto_key_type[key] != mp_typeof(*pos))) {
+			pr_err("unknown key %#llx\n", (unsigned long long)key);
 			return;
 		}
 
-		pr_info("key: %#llx '%s' ", key, iproto_key_strs[key]);
-		pr_info("value: ");
-		emit_value(ctx, &pos, end);
-		pr_info("\n");
+		obuf_puts(out, "key: ");
+		obuf_put_hex(out, key);
+		obuf_puts(out, " '");
+		obuf_puts(out, name);
+		obuf_puts(out, "' value: ");
+		if (hdr->type == VY_RUN_ROW_INDEX && key == VY_ROW_INDEX_DATA &&
+		    mp_typeof(*pos) == MP_BIN)
+			emit_row_index(out, &pos);
+		else if (update_ops_key(hdr->type, key) && update_ops_valid(pos))
+			emit_update_ops(out, ctx, &pos, end);
+		else
+			emit_value(out, ctx, &pos, end);
+		obuf_putc(out, '\n');
+	}
+}
+
+static void emit_end_row(struct obuf *out, xlog_ctx_t *ctx)
+{
+}
+
+static void emit_end_block(struct obuf *out, xlog_ctx_t *ctx)
+{
+	emit_hr(out);
+}
+
+static void emit_tx_header(struct obuf *out, xlog_ctx_t *ctx,
+			   const struct xtx *tx)
+{
+	obuf_puts(out, "transaction\n");
+	emit_hr(out);
+	obuf_puts(out, "  replica_id ");
+	obuf_put_hex(out, tx->replica_id);
+	obuf_puts(out, " tsn ");
+	obuf_put_i64(out, tx->tsn);
+	obuf_puts(out, " lsn ");
+	obuf_put_i64(out, tx->first_lsn);
+	obuf_puts(out, "..");
+	obuf_put_i64(out, tx->last_lsn);
+	obuf_puts(out, " rows ");
+	obuf_put_u64(out, tx->nr_rows);
+	obuf_puts(out, " size ");
+	obuf_put_u64(out, tx->size);
+	obuf_printf(out, " duration %g", tx->last_tm - tx->first_tm);
+	obuf_puts(out, " status ");
+	obuf_puts(out, xtx_status_strs[tx->status]);
+	obuf_puts(out, " continued ");
+	obuf_put_u64(out, tx->continued);
+	obuf_puts(out, "\n  statements");
+	for (size_t i = 0; i < IPROTO_TYPE_STAT_MAX; i++) {
+		if (!tx->nr_stmts[i])
+			continue;
+		obuf_putc(out, ' ');
+		obuf_puts(out, pr_iproto_type(i));
+		obuf_putc(out, ' ');
+		obuf_put_u64(out, tx->nr_stmts[i]);
+	}
+	if (tx->nr_other) {
+		obuf_puts(out, " OTHER ");
+		obuf_put_u64(out, tx->nr_other);
+	}
+	obuf_putc(out, '\n');
+	emit_hr(out);
+}
+
+static void emit_end_tx(struct obuf *out, xlog_ctx_t *ctx)
+{
+	emit_hr(out);
+}
+
+static const uint32_t stats_types[] = {
+	IPROTO_INSERT, IPROTO_REPLACE, IPROTO_UPDATE,
+	IPROTO_DELETE, IPROTO_UPSERT, IPROTO_NOP,
+};
+
+static void emit_stats_time(struct obuf *out, double tm)
+{
+	time_t t = tm;
+	struct tm tmv;
+	char buf[32];
+
+	if (tm <= 0 || !gmtime_r(&t, &tmv) ||
+	    !strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tmv))
+		obuf_puts(out, "-");
+	else
+		obuf_puts(out, buf);
+}
+
+static void emit_stats_rate(struct obuf *out, const struct stats_counters *c,
+			    uint64_t v)
+{
+	double span = c->max_tm - c->min_tm;
+
+	if (c->min_tm > 0 && span > 0)
+		obuf_printf(out, " %10.1f", v / span);
+	else
+		obuf_printf(out, " %10s", "-");
+}
+
+static void emit_stats_counters(struct obuf *out, uint64_t id,
+				const struct stats_counters *c)
+{
+	uint64_t other = c->rows, nr_tuples = 0;
+
+	for (size_t i = 0; i < STATS_SIZE_BUCKETS; i++)
+		nr_tuples += c->tuple_sizes[i];
+
+	if (id == STATS_NO_SPACE)
+		obuf_printf(out, "%10s", "-");
+	else
+		obuf_printf(out, "%10llu", (unsigned long long)id);
+	obuf_printf(out, " %10llu %12llu", (unsigned long long)c->rows,
+		    (unsigned long long)c->bytes);
+	for (size_t i = 0; i < ARRAY_SIZE(stats_types); i++) {
+		obuf_printf(out, " %8llu",
+			    (unsigned long long)c->nr_types[stats_types[i]]);
+		other -= c->nr_types[stats_types[i]];
+	}
+	obuf_printf(out, " %8llu", (unsigned long long)other);
+	obuf_printf(out, " %8llu %6llu %6llu",
+		    (unsigned long long)(nr_tuples ? c->tuple_bytes / nr_tuples : 0),
+		    (unsigned long long)stats_size_quantile(c, 0.5),
+		    (unsigned long long)stats_size_quantile(c, 0.99));
+	emit_stats_rate(out, c, c->rows);
+	emit_stats_rate(out, c, c->bytes);
+	obuf_putc(out, '\n');
+}
+
+static void emit_stats_table(struct obuf *out, const char *name,
+			     const struct id_hash *h)
+{
+	uint64_t *ids = id_hash_ids(h);
+
+	if (!ids)
+		return;
+
+	obuf_printf(out, "%10s %10s %12s", name, "rows", "bytes");
+	for (size_t i = 0; i < ARRAY_SIZE(stats_types); i++)
+		obuf_printf(out, " %8s", pr_iproto_type(stats_types[i]));
+	obuf_printf(out, " %8s %8s %6s %6s %10s %10s\n", "OTHER",
+		    "tuple", "p50", "p99", "rows/s", "bytes/s");
+	for (size_t i = 0; i < h->nr; i++)
+		emit_stats_counters(out, ids[i], id_hash_get(h, ids[i]));
+	free(ids);
+	emit_hr(out);
+}
+
+static void emit_stats(struct obuf *out, const struct stats *st)
+{
+	const struct stats_counters *c = &st->total;
+	uint64_t *ids;
+
+	obuf_printf(out, "files %llu blocks %llu zstd %llu disk %llu raw %llu",
+		    (unsigned long long)st->files, (unsigned long long)st->blocks,
+		    (unsigned long long)st->zblocks,
+		    (unsigned long long)st->disk_bytes,
+		    (unsigned long long)st->raw_bytes);
+	if (st->disk_bytes)
+		obuf_printf(out, " ratio %.2f",
+			    (double)st->raw_bytes / st->disk_bytes);
+	obuf_printf(out, "\nrows %llu bytes %llu lsn %lld..%lld time ",
+		    (unsigned long long)c->rows, (unsigned long long)c->bytes,
+		    (long long)c->min_lsn, (long long)c->max_lsn);
+	emit_stats_time(out, c->min_tm);
+	obuf_puts(out, " .. ");
+	emit_stats_time(out, c->max_tm);
+	obuf_putc(out, '\n');
+	emit_hr(out);
+
+	emit_stats_table(out, "space", &st->spaces);
+	emit_stats_table(out, "replica", &st->replicas);
+
+	if (!st->rates.nr)
+		return;
+	ids = id_hash_ids(&st->rates);
+	if (!ids)
+		return;
+	obuf_printf(out, "%-19s %10s %12s\n", "time", "rows", "bytes");
+	for (size_t i = 0; i < st->rates.nr; i++) {
+		const struct stats_rate *r = id_hash_get(&st->rates, ids[i]);
+
+		emit_stats_time(out, (double)ids[i] * STATS_TIME_STEP);
+		obuf_printf(out, " %10llu %12llu\n", (unsigned long long)r->rows,
+			    (unsigned long long)r->bytes);
+	}
+	free(ids);
+	emit_hr(out);
+}
+
+static void emit_summary(struct obuf *out, xlog_ctx_t *ctx,
+			 const struct xlog_summary *sum)
+{
+	obuf_printf(out, "%s: %s blocks %llu zstd %llu disk %llu rows %llu "
+		    "bytes %llu lsn %lld..%lld time ", ctx->path,
+		    xlog_type_name(ctx->file_type),
+		    (unsigned long long)sum->blocks,
+		    (unsigned long long)sum->zblocks,
+		    (unsigned long long)sum->disk_bytes,
+		    (unsigned long long)sum->rows,
+		    (unsigned long long)sum->bytes,
+		    (long long)sum->min_lsn, (long long)sum->max_lsn);
+	emit_stats_time(out, sum->min_tm);
+	obuf_puts(out, " .. ");
+	emit_stats_time(out, sum->max_tm);
+	if (sum->min_tm > 0)
+		obuf_printf(out, " span %gs", sum->max_tm - sum->min_tm);
+	obuf_putc(out, '\n');
+}
+
+static void emit_tuple(struct obuf *out, uint32_t space_id, const char *tuple)
+{
+	obuf_puts(out, "space ");
+	obuf_put_u64(out, space_id);
+	obuf_puts(out, ": ");
+	emit_value(out, NULL, &tuple, NULL);
+	obuf_putc(out, '\n');
+}
+
+/* Same as vclocks in meta, {1: 17, 2: 5} */
+static void emit_vclock(struct obuf *out, const int64_t *vclock)
+{
+	bool first = true;
+
+	obuf_putc(out, '{');
+	for (int i = 0; i < VCLOCK_MAX; i++) {
+		if (!vclock[i])
+			continue;
+		if (!first)
+			obuf_puts(out, ", ");
+		obuf_printf(out, "%d: %lld", i, (long long)vclock[i]);
+		first = false;
+	}
+	obuf_putc(out, '}');
+}
+
+static void emit_replay(struct obuf *out, const struct memtx_summary *sum)
+{
+	emit_hr(out);
+	obuf_printf(out, "snapshot %s xlogs %llu snapshot rows %llu applied %llu "
+		    "skipped %llu failed %llu unresolved %llu\n"
+		    "spaces %llu tuples %llu vclock ",
+		    sum->snap ? sum->snap : "-",
+		    (unsigned long long)sum->nr_xlogs,
+		    (unsigned long long)sum->snap_rows,
+		    (unsigned long long)sum->applied,
+		    (unsigned long long)sum->skipped,
+		    (unsigned long long)sum->failed,
+		    (unsigned long long)sum->unresolved,
+		    (unsigned long long)sum->spaces,
+		    (unsigned long long)sum->tuples);
+	emit_vclock(out, sum->vclock);
+	obuf_putc(out, '\n');
+	if (sum->written)
+		obuf_printf(out, "written %s\n", sum->written);
+}
+
+static void emit_key(struct obuf *out, const char *name, const char *key)
+{
+	obuf_puts(out, name);
+	if (key)
+		emit_value(out, NULL, &key, NULL);
+	else
+		obuf_puts(out, "nil");
+}
+
+static void emit_layout_lsm(struct obuf *out, const struct vy_layout *l,
+			    const struct vy_lsm_recovery_info *lsm)
+{
+	obuf_printf(out, "lsm %lld: space %u index %u group %u "
+		    "create_lsn %lld modify_lsn %lld dump_lsn %lld",
+		    (long long)lsm->id, lsm->space_id, lsm->index_id,
+		    lsm->group_id, (long long)lsm->create_lsn,
+		    (long long)lsm->modify_lsn, (long long)lsm->dump_lsn);
+	if (lsm->prepared)
+		obuf_puts(out, " prepared");
+	if (lsm->dropped)
+		obuf_printf(out, " dropped drop_lsn %lld", (long long)lsm->drop_lsn);
+	obuf_putc(out, '\n');
+	emit_key(out, "  key_def ", lsm->key_def);
+	obuf_putc(out, '\n');
+
+	for (size_t i = vy_layout_ranges(l, lsm->id); i < l->nr_ranges; i++) {
+		const struct vy_range_recovery_info *range = l->ranges[i];
+
+		if (range->lsm_id != lsm->id)
+			break;
+
+		obuf_printf(out, "  range %lld:", (long long)range->id);
+		emit_key(out, " begin ", range->begin);
+		emit_key(out, " end ", range->end);
+		obuf_putc(out, '\n');
+
+		for (size_t j = vy_layout_slices(l, range->id); j < l->nr_slices; j++) {
+			const struct vy_slice_recovery_info *slice = l->slices[j];
+
+			if (slice->range_id != range->id)
+				break;
+
+			obuf_printf(out, "    slice %lld: run %lld",
+				    (long long)slice->id, (long long)slice->run_id);
+			emit_key(out, " begin ", slice->begin);
+			emit_key(out, " end ", slice->end);
+			obuf_putc(out, '\n');
+		}
+	}
+
+	for (size_t i = vy_layout_runs(l, lsm->id); i < l->nr_runs; i++) {
+		const struct vy_run_recovery_info *run = l->runs[i];
+
+		if (run->lsm_id != lsm->id)
+			break;
+
+		obuf_printf(out, "  run %lld: dump_lsn %lld dump_count %u",
+			    (long long)run->id, (long long)run->dump_lsn,
+			    run->dump_count);
+		if (run->prepared)
+			obuf_puts(out, " prepared");
+		if (run->dropped)
+			obuf_printf(out, " dropped gc_lsn %lld", (long long)run->gc_lsn);
+		obuf_putc(out, '\n');
+	}
+}
+
+static void emit_layout(struct obuf *out, xlog_ctx_t *ctx,
+			const struct vy_layout *l)
+{
+	for (size_t i = 0; i < l->nr_lsms; i++)
+		emit_layout_lsm(out, l, l->lsms[i]);
+
+	obuf_printf(out, "%zu lsms, %zu ranges, %zu runs, %zu slices "
+		    "from %llu records, %llu mismatches\n",
+		    l->nr_lsms, l->nr_ranges, l->nr_runs, l->nr_slices,
+		    (unsigned long long)l->nr_records,
+		    (unsigned long long)l->nr_errors);
+}
+
+const struct emitter emitter_text = {
+	.name		= "text",
+	.meta		= emit_meta,
+	.notice		= emit_notice,
+	.begin_block	= emit_xlog_fixheader,
+	.row_header	= emit_xlog_header,
+	.body		= emit_xlog_data,
+	.end_row	= emit_end_row,
+	.end_block	= emit_end_block,
+	.begin_tx	= emit_tx_header,
+	.end_tx		= emit_end_tx,
+	.stats		= emit_stats,
+	.summary	= emit_summary,
+	.tuple		= emit_tuple,
+	.replay		= emit_replay,
+	.layout		= emit_layout,
+};
+
+static const struct emitter *emitters[] = {
+	&emitter_text,
+	&emitter_json,
+};
+
+const struct emitter *emitter_lookup(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(emitters); i++) {
+		if (!strcmp(emitters[i]->name, name))
+			return emitters[i];
 	}
+	return NULL;
 }
@@ -2,11 +2,63 @@
 #define EMIT_H__
 
 #include "xlog.h"
+#include "obuf.h"
 
-extern void emit_xlog_fixheader(const struct xlog_fixheader *xhdr);
-extern void emit_xlog_header(const struct xrow_header *hdr);
-extern void emit_value(xlog_ctx_t *ctx, const char **pos, const char *end);
-extern void emit_xlog_data(xlog_ctx_t *ctx, const char *pos, const char *end);
-extern void emit_hr(void);
+enum {
+	/** Strings are cut to this length on output */
+	EMIT_STR_MAX		= 4095,
+};
+
+struct xtx;
+struct stats;
+struct memtx_summary;
+struct vy_layout;
+
+/*
+ * Output format. The hooks are called for every block
+ * and every row in it, a row without a body gets no
+ * body() call. In transaction mode the rows are put
+ * between begin_tx() and end_tx() instead of blocks.
+ * With --stats nothing but stats() is called, once,
+ * with --summary only summary() is, once per file. A
+ * replay calls tuple() for every tuple left and then
+ * replay() once, a vylog replayed by --layout gets a
+ * layout() call instead of the rows.
+ */
+struct emitter {
+	const char	*name;
+	void		(*meta)(struct obuf *out, xlog_ctx_t *ctx);
+	void		(*notice)(struct obuf *out, xlog_ctx_t *ctx, const char *msg);
+	void		(*begin_block)(struct obuf *out, xlog_ctx_t *ctx,
+				       const struct xlog_fixheader *xhdr);
+	void		(*row_header)(struct obuf *out, xlog_ctx_t *ctx,
+				      const struct xrow_header *hdr);
+	void		(*body)(struct obuf *out, xlog_ctx_t *ctx,
+				const struct xrow_header *hdr,
+				const char *pos, const char *end);
+	void		(*end_row)(struct obuf *out, xlog_ctx_t *ctx);
+	void		(*end_block)(struct obuf *out, xlog_ctx_t *ctx);
+	void		(*begin_tx)(struct obuf *out, xlog_ctx_t *ctx,
+				    const struct xtx *tx);
+	void		(*end_tx)(struct obuf *out, xlog_ctx_t *ctx);
+	void		(*stats)(struct obuf *out, const struct stats *st);
+	void		(*summary)(struct obuf *out, xlog_ctx_t *ctx,
+				   const struct xlog_summary *sum);
+	void		(*tuple)(struct obuf *out, uint32_t space_id,
+				 const char *tuple);
+	void		(*replay)(struct obuf *out,
+				  const struct memtx_summary *sum);
+	void		(*layout)(struct obuf *out, xlog_ctx_t *ctx,
+				  const struct vy_layout *l);
+};
+
+extern const struct emitter emitter_text;
+extern const struct emitter emitter_json;
+
+extern const struct emitter *emitter_lookup(const char *name);
+
+extern const char *emit_key_name(uint32_t type, uint64_t key);
+extern void emit_value(struct obuf *out, xlog_ctx_t *ctx, const char **pos, const char *end);
+extern void emit_hr(struct obuf *out);
 
 #endif /* EMIT_H__ */
@@ -0,0 +1,797 @@
+#include <math.h>
+
+#include "compiler.h"
+#include "constants.h"
+#include "xlog.h"
+#include "emit.h"
+#include "tx.h"
+#include "stats.h"
+#include "memtx.h"
+#include "vinyl.h"
+#include "vylog.h"
+#include "log.h"
+#include "update.h"
+
+#include "msgpuck/msgpuck.h"
+
+/*
+ * JSON Lines output: a line with meta per file and
+ * a line per row. Strings are emitted as is, apart
+ * from escaping, so invalid UTF-8 is passed through.
+ */
+
+static const char json_xdigits[] = "0123456789abcdef";
+
+static void json_put_str(struct obuf *out, const char *s, size_t len)
+{
+	const char *run = s, *end = s + len;
+
+	obuf_putc(out, '"');
+	for (; s < end; s++) {
+		unsigned char c = *s;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		obuf_put(out, run, s - run);
+		switch (c) {
+		case '"':
+			obuf_puts(out, "\\\"");
+			break;
+		case '\\':
+			obuf_puts(out, "\\\\");
+			break;
+		case '\n':
+			obuf_puts(out, "\\n");
+			break;
+		case '\r':
+			obuf_puts(out, "\\r");
+			break;
+		case '\t':
+			obuf_puts(out, "\\t");
+			break;
+		default: {
+			char u[6] = {
+				'\\', 'u', '0', '0',
+				json_xdigits[c >> 4],
+				json_xdigits[c & 0xf],
+			};
+			obuf_put(out, u, sizeof(u));
+		}
+		}
+		run = s + 1;
+	}
+	obuf_put(out, run, end - run);
+	obuf_putc(out, '"');
+}
+
+static void json_put_hex(struct obuf *out, const char *s, uint32_t len)
+{
+	char *p = obuf_reserve(out, 2 * (size_t)len + 2);
+
+	if (!p)
+		return;
+
+	*p++ = '"';
+	for (uint32_t i = 0; i < len; i++) {
+		*p++ = json_xdigits[(unsigned char)s[i] >> 4];
+		*p++ = json_xdigits[(unsigned char)s[i] & 0xf];
+	}
+	*p++ = '"';
+	out->len += 2 * (size_t)len + 2;
+}
+
+static void json_put_double(struct obuf *out, double v)
+{
+	if (!isfinite(v))
+		obuf_puts(out, "null");
+	else if (v > -1e15 && v < 1e15 && v == (int64_t)v)
+		obuf_put_i64(out, (int64_t)v);
+	else
+		obuf_printf(out, "%.17g", v);
+}
+
+/* Key names are the text ones with spaces replaced */
+static void json_put_key(struct obuf *out, const char *name)
+{
+	size_t len = strlen(name);
+	char *p = obuf_reserve(out, len + 3);
+
+	if (!p)
+		return;
+
+	*p++ = '"';
+	for (size_t i = 0; i < len; i++) {
+		char c = name[i];
+		*p++ = c == ' ' ? '_' : (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+	}
+	*p++ = '"';
+	*p++ = ':';
+	out->len += len + 3;
+}
+
+static void json_value(struct obuf *out, const char **pos);
+
+static void json_map_key(struct obuf *out, const char **pos)
+{
+	switch (mp_typeof(**pos)) {
+	case MP_STR:
+		json_value(out, pos);
+		break;
+	case MP_UINT:
+		obuf_putc(out, '"');
+		obuf_put_u64(out, mp_decode_uint(pos));
+		obuf_putc(out, '"');
+		break;
+	case MP_INT:
+		obuf_putc(out, '"');
+		obuf_put_i64(out, mp_decode_int(pos));
+		obuf_putc(out, '"');
+		break;
+	default: {
+		/* Any other key is stringified */
+		struct obuf tmp = { .fd = -1, };
+
+		json_value(&tmp, pos);
+		json_put_str(out, tmp.buf, tmp.len);
+		obuf_fini(&tmp);
+	}
+	}
+}
+
+static void json_value(struct obuf *out, const char **pos)
+{
+	switch (mp_typeof(**pos)) {
+	case MP_NIL:
+		mp_decode_nil(pos);
+		obuf_puts(out, "null");
+		break;
+	case MP_UINT:
+		obuf_put_u64(out, mp_decode_uint(pos));
+		break;
+	case MP_INT:
+		obuf_put_i64(out, mp_decode_int(pos));
+		break;
+	case MP_STR: {
+		uint32_t len;
+		const char *str = mp_decode_str(pos, &len);
+		json_put_str(out, str, len);
+		break;
+	}
+	case MP_BIN: {
+		uint32_t len;
+		const char *bin = mp_decode_bin(pos, &len);
+		json_put_hex(out, bin, len);
+		break;
+	}
+	case MP_ARRAY: {
+		uint32_t size = mp_decode_array(pos);
+		obuf_putc(out, '[');
+		for (uint32_t i = 0; i < size; i++) {
+			if (i)
+				obuf_putc(out, ',');
+			json_value(out, pos);
+		}
+		obuf_putc(out, ']');
+		break;
+	}
+	case MP_MAP: {
+		uint32_t size = mp_decode_map(pos);
+		obuf_putc(out, '{');
+		for (uint32_t i = 0; i < size; i++) {
+			if (i)
+				obuf_putc(out, ',');
+			json_map_key(out, pos);
+			obuf_putc(out, ':');
+			json_value(out, pos);
+		}
+		obuf_putc(out, '}');
+		break;
+	}
+	case MP_BOOL:
+		obuf_puts(out, mp_decode_bool(pos) ? "true" : "false");
+		break;
+	case MP_FLOAT:
+		json_put_double(out, mp_decode_float(pos));
+		break;
+	case MP_DOUBLE:
+		json_put_double(out, mp_decode_double(pos));
+		break;
+	case MP_EXT: {
+		uint32_t len;
+		int8_t type;
+		const char *data = mp_decode_ext(pos, &type, &len);
+		obuf_puts(out, "{\"ext\":");
+		obuf_put_i64(out, type);
+		obuf_puts(out, ",\"data\":");
+		json_put_hex(out, data, len);
+		obuf_putc(out, '}');
+		break;
+	}
+	default:
+		mp_next(pos);
+		obuf_puts(out, "null");
+	}
+}
+
+static void json_meta(struct obuf *out, xlog_ctx_t *ctx)
+{
+	bool first = true;
+
+	obuf_puts(out, "{\"file\":");
+	json_put_str(out, ctx->path, strlen(ctx->path));
+	obuf_puts(out, ",\"meta\":{");
+	for (size_t i = 0; i < XLOG_META_MAX; i++) {
+		if (!ctx->meta_values[i][0])
+			continue;
+		if (!first)
+			obuf_putc(out, ',');
+		first = false;
+		json_put_str(out, xlog_meta_keys[i], strlen(xlog_meta_keys[i]));
+		obuf_putc(out, ':');
+		json_put_str(out, ctx->meta_values[i], strlen(ctx->meta_values[i]));
+	}
+	obuf_puts(out, "}}\n");
+}
+
+static void json_notice(struct obuf *out, xlog_ctx_t *ctx, const char *msg)
+{
+	obuf_puts(out, "{\"notice\":");
+	json_put_str(out, msg, strlen(msg));
+	obuf_puts(out, "}\n");
+}
+
+static void json_begin_block(struct obuf *out, xlog_ctx_t *ctx,
+			     const struct xlog_fixheader *xhdr)
+{
+}
+
+static void json_row_header(struct obuf *out, xlog_ctx_t *ctx,
+			    const struct xrow_header *hdr)
+{
+	obuf_puts(out, "{\"type\":");
+	if (hdr->type < IPROTO_TYPE_MAX && iproto_type_strs[hdr->type]) {
+		const char *name = iproto_type_strs[hdr->type];
+		json_put_str(out, name, strlen(name));
+	} else
+		obuf_put_u64(out, hdr->type);
+	obuf_puts(out, ",\"lsn\":");
+	obuf_put_i64(out, hdr->lsn);
+	obuf_puts(out, ",\"replica_id\":");
+	obuf_put_u64(out, hdr->replica_id);
+	obuf_puts(out, ",\"group_id\":");
+	obuf_put_u64(out, hdr->group_id);
+	obuf_puts(out, ",\"sync\":");
+	obuf_put_u64(out, hdr->sync);
+	obuf_puts(out, ",\"tm\":");
+	json_put_double(out, hdr->tm);
+	obuf_puts(out, ",\"tsn\":");
+	obuf_put_i64(out, hdr->tsn);
+	obuf_puts(out, ",\"is_commit\":");
+	obuf_puts(out, hdr->is_commit ? "true" : "false");
+	obuf_puts(out, ",\"schema_version\":");
+	obuf_put_u64(out, hdr->schema_version);
+}
+
+static void json_row_index(struct obuf *out, const char **pos)
+{
+	uint32_t len;
+	const char *data = mp_decode_bin(pos, &len);
+
+	obuf_putc(out, '[');
+	for (uint32_t i = 0; i < len / sizeof(uint32_t); i++) {
+		if (i)
+			obuf_putc(out, ',');
+		obuf_put_u64(out, vy_row_index_get(data, i));
+	}
+	obuf_putc(out, ']');
+}
+
+/* Vylog record type goes along with its keys */
+static void json_vylog_record(struct obuf *out, uint32_t type, const char *pos)
+{
+	uint32_t size = mp_decode_map(&pos);
+
+	obuf_puts(out, "{\"record\":");
+	if (type < vy_log_record_type_MAX && vy_log_type_name[type]) {
+		const char *name = vy_log_type_name[type];
+		json_put_str(out, name, strlen(name));
+	} else
+		obuf_put_u64(out, type);
+
+	for (uint32_t i = 0; i < size; i++) {
+		obuf_putc(out, ',');
+		if (mp_typeof(*pos) == MP_UINT) {
+			uint64_t key = mp_decode_uint(&pos);
+			if (key < vy_log_key_MAX && vy_log_key_name[key]) {
+				json_put_key(out, vy_log_key_name[key]);
+			} else {
+				obuf_putc(out, '"');
+				obuf_put_u64(out, key);
+				obuf_puts(out, "\":");
+			}
+		} else {
+			json_map_key(out, &pos);
+			obuf_putc(out, ':');
+		}
+		json_value(out, &pos);
+	}
+	obuf_putc(out, '}');
+}
+
+/* Operations as objects: op, field as given and what the op takes */
+static void json_update_ops(struct obuf *out, const char **pos)
+{
+	uint32_t nr = mp_decode_array(pos);
+	struct update_op op;
+	const char *arg;
+
+	obuf_putc(out, '[');
+	for (uint32_t i = 0; i < nr; i++) {
+		update_op_decode(&op, pos);
+		if (i)
+			obuf_putc(out, ',');
+		obuf_puts(out, "{\"op\":");
+		json_put_str(out, &op.opcode, 1);
+		obuf_puts(out, ",\"field\":");
+		obuf_put_i64(out, op.field);
+		switch (op.opcode) {
+		case '#':
+			obuf_puts(out, ",\"count\":");
+			obuf_put_i64(out, op.a);
+			break;
+		case ':':
+			obuf_puts(out, ",\"offset\":");
+			obuf_put_i64(out, op.a);
+			obuf_puts(out, ",\"cut\":");
+			obuf_put_i64(out, op.b);
+			obuf_puts(out, ",\"value\":");
+			json_put_str(out, op.arg, op.arg_len);
+			break;
+		default:
+			obuf_puts(out, ",\"value\":");
+			arg = op.arg;
+			json_value(out, &arg);
+		}
+		obuf_putc(out, '}');
+	}
+	obuf_putc(out, ']');
+}
+
+static void json_body(struct obuf *out, xlog_ctx_t *ctx,
+		      const struct xrow_header *hdr,
+		      const char *pos, const char *end)
+{
+	const char *fields;
+	uint32_t size, type;
+
+	obuf_puts(out, ",\"body\":");
+	if (ctx->file_type == WAL_TYPE_VY_XLOG &&
+	    (fields = vy_log_record_fields(pos, &type))) {
+		json_vylog_record(out, type, fields);
+		return;
+	}
+
+	if (mp_typeof(*pos) != MP_MAP) {
+		json_value(out, &pos);
+		return;
+	}
+
+	size = mp_decode_map(&pos);
+	obuf_putc(out, '{');
+	for (uint32_t i = 0; i < size; i++) {
+		if (i)
+			obuf_putc(out, ',');
+
+		if (mp_typeof(*pos) != MP_UINT) {
+			json_map_key(out, &pos);
+			obuf_putc(out, ':');
+		} else {
+			uint64_t key = mp_decode_uint(&pos);
+			const char *name = emit_key_name(hdr->type, key);
+			if (name) {
+				json_put_key(out, name);
+			} else {
+				obuf_putc(out, '"');
+				obuf_put_u64(out, key);
+				obuf_puts(out, "\":");
+			}
+
+			if (hdr->type == VY_RUN_ROW_INDEX &&
+			    key == VY_ROW_INDEX_DATA && mp_typeof(*pos) == MP_BIN) {
+				json_row_index(out, &pos);
+				continue;
+			}
+			if (update_ops_key(hdr->type, key) &&
+			    update_ops_valid(pos)) {
+				json_update_ops(out, &pos);
+				continue;
+			}
+		}
+		json_value(out, &pos);
+	}
+	obuf_putc(out, '}');
+}
+
+static void json_end_row(struct obuf *out, xlog_ctx_t *ctx)
+{
+	obuf_puts(out, "}\n");
+}
+
+static void json_end_block(struct obuf *out, xlog_ctx_t *ctx)
+{
+}
+
+/* A line with the transaction goes before its rows */
+static void json_begin_tx(struct obuf *out, xlog_ctx_t *ctx,
+			  const struct xtx *tx)
+{
+	bool first = true;
+
+	obuf_puts(out, "{\"tx\":{\"replica_id\":");
+	obuf_put_u64(out, tx->replica_id);
+	obuf_puts(out, ",\"tsn\":");
+	obuf_put_i64(out, tx->tsn);
+	obuf_puts(out, ",\"first_lsn\":");
+	obuf_put_i64(out, tx->first_lsn);
+	obuf_puts(out, ",\"last_lsn\":");
+	obuf_put_i64(out, tx->last_lsn);
+	obuf_puts(out, ",\"rows\":");
+	obuf_put_u64(out, tx->nr_rows);
+	obuf_puts(out, ",\"size\":");
+	obuf_put_u64(out, tx->size);
+	obuf_puts(out, ",\"duration\":");
+	json_put_double(out, tx->last_tm - tx->first_tm);
+	obuf_puts(out, ",\"statements\":{");
+	for (size_t i = 0; i < IPROTO_TYPE_STAT_MAX; i++) {
+		if (!tx->nr_stmts[i])
+			continue;
+		if (!first)
+			obuf_putc(out, ',');
+		first = false;
+		if (iproto_type_strs[i])
+			json_put_str(out, iproto_type_strs[i], strlen(iproto_type_strs[i]));
+		else
+			obuf_printf(out, "\"%zu\"", i);
+		obuf_putc(out, ':');
+		obuf_put_u64(out, tx->nr_stmts[i]);
+	}
+	if (tx->nr_other) {
+		if (!first)
+			obuf_putc(out, ',');
+		obuf_puts(out, "\"OTHER\":");
+		obuf_put_u64(out, tx->nr_other);
+	}
+	obuf_puts(out, "},\"status\":");
+	json_put_str(out, xtx_status_strs[tx->status],
+		     strlen(xtx_status_strs[tx->status]));
+	obuf_puts(out, ",\"continued\":");
+	obuf_puts(out, tx->continued ? "true" : "false");
+	obuf_puts(out, ",\"shown\":");
+	obuf_put_u64(out, tx->nr_shown);
+	obuf_puts(out, "}}\n");
+}
+
+static void json_end_tx(struct obuf *out, xlog_ctx_t *ctx)
+{
+}
+
+static void json_stats_counters(struct obuf *out, const struct stats_counters *c)
+{
+	bool first = true;
+
+	obuf_puts(out, "\"rows\":");
+	obuf_put_u64(out, c->rows);
+	obuf_puts(out, ",\"bytes\":");
+	obuf_put_u64(out, c->bytes);
+	obuf_puts(out, ",\"min_lsn\":");
+	obuf_put_i64(out, c->min_lsn);
+	obuf_puts(out, ",\"max_lsn\":");
+	obuf_put_i64(out, c->max_lsn);
+	obuf_puts(out, ",\"min_tm\":");
+	json_put_double(out, c->min_tm);
+	obuf_puts(out, ",\"max_tm\":");
+	json_put_double(out, c->max_tm);
+	obuf_puts(out, ",\"statements\":{");
+	for (size_t i = 0; i < IPROTO_TYPE_STAT_MAX; i++) {
+		if (!c->nr_types[i])
+			continue;
+		if (!first)
+			obuf_putc(out, ',');
+		first = false;
+		if (iproto_type_strs[i])
+			json_put_str(out, iproto_type_strs[i], strlen(iproto_type_strs[i]));
+		else
+			obuf_printf(out, "\"%zu\"", i);
+		obuf_putc(out, ':');
+		obuf_put_u64(out, c->nr_types[i]);
+	}
+	if (c->nr_other) {
+		if (!first)
+			obuf_putc(out, ',');
+		obuf_puts(out, "\"OTHER\":");
+		obuf_put_u64(out, c->nr_other);
+	}
+	obuf_puts(out, "},\"tuple_bytes\":");
+	obuf_put_u64(out, c->tuple_bytes);
+
+	/* Keyed by the lower bound of a bucket */
+	first = true;
+	obuf_puts(out, ",\"tuple_sizes\":{");
+	for (size_t i = 0; i < STATS_SIZE_BUCKETS; i++) {
+		if (!c->tuple_sizes[i])
+			continue;
+		if (!first)
+			obuf_putc(out, ',');
+		first = false;
+		obuf_putc(out, '"');
+		obuf_put_u64(out, 1ull << i);
+		obuf_puts(out, "\":");
+		obuf_put_u64(out, c->tuple_sizes[i]);
+	}
+	obuf_putc(out, '}');
+}
+
+static void json_stats_hash(struct obuf *out, const char *name,
+			    const struct id_hash *h)
+{
+	uint64_t *ids = id_hash_ids(h);
+
+	if (!ids)
+		return;
+
+	for (size_t i = 0; i < h->nr; i++) {
+		obuf_puts(out, "{\"");
+		obuf_puts(out, name);
+		obuf_puts(out, "\":");
+		if (ids[i] == STATS_NO_SPACE)
+			obuf_puts(out, "null");
+		else
+			obuf_put_u64(out, ids[i]);
+		obuf_putc(out, ',');
+		json_stats_counters(out, id_hash_get(h, ids[i]));
+		obuf_puts(out, "}\n");
+	}
+	free(ids);
+}
+
+/* A line with totals, then a line per space, replica and interval */
+static void json_stats(struct obuf *out, const struct stats *st)
+{
+	uint64_t *ids;
+
+	obuf_puts(out, "{\"stats\":{\"files\":");
+	obuf_put_u64(out, st->files);
+	obuf_puts(out, ",\"blocks\":");
+	obuf_put_u64(out, st->blocks);
+	obuf_puts(out, ",\"zstd_blocks\":");
+	obuf_put_u64(out, st->zblocks);
+	obuf_puts(out, ",\"disk_bytes\":");
+	obuf_put_u64(out, st->disk_bytes);
+	obuf_puts(out, ",\"raw_bytes\":");
+	obuf_put_u64(out, st->raw_bytes);
+	obuf_putc(out, ',');
+	json_stats_counters(out, &st->total);
+	obuf_puts(out, "}}\n");
+
+	json_stats_hash(out, "space", &st->spaces);
+	json_stats_hash(out, "replica", &st->replicas);
+
+	ids = id_hash_ids(&st->rates);
+	if (!ids)
+		return;
+	for (size_t i = 0; i < st->rates.nr; i++) {
+		const struct stats_rate *r = id_hash_get(&st->rates, ids[i]);
+
+		obuf_puts(out, "{\"time\":");
+		obuf_put_u64(out, ids[i] * STATS_TIME_STEP);
+		obuf_puts(out, ",\"step\":");
+		obuf_put_u64(out, STATS_TIME_STEP);
+		obuf_puts(out, ",\"rows\":");
+		obuf_put_u64(out, r->rows);
+		obuf_puts(out, ",\"bytes\":");
+		obuf_put_u64(out, r->bytes);
+		obuf_puts(out, "}\n");
+	}
+	free(ids);
+}
+
+static void json_summary(struct obuf *out, xlog_ctx_t *ctx,
+			 const struct xlog_summary *sum)
+{
+	const char *type = xlog_type_name(ctx->file_type);
+
+	obuf_puts(out, "{\"file\":");
+	json_put_str(out, ctx->path, strlen(ctx->path));
+	obuf_puts(out, ",\"type\":");
+	json_put_str(out, type, strlen(type));
+	obuf_puts(out, ",\"blocks\":");
+	obuf_put_u64(out, sum->blocks);
+	obuf_puts(out, ",\"zstd_blocks\":");
+	obuf_put_u64(out, sum->zblocks);
+	obuf_puts(out, ",\"disk_bytes\":");
+	obuf_put_u64(out, sum->disk_bytes);
+	obuf_puts(out, ",\"rows\":");
+	obuf_put_u64(out, sum->rows);
+	obuf_puts(out, ",\"bytes\":");
+	obuf_put_u64(out, sum->bytes);
+	obuf_puts(out, ",\"min_lsn\":");
+	obuf_put_i64(out, sum->min_lsn);
+	obuf_puts(out, ",\"max_lsn\":");
+	obuf_put_i64(out, sum->max_lsn);
+	obuf_puts(out, ",\"min_tm\":");
+	json_put_double(out, sum->min_tm);
+	obuf_puts(out, ",\"max_tm\":");
+	json_put_double(out, sum->max_tm);
+	obuf_puts(out, "}\n");
+}
+
+static void json_tuple(struct obuf *out, uint32_t space_id, const char *tuple)
+{
+	obuf_puts(out, "{\"space\":");
+	obuf_put_u64(out, space_id);
+	obuf_puts(out, ",\"tuple\":");
+	json_value(out, &tuple);
+	obuf_puts(out, "}\n");
+}
+
+static void json_replay(struct obuf *out, const struct memtx_summary *sum)
+{
+	bool first = true;
+
+	obuf_puts(out, "{\"replay\":{\"snapshot\":");
+	if (sum->snap)
+		json_put_str(out, sum->snap, strlen(sum->snap));
+	else
+		obuf_puts(out, "null");
+	obuf_puts(out, ",\"xlogs\":");
+	obuf_put_u64(out, sum->nr_xlogs);
+	obuf_puts(out, ",\"snapshot_rows\":");
+	obuf_put_u64(out, sum->snap_rows);
+	obuf_puts(out, ",\"applied\":");
+	obuf_put_u64(out, sum->applied);
+	obuf_puts(out, ",\"skipped\":");
+	obuf_put_u64(out, sum->skipped);
+	obuf_puts(out, ",\"failed\":");
+	obuf_put_u64(out, sum->failed);
+	obuf_puts(out, ",\"unresolved\":");
+	obuf_put_u64(out, sum->unresolved);
+	obuf_puts(out, ",\"spaces\":");
+	obuf_put_u64(out, sum->spaces);
+	obuf_puts(out, ",\"tuples\":");
+	obuf_put_u64(out, sum->tuples);
+	obuf_puts(out, ",\"vclock\":{");
+	for (int i = 0; i < VCLOCK_MAX; i++) {
+		if (!sum->vclock[i])
+			continue;
+		if (!first)
+			obuf_putc(out, ',');
+		obuf_printf(out, "\"%d\":%lld", i, (long long)sum->vclock[i]);
+		first = false;
+	}
+	obuf_putc(out, '}');
+	if (sum->written) {
+		obuf_puts(out, ",\"written\":");
+		json_put_str(out, sum->written, strlen(sum->written));
+	}
+	obuf_puts(out, "}}\n");
+}
+
+static void json_layout_key(struct obuf *out, const char *name, const char *key)
+{
+	json_put_key(out, name);
+	if (key)
+		json_value(out, &key);
+	else
+		obuf_puts(out, "null");
+}
+
+/* A line per LSM tree with its ranges, their slices and its runs */
+static void json_layout_lsm(struct obuf *out, const struct vy_layout *l,
+			    const struct vy_lsm_recovery_info *lsm)
+{
+	bool first = true;
+
+	obuf_printf(out, "{\"lsm\":{\"id\":%lld,\"space_id\":%u,"
+		    "\"index_id\":%u,\"group_id\":%u,\"create_lsn\":%lld,"
+		    "\"modify_lsn\":%lld,\"dump_lsn\":%lld,\"prepared\":%s,"
+		    "\"dropped\":%s",
+		    (long long)lsm->id, lsm->space_id, lsm->index_id,
+		    lsm->group_id, (long long)lsm->create_lsn,
+		    (long long)lsm->modify_lsn, (long long)lsm->dump_lsn,
+		    lsm->prepared ? "true" : "false",
+		    lsm->dropped ? "true" : "false");
+	if (lsm->dropped)
+		obuf_printf(out, ",\"drop_lsn\":%lld", (long long)lsm->drop_lsn);
+	obuf_putc(out, ',');
+	json_layout_key(out, "key_def", lsm->key_def);
+
+	obuf_puts(out, ",\"ranges\":[");
+	for (size_t i = vy_layout_ranges(l, lsm->id); i < l->nr_ranges; i++) {
+		const struct vy_range_recovery_info *range = l->ranges[i];
+		bool first_slice = true;
+
+		if (range->lsm_id != lsm->id)
+			break;
+		if (!first)
+			obuf_putc(out, ',');
+		first = false;
+
+		obuf_printf(out, "{\"id\":%lld,", (long long)range->id);
+		json_layout_key(out, "begin", range->begin);
+		obuf_putc(out, ',');
+		json_layout_key(out, "end", range->end);
+		obuf_puts(out, ",\"slices\":[");
+		for (size_t j = vy_layout_slices(l, range->id); j < l->nr_slices; j++) {
+			const struct vy_slice_recovery_info *slice = l->slices[j];
+
+			if (slice->range_id != range->id)
+				break;
+			if (!first_slice)
+				obuf_putc(out, ',');
+			first_slice = false;
+
+			obuf_printf(out, "{\"id\":%lld,\"run_id\":%lld,",
+				    (long long)slice->id, (long long)slice->run_id);
+			json_layout_key(out, "begin", slice->begin);
+			obuf_putc(out, ',');
+			json_layout_key(out, "end", slice->end);
+			obuf_putc(out, '}');
+		}
+		obuf_puts(out, "]}");
+	}
+
+	obuf_puts(out, "],\"runs\":[");
+	first = true;
+	for (size_t i = vy_layout_runs(l, lsm->id); i < l->nr_runs; i++) {
+		const struct vy_run_recovery_info *run = l->runs[i];
+
+		if (run->lsm_id != lsm->id)
+			break;
+		if (!first)
+			obuf_putc(out, ',');
+		first = false;
+
+		obuf_printf(out, "{\"id\":%lld,\"dump_lsn\":%lld,"
+			    "\"dump_count\":%u,\"prepared\":%s,\"dropped\":%s",
+			    (long long)run->id, (long long)run->dump_lsn,
+			    run->dump_count, run->prepared ? "true" : "false",
+			    run->dropped ? "true" : "false");
+		if (run->dropped)
+			obuf_printf(out, ",\"gc_lsn\":%lld", (long long)run->gc_lsn);
+		obuf_putc(out, '}');
+	}
+	obuf_puts(out, "]}}\n");
+}
+
+static void json_layout(struct obuf *out, xlog_ctx_t *ctx,
+			const struct vy_layout *l)
+{
+	for (size_t i = 0; i < l->nr_lsms; i++)
+		json_layout_lsm(out, l, l->lsms[i]);
+
+	obuf_printf(out, "{\"layout\":{\"lsms\":%zu,\"ranges\":%zu,"
+		    "\"runs\":%zu,\"slices\":%zu,\"records\":%llu,"
+		    "\"mismatches\":%llu}}\n",
+		    l->nr_lsms, l->nr_ranges, l->nr_runs, l->nr_slices,
+		    (unsigned long long)l->nr_records,
+		    (unsigned long long)l->nr_errors);
+}
+
+const struct emitter emitter_json = {
+	.name		= "json",
+	.meta		= json_meta,
+	.notice		= json_notice,
+	.begin_block	= json_begin_block,
+	.row_header	= json_row_header,
+	.body		= json_body,
+	.end_row	= json_end_row,
+	.end_block	= json_end_block,
+	.begin_tx	= json_begin_tx,
+	.end_tx		= json_end_tx,
+	.stats		= json_stats,
+	.summary	= json_summary,
+	.tuple		= json_tuple,
+	.replay		= json_replay,
+	.layout		= json_layout,
+};
@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <glob.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "files.h"
+#include "xlog.h"
+#include "reader.h"
+#include "emit.h"
+#include "opts.h"
+#include "pool.h"
+#include "follow.h"
+#include "writer.h"
+#include "log.h"
+
+static int xfile_push(struct xfile_list *l, const char *path)
+{
+	if (l->nr == l->size) {
+		size_t size = l->size ? l->size * 2 : 64;
+		struct xfile *files = realloc(l->files, size * sizeof(files[0]));
+
+		if (!files) {
+			pr_perror("Can't allocate file list");
+			return -1;
+		}
+		l->files = files;
+		l->size = size;
+	}
+
+	memset(&l->files[l->nr], 0, sizeof(l->files[0]));
+	l->files[l->nr].path = strdup(path);
+	if (!l->files[l->nr].path) {
+		pr_perror("Can't allocate file list");
+		return -1;
+	}
+	l->nr++;
+	return 0;
+}
+
+/* Only snapshots and xlogs make up the log of a directory */
+static bool is_log_file(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 5 && (!strcmp(name + len - 5, ".snap") ||
+			   !strcmp(name + len - 5, ".xlog"));
+}
+
+static int add_dir(struct xfile_list *l, const char *path)
+{
+	struct dirent *de;
+	DIR *dir;
+	int ret = 0;
+
+	dir = opendir(path);
+	if (!dir) {
+		pr_perror("Can't open %s", path);
+		return -1;
+	}
+
+	while (!ret && (de = readdir(dir))) {
+		char *name;
+
+		if (!is_log_file(de->d_name))
+			continue;
+
+		if (asprintf(&name, "%s/%s", path, de->d_name) < 0) {
+			pr_perror("Can't allocate path");
+			ret = -1;
+			break;
+		}
+		ret = xfile_push(l, name);
+		free(name);
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+/* A file, a directory or a glob pattern */
+int xfile_list_add(struct xfile_list *l, const char *arg)
+{
+	struct stat st;
+	glob_t g;
+	int ret;
+
+	if (!stat(arg, &st))
+		return S_ISDIR(st.st_mode) ? add_dir(l, arg) : xfile_push(l, arg);
+
+	if (errno != ENOENT || !strpbrk(arg, "*?[")) {
+		pr_perror("Can't stat %s", arg);
+		return -1;
+	}
+
+	ret = glob(arg, 0, NULL, &g);
+	if (ret == GLOB_NOMATCH) {
+		pr_err("No files match %s\n", arg);
+		return -1;
+	} else if (ret) {
+		pr_err("Can't expand %s\n", arg);
+		return -1;
+	}
+
+	for (size_t i = 0; i < g.gl_pathc && !ret; i++)
+		ret = xfile_list_add(l, g.gl_pathv[i]);
+
+	globfree(&g);
+	return ret;
+}
+
+void xfile_list_fini(struct xfile_list *l)
+{
+	for (size_t i = 0; i < l->nr; i++)
+		free(l->files[i].path);
+	free(l->files);
+	memset(l, 0, sizeof(*l));
+}
+
+/* Vclock components, the meta looks like {1: 17, 2: 5} */
+static int vclock_parse(const char *str, int64_t *vclock)
+{
+	const char *pos = strchr(str, '{');
+	unsigned long id;
+	char *end;
+
+	memset(vclock, 0, VCLOCK_MAX * sizeof(vclock[0]));
+	if (!pos)
+		return -1;
+
+	for (pos++;;) {
+		while (*pos == ' ')
+			pos++;
+		if (*pos == '}')
+			return 0;
+
+		id = strtoul(pos, &end, 10);
+		if (end == pos || *end != ':' || id >= VCLOCK_MAX)
+			return -1;
+
+		pos = end + 1;
+		vclock[id] = strtoll(pos, &end, 10);
+		if (end == pos)
+			return -1;
+
+		for (pos = end; *pos == ' '; pos++)
+			;
+		if (*pos == ',')
+			pos++;
+		else if (*pos != '}')
+			return -1;
+	}
+}
+
+/* The other way around, nonzero components only */
+void vclock_format(char *buf, size_t size, const int64_t *vclock)
+{
+	size_t len = snprintf(buf, size, "{");
+
+	for (int i = 0; i < VCLOCK_MAX && len < size; i++) {
+		if (!vclock[i])
+			continue;
+		len += snprintf(buf + len, size - len, "%s%d: %lld",
+				len > 1 ? ", " : "", i, (long long)vclock[i]);
+	}
+	if (len < size)
+		snprintf(buf + len, size - len, "}");
+}
+
+/* Only meta of a file is read to find its place */
+static int xfile_read_meta(struct xfile *f)
+{
+	const char *vclock;
+	struct reader rd;
+	xlog_ctx_t ctx;
+	int ret = -1;
+
+	if (reader_open(&rd, f->path, READER_READ, READER_BUFSIZE_MIN))
+		return -1;
+
+	xlog_ctx_create(&ctx);
+	ctx.path = f->path;
+	ctx.rd = &rd;
+	ctx.size = rd.size;
+
+	if (parse_header(&ctx)) {
+		pr_err("%s: can't read meta\n", f->path);
+		goto out;
+	}
+
+	f->type = ctx.file_type;
+	strcpy(f->instance, ctx.meta_values[XLOG_META_INSTANCE_UUID_KEY][0] ?
+	       ctx.meta_values[XLOG_META_INSTANCE_UUID_KEY] :
+	       ctx.meta_values[XLOG_META_INSTANCE_INSTANCE_UUID_KEY_V12]);
+	strcpy(f->version, ctx.meta_values[XLOG_META_VERSION_KEY]);
+	vclock = ctx.meta_values[XLOG_META_XLOG_META_VCLOCK_KEY];
+	if (!vclock[0]) {
+		/* Vinyl runs and indexes go first */
+		f->signature = -1;
+	} else if (vclock_parse(vclock, f->vclock)) {
+		pr_err("%s: broken vclock %s\n", f->path, vclock);
+		goto out;
+	} else {
+		/* The sum of components */
+		f->signature = 0;
+		for (int i = 0; i < VCLOCK_MAX; i++)
+			f->signature += f->vclock[i];
+	}
+	ret = 0;
+out:
+	xlog_ctx_destroy(&ctx);
+	reader_close(&rd);
+	return ret;
+}
+
+/* A snapshot goes before the xlog starting at the same vclock */
+static int xfile_cmp(const void *x, const void *y)
+{
+	const struct xfile *a = x, *b = y;
+
+	if (a->signature != b->signature)
+		return a->signature < b->signature ? -1 : 1;
+	if (a->type != b->type)
+		return a->type < b->type ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/* Files with broken meta are dropped, the rest are still dumped */
+int xfile_list_sort(struct xfile_list *l)
+{
+	size_t nr = 0;
+
+	for (size_t i = 0; i < l->nr; i++) {
+		if (xfile_read_meta(&l->files[i])) {
+			free(l->files[i].path);
+			l->nr_broken++;
+			continue;
+		}
+		l->files[nr++] = l->files[i];
+	}
+	l->nr = nr;
+
+	qsort(l->files, l->nr, sizeof(l->files[0]), xfile_cmp);
+	return 0;
+}
+
+static int dump_file(const char *path, struct obuf *out, int jobs,
+		     struct follow *fw)
+{
+	struct reader rd;
+	xlog_ctx_t ctx;
+	int ret;
+
+	if (reader_open(&rd, path, opts.reader, opts.bufsize))
+		return -1;
+
+	xlog_ctx_create(&ctx);
+
+	ctx.path = path;
+	ctx.rd = &rd;
+	ctx.out = out;
+	ctx.em = emitter_lookup(opts.format);
+	ctx.size = rd.size;
+	ctx.jobs = jobs;
+	ctx.follow = fw;
+
+	ret = parse_file(&ctx);
+
+	xlog_ctx_destroy(&ctx);
+	reader_close(&rd);
+	return ret;
+}
+
+int xfile_dump(const char *path, struct obuf *out, int jobs)
+{
+	return dump_file(path, out, jobs, NULL);
+}
+
+/* A directory gets a file of the same name */
+static char *rewrite_path(const char *path, const char *dst)
+{
+	const char *base = strrchr(path, '/');
+	struct stat st;
+	char *name;
+
+	if (stat(dst, &st) || !S_ISDIR(st.st_mode))
+		return strdup(dst);
+	if (asprintf(&name, "%s/%s", dst, base ? base + 1 : path) < 0)
+		return NULL;
+	return name;
+}
+
+/*
+ * Write a snapshot or an xlog anew with the rows passing the
+ * filters only, the meta is kept. Rows are decoded in order,
+ * the blocks are compressed by --jobs threads.
+ */
+int xfile_rewrite(const char *path, const char *dst, struct obuf *out)
+{
+	struct writer_meta meta = { };
+	char *name = NULL, *msg;
+	struct reader rd;
+	struct writer w;
+	xlog_ctx_t ctx;
+	int ret = -1;
+
+	if (reader_open(&rd, path, opts.reader, opts.bufsize))
+		return -1;
+
+	xlog_ctx_create(&ctx);
+	ctx.path = path;
+	ctx.rd = &rd;
+	ctx.out = out;
+	ctx.em = emitter_lookup(opts.format);
+	ctx.size = rd.size;
+	ctx.jobs = 1;
+
+	if (parse_header(&ctx))
+		goto out;
+	if (ctx.file_type != WAL_TYPE_SNAP && ctx.file_type != WAL_TYPE_XLOG) {
+		pr_err("%s: only snapshots and xlogs can be rewritten\n", path);
+		goto out;
+	}
+
+	/* Vclocks are copied as they are, zero components too */
+	meta.instance = ctx.meta_values[XLOG_META_INSTANCE_UUID_KEY][0] ?
+		ctx.meta_values[XLOG_META_INSTANCE_UUID_KEY] :
+		ctx.meta_values[XLOG_META_INSTANCE_INSTANCE_UUID_KEY_V12];
+	meta.version = ctx.meta_values[XLOG_META_VERSION_KEY];
+	meta.vclock = ctx.meta_values[XLOG_META_XLOG_META_VCLOCK_KEY];
+	meta.prev_vclock = ctx.meta_values[XLOG_META_PREV_VCLOCK_KEY];
+	if (!meta.vclock[0]) {
+		pr_err("%s: no vclock\n", path);
+		goto out;
+	}
+
+	name = rewrite_path(path, dst);
+	if (!name) {
+		pr_perror("Can't allocate path");
+		goto out;
+	}
+	if (writer_open(&w, name, ctx.file_type, &meta, opts.zstd_level, opts.jobs))
+		goto out;
+
+	ctx.writer = &w;
+	ret = parse_file(&ctx);
+	if (ret)
+		writer_abort(&w);
+	else
+		ret = writer_close(&w);
+
+	if (!ret && asprintf(&msg, "written %s: %llu rows, %llu blocks, %llu bytes",
+			     name, (unsigned long long)w.rows,
+			     (unsigned long long)w.blocks,
+			     (unsigned long long)w.bytes) >= 0) {
+		ctx.em->notice(out, &ctx, msg);
+		free(msg);
+	}
+out:
+	free(name);
+	xlog_ctx_destroy(&ctx);
+	reader_close(&rd);
+	return ret;
+}
+
+/*
+ * A new xlog may be seen before its meta is written,
+ * wait for the blank line which ends the meta.
+ */
+static int wait_meta(struct follow *fw, const char *path)
+{
+	char *buf = malloc(XLOG_META_LEN_MAX);
+	int fd, ret = -1;
+	ssize_t len;
+
+	if (!buf) {
+		pr_perror("Can't allocate meta");
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		pr_perror("Can't open %s", path);
+		goto out;
+	}
+
+	for (;;) {
+		len = pread(fd, buf, XLOG_META_LEN_MAX, 0);
+		if (len < 0) {
+			pr_perror("Can't read %s", path);
+			break;
+		}
+		if (memmem(buf, len, "\n\n", 2)) {
+			ret = 0;
+			break;
+		}
+		if (len == XLOG_META_LEN_MAX) {
+			pr_err("%s: no meta end found\n", path);
+			break;
+		}
+		if (follow_wait(fw))
+			break;
+	}
+	close(fd);
+out:
+	free(buf);
+	return ret;
+}
+
+/* Dump a live xlog and the xlogs written after it, returns on errors only */
+int xfile_follow(const char *path, struct obuf *out)
+{
+	char *cur = NULL, *next;
+	struct follow fw;
+	int ret;
+
+	if (follow_init(&fw, path))
+		return -1;
+
+	for (;;) {
+		if (dump_file(path, out, 1, &fw))
+			break;
+
+		while (!(ret = follow_next(&fw, &next))) {
+			if (obuf_flush(out) || follow_wait(&fw)) {
+				ret = -1;
+				break;
+			}
+		}
+		if (ret < 0)
+			break;
+
+		free(cur);
+		path = cur = next;
+		if (follow_set_file(&fw, path) || wait_meta(&fw, path))
+			break;
+	}
+
+	free(cur);
+	follow_fini(&fw);
+	return -1;
+}
+
+/*
+ * Files are dumped concurrently, each into an unlinked
+ * temporary file so the memory is bounded whatever the
+ * output size is, and copied to the output in order.
+ */
+struct xfile_item {
+	const struct xfile	*file;
+	int			fd;
+	struct obuf		out;
+	int			rc;
+};
+
+struct xfile_pool_arg {
+	struct obuf		*out;
+	int			rc;
+};
+
+static int spill_open(void)
+{
+	const char *dir = getenv("TMPDIR") ? : "/tmp";
+	char *path;
+	int fd;
+
+	fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+	if (fd >= 0)
+		return fd;
+
+	/* No O_TMPFILE support in the filesystem */
+	if (asprintf(&path, "%s/ttdump.XXXXXX", dir) < 0)
+		return -1;
+	fd = mkstemp(path);
+	if (fd >= 0)
+		unlink(path);
+	else
+		pr_perror("Can't create temporary file in %s", dir);
+	free(path);
+	return fd;
+}
+
+static void xfile_work(void *item, int worker, void *arg)
+{
+	struct xfile_item *it = item;
+
+	if (it->fd < 0) {
+		it->fd = spill_open();
+		if (it->fd < 0) {
+			it->rc = -1;
+			return;
+		}
+		if (obuf_init(&it->out, it->fd, OBUF_SIZE_DEF)) {
+			close(it->fd);
+			it->fd = -1;
+			it->rc = -1;
+			return;
+		}
+	}
+
+	if (ftruncate(it->fd, 0) || lseek(it->fd, 0, SEEK_SET)) {
+		pr_perror("Can't reset temporary file");
+		it->rc = -1;
+		return;
+	}
+
+	it->out.len = 0;
+	it->out.error = 0;
+	it->rc = xfile_dump(it->file->path, &it->out, 1);
+	if (obuf_flush(&it->out))
+		it->rc = -1;
+}
+
+static int spill_copy(struct obuf *out, int fd)
+{
+	off_t size = lseek(fd, 0, SEEK_CUR), off = 0;
+
+	if (size < 0 || obuf_flush(out))
+		return -1;
+
+	while (off < size) {
+		ssize_t ret = sendfile(out->fd, fd, &off, size - off);
+
+		if (ret > 0)
+			continue;
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno != EINVAL && errno != ENOSYS) {
+			pr_perror("Can't write output");
+			return -1;
+		}
+		break;
+	}
+
+	/* Output which sendfile can't write to */
+	while (off < size) {
+		ssize_t ret;
+
+		if (out->len == out->size && obuf_flush(out))
+			return -1;
+
+		ret = pread(fd, out->buf + out->len, out->size - out->len, off);
+		if (ret <= 0) {
+			pr_perror("Can't read temporary file");
+			return -1;
+		}
+		out->len += ret;
+		off += ret;
+	}
+	return 0;
+}
+
+static int xfile_done(void *item, void *arg)
+{
+	struct xfile_pool_arg *pa = arg;
+	struct xfile_item *it = item;
+
+	if (it->fd >= 0 && spill_copy(pa->out, it->fd))
+		return -1;
+
+	/* A broken file doesn't stop the rest */
+	if (it->rc)
+		pa->rc = -1;
+	return 0;
+}
+
+static void xfile_item_init(void *item)
+{
+	struct xfile_item *it = item;
+
+	it->fd = -1;
+}
+
+static void xfile_item_free(void *item)
+{
+	struct xfile_item *it = item;
+
+	if (it->fd >= 0) {
+		obuf_fini(&it->out);
+		close(it->fd);
+	}
+}
+
+int xfile_list_dump(struct xfile_list *l, struct obuf *out, int jobs)
+{
+	struct xfile_pool_arg pa = { .out = out, };
+	struct pool *pool;
+	int ret = 0;
+
+	if (jobs <= 1 || l->nr <= 1) {
+		for (size_t i = 0; i < l->nr; i++) {
+			if (xfile_dump(l->files[i].path, out, jobs))
+				ret = -1;
+		}
+		return ret;
+	}
+
+	pool = pool_create(jobs, jobs * 2, sizeof(struct xfile_item),
+			   xfile_work, xfile_done, &pa);
+	if (!pool)
+		return -1;
+	/* Spill files are opened on the first use of an item */
+	pool_for_each_item(pool, xfile_item_init);
+
+	for (size_t i = 0; i < l->nr; i++) {
+		struct xfile_item *it = pool_next(pool);
+
+		if (!it) {
+			ret = -1;
+			break;
+		}
+		it->file = &l->files[i];
+		it->rc = 0;
+		pool_submit(pool);
+	}
+
+	if (pool_wait(pool))
+		ret = -1;
+	pool_for_each_item(pool, xfile_item_free);
+	pool_destroy(pool);
+	return ret ? ret : pa.rc;
+}
@@ -0,0 +1,39 @@
+#ifndef FILES_H__
+#define FILES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "obuf.h"
+
+/* A file to dump along with its place in the log */
+struct xfile {
+	char		*path;
+	int		type;
+	int64_t		signature;
+	int64_t		vclock[VCLOCK_MAX];
+	char		instance[128];
+	char		version[128];
+};
+
+struct xfile_list {
+	struct xfile	*files;
+	size_t		nr;
+	size_t		size;
+	/* Files dropped as their meta can't be read */
+	size_t		nr_broken;
+};
+
+extern void vclock_format(char *buf, size_t size, const int64_t *vclock);
+
+extern int xfile_list_add(struct xfile_list *l, const char *arg);
+extern int xfile_list_sort(struct xfile_list *l);
+extern void xfile_list_fini(struct xfile_list *l);
+
+extern int xfile_dump(const char *path, struct obuf *out, int jobs);
+extern int xfile_rewrite(const char *path, const char *dst, struct obuf *out);
+extern int xfile_list_dump(struct xfile_list *l, struct obuf *out, int jobs);
+extern int xfile_follow(const char *path, struct obuf *out);
+
+#endif /* FILES_H__ */
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+
+#include "constants.h"
+#include "filter.h"
+#include "xlog.h"
+#include "log.h"
+
+#include "msgpuck/msgpuck.h"
+
+void filter_init(struct filter *f)
+{
+	memset(f, 0, sizeof(*f));
+
+	f->from_lsn	= INT64_MIN;
+	f->to_lsn	= INT64_MAX;
+	f->from_tm	= -INFINITY;
+	f->to_tm	= INFINITY;
+
+	/* Primary keys are mostly the first field */
+	f->key_def.nr_parts = 1;
+}
+
+void filter_fini(struct filter *f)
+{
+	free(f->space_ids.ids);
+	free(f->types.ids);
+	free(f->replica_ids.ids);
+	free(f->group_ids.ids);
+	free(f->key);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int id_set_add(struct id_set *set, uint32_t id)
+{
+	uint32_t *ids;
+
+	if (id_set_has(set, id))
+		return 0;
+
+	ids = realloc(set->ids, (set->nr + 1) * sizeof(ids[0]));
+	if (!ids) {
+		pr_perror("Can't allocate id set");
+		return -1;
+	}
+
+	ids[set->nr++] = id;
+	qsort(ids, set->nr, sizeof(ids[0]), cmp_u32);
+	set->ids = ids;
+	return 0;
+}
+
+bool id_set_has(const struct id_set *set, uint32_t id)
+{
+	return bsearch(&id, set->ids, set->nr, sizeof(id), cmp_u32) != NULL;
+}
+
+/* Comma separated list of numbers */
+int filter_parse_ids(struct id_set *set, const char *str)
+{
+	const char *pos = str;
+
+	for (;;) {
+		char *end;
+		unsigned long long v = strtoull(pos, &end, 0);
+
+		if (end == pos || (*end != ',' && *end != '\0') || v > UINT32_MAX) {
+			pr_err("Invalid id list %s\n", str);
+			return -1;
+		}
+		if (id_set_add(set, v))
+			return -1;
+		if (*end == '\0')
+			return 0;
+		pos = end + 1;
+	}
+}
+
+/* Comma separated list of request type names or numbers */
+int filter_parse_types(struct id_set *set, const char *str)
+{
+	char *copy = strdup(str), *tok, *save;
+	int ret = 0;
+
+	if (!copy) {
+		pr_perror("Can't allocate type list");
+		return -1;
+	}
+
+	for (tok = strtok_r(copy, ",", &save); tok && !ret;
+	     tok = strtok_r(NULL, ",", &save)) {
+		uint32_t type = IPROTO_TYPE_MAX;
+		char *end;
+
+		for (uint32_t i = 0; i < IPROTO_TYPE_MAX; i++) {
+			if (iproto_type_strs[i] &&
+			    !strcasecmp(iproto_type_strs[i], tok)) {
+				type = i;
+				break;
+			}
+		}
+
+		if (type == IPROTO_TYPE_MAX) {
+			type = strtoul(tok, &end, 0);
+			if (end == tok || *end != '\0') {
+				pr_err("Unknown request type %s\n", tok);
+				ret = -1;
+				break;
+			}
+		}
+
+		ret = id_set_add(set, type);
+	}
+
+	free(copy);
+	return ret;
+}
+
+int filter_parse_lsn(int64_t *lsn, const char *str)
+{
+	char *end;
+
+	*lsn = strtoll(str, &end, 0);
+	if (end == str || *end != '\0') {
+		pr_err("Invalid LSN %s\n", str);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Either seconds since the epoch or a date
+ * and time in UTC like 2020-06-13 12:05:59.
+ */
+int filter_parse_time(double *tm, const char *str)
+{
+	static const char *formats[] = {
+		"%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%dT%H:%M:%S",
+		"%Y-%m-%d",
+	};
+	char *end;
+
+	*tm = strtod(str, &end);
+	if (end != str && *end == '\0')
+		return 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(formats); i++) {
+		struct tm t;
+
+		memset(&t, 0, sizeof(t));
+		end = strptime(str, formats[i], &t);
+		if (end && *end == '\0') {
+			*tm = timegm(&t);
+			return 0;
+		}
+	}
+
+	pr_err("Invalid time %s\n", str);
+	return -1;
+}
+
+bool filter_row(const struct filter *f, const struct xrow_header *hdr)
+{
+	if (hdr->lsn < f->from_lsn || hdr->lsn > f->to_lsn)
+		return false;
+	if (hdr->tm < f->from_tm || hdr->tm > f->to_tm)
+		return false;
+	if (!id_set_empty(&f->types) && !id_set_has(&f->types, hdr->type))
+		return false;
+	if (!id_set_empty(&f->replica_ids) &&
+	    !id_set_has(&f->replica_ids, hdr->replica_id))
+		return false;
+	if (!id_set_empty(&f->group_ids) &&
+	    !id_set_has(&f->group_ids, hdr->group_id))
+		return false;
+	return true;
+}
+
+/* A key part, strings are the parts which are nothing else */
+static char *encode_key_part(char *p, const char *str, size_t len)
+{
+	unsigned long long u;
+	long long i;
+	char *end;
+	double d;
+
+	if (len == 3 && !memcmp(str, "nil", 3))
+		return mp_encode_nil(p);
+	if (len == 4 && !memcmp(str, "true", 4))
+		return mp_encode_bool(p, true);
+	if (len == 5 && !memcmp(str, "false", 5))
+		return mp_encode_bool(p, false);
+
+	errno = 0;
+	if (*str != '-') {
+		u = strtoull(str, &end, 10);
+		if (end == str + len && !errno)
+			return mp_encode_uint(p, u);
+	} else {
+		i = strtoll(str, &end, 10);
+		if (end == str + len && !errno)
+			return mp_encode_int(p, i);
+	}
+
+	d = strtod(str, &end);
+	if (end == str + len)
+		return mp_encode_double(p, d);
+	return mp_encode_str(p, str, len);
+}
+
+/*
+ * Comma separated key parts: numbers, true, false, nil and
+ * strings, in double quotes if they have commas or look like
+ * something else. The key is kept in the canonical form.
+ */
+int filter_parse_key(struct filter *f, const char *str)
+{
+	struct obuf parts, key;
+	const char *pos = str, *end;
+	uint32_t nr = 0;
+	int ret = -1;
+	char *p;
+
+	if (obuf_init(&parts, -1, 64))
+		return -1;
+	if (obuf_init(&key, -1, 64)) {
+		obuf_fini(&parts);
+		return -1;
+	}
+
+	/* The array header is put in front of the parts at the end */
+	parts.len = 5;
+	for (;;) {
+		p = obuf_reserve(&parts, strlen(pos) + 9);
+		if (!p)
+			goto out;
+
+		if (*pos == '"') {
+			end = strchr(pos + 1, '"');
+			if (!end || (end[1] != ',' && end[1] != '\0'))
+				goto invalid;
+			p = mp_encode_str(p, pos + 1, end - pos - 1);
+			end++;
+		} else {
+			end = strchrnul(pos, ',');
+			if (end == pos)
+				goto invalid;
+			p = encode_key_part(p, pos, end - pos);
+		}
+		parts.len = p - parts.buf;
+
+		if (++nr > KEY_PARTS_MAX)
+			goto invalid;
+		if (*end == '\0')
+			break;
+		pos = end + 1;
+	}
+
+	p = parts.buf + 5 - mp_sizeof_array(nr);
+	mp_encode_array(p, nr);
+	if (key_canon(p, &key))
+		goto out;
+
+	free(f->key);
+	f->key = key.buf;
+	f->key_parts = nr;
+	key.buf = NULL;
+	ret = 0;
+	goto out;
+
+invalid:
+	pr_err("Invalid key %s\n", str);
+out:
+	obuf_fini(&parts);
+	obuf_fini(&key);
+	return ret;
+}
+
+/* Comma separated one based field numbers, as index parts are given */
+int filter_parse_key_fields(struct key_def *kd, const char *str)
+{
+	const char *pos = str;
+	uint32_t nr = 0;
+
+	for (;;) {
+		char *end;
+		unsigned long long v = strtoull(pos, &end, 10);
+
+		if (end == pos || (*end != ',' && *end != '\0') ||
+		    !v || v > UINT32_MAX || nr == KEY_PARTS_MAX) {
+			pr_err("Invalid key fields %s\n", str);
+			return -1;
+		}
+		kd->fields[nr++] = v - 1;
+		if (*end == '\0')
+			break;
+		pos = end + 1;
+	}
+
+	kd->nr_parts = nr;
+	return 0;
+}
+
+/*
+ * Look up IPROTO_SPACE_ID in a row body, it usually
+ * comes first so tuples are not walked at all. With
+ * a key to look up the key of a delete or an update
+ * by the primary index or the key of the tuple of any
+ * other request has to match it as well, values are
+ * compared in place.
+ */
+bool filter_row_space(const struct filter *f, const char *body, const char *end)
+{
+	const char *key = NULL, *tuple = NULL;
+	bool has_space = false;
+	uint64_t index_id = 0;
+	uint32_t size;
+
+	if (id_set_empty(&f->space_ids))
+		return true;
+	if (!body || mp_typeof(*body) != MP_MAP)
+		return false;
+
+	size = mp_decode_map(&body);
+	for (uint32_t i = 0; i < size && body < end; i++) {
+		if (mp_typeof(*body) != MP_UINT)
+			return false;
+
+		switch (mp_decode_uint(&body)) {
+		case IPROTO_SPACE_ID:
+			if (mp_typeof(*body) != MP_UINT ||
+			    !id_set_has(&f->space_ids, mp_decode_uint(&body)))
+				return false;
+			if (!f->key)
+				return true;
+			has_space = true;
+			continue;
+		case IPROTO_INDEX_ID:
+			if (mp_typeof(*body) == MP_UINT) {
+				index_id = mp_decode_uint(&body);
+				continue;
+			}
+			break;
+		case IPROTO_KEY:
+			key = body;
+			break;
+		case IPROTO_TUPLE:
+			tuple = body;
+			break;
+		}
+		mp_next(&body);
+	}
+
+	if (!has_space)
+		return false;
+	/* Updates have operations in place of the tuple */
+	if (key)
+		return !index_id && key_match(key, f->key);
+	return tuple && key_match_tuple(&f->key_def, tuple, f->key);
+}
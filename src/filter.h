@@ -0,0 +1,70 @@
+#ifndef FILTER_H__
+#define FILTER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "key.h"
+
+struct xrow_header;
+
+/* A small set of ids kept sorted */
+struct id_set {
+	uint32_t	*ids;
+	size_t		nr;
+};
+
+/*
+ * Row filter: a row passes if it matches every
+ * condition set, empty sets match everything.
+ */
+struct filter {
+	bool		enabled;
+
+	struct id_set	space_ids;
+	struct id_set	types;
+	struct id_set	replica_ids;
+	struct id_set	group_ids;
+
+	int64_t		from_lsn;
+	int64_t		to_lsn;
+	double		from_tm;
+	double		to_tm;
+
+	/* Canonical key to look up and the primary key it is matched by */
+	char		*key;
+	uint32_t	key_parts;
+	struct key_def	key_def;
+};
+
+extern void filter_init(struct filter *f);
+extern void filter_fini(struct filter *f);
+
+extern int filter_parse_ids(struct id_set *set, const char *str);
+extern int filter_parse_types(struct id_set *set, const char *str);
+extern int filter_parse_lsn(int64_t *lsn, const char *str);
+extern int filter_parse_time(double *tm, const char *str);
+extern int filter_parse_key(struct filter *f, const char *str);
+extern int filter_parse_key_fields(struct key_def *kd, const char *str);
+
+extern bool filter_row(const struct filter *f, const struct xrow_header *hdr);
+extern bool filter_row_space(const struct filter *f, const char *body,
+			     const char *end);
+
+static inline bool id_set_empty(const struct id_set *set)
+{
+	return set->nr == 0;
+}
+
+/* Whether LSN or time range is limited */
+static inline bool filter_has_bounds(const struct filter *f)
+{
+	return f->from_lsn != INT64_MIN || f->to_lsn != INT64_MAX ||
+	       f->from_tm != -INFINITY || f->to_tm != INFINITY;
+}
+
+extern bool id_set_has(const struct id_set *set, uint32_t id);
+
+#endif /* FILTER_H__ */
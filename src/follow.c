@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+
+#include <sys/inotify.h>
+
+#include "follow.h"
+#include "log.h"
+
+static int split_path(const char *path, char **dir, char **name)
+{
+	const char *slash = strrchr(path, '/');
+
+	if (!slash) {
+		*dir = strdup(".");
+		*name = strdup(path);
+	} else {
+		*dir = strndup(path, slash == path ? 1 : slash - path);
+		*name = strdup(slash + 1);
+	}
+
+	if (!*dir || !*name) {
+		pr_perror("Can't allocate path");
+		free(*dir);
+		free(*name);
+		return -1;
+	}
+	return 0;
+}
+
+int follow_init(struct follow *fw, const char *path)
+{
+	memset(fw, 0, sizeof(*fw));
+	fw->file_wd = -1;
+	fw->dir_wd = -1;
+
+	fw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fw->fd < 0) {
+		pr_perror("Can't create inotify instance");
+		return -1;
+	}
+
+	if (follow_set_file(fw, path)) {
+		follow_fini(fw);
+		return -1;
+	}
+	return 0;
+}
+
+void follow_fini(struct follow *fw)
+{
+	if (fw->fd >= 0)
+		close(fw->fd);
+	free(fw->dir);
+	free(fw->name);
+}
+
+/* Watch @path for writes and its directory for new files */
+int follow_set_file(struct follow *fw, const char *path)
+{
+	char *dir, *name;
+
+	if (split_path(path, &dir, &name))
+		return -1;
+
+	if (fw->file_wd >= 0)
+		inotify_rm_watch(fw->fd, fw->file_wd);
+	fw->file_wd = inotify_add_watch(fw->fd, path, IN_MODIFY);
+	if (fw->file_wd < 0) {
+		pr_perror("Can't watch %s", path);
+		goto err;
+	}
+
+	if (!fw->dir || strcmp(fw->dir, dir)) {
+		if (fw->dir_wd >= 0)
+			inotify_rm_watch(fw->fd, fw->dir_wd);
+		fw->dir_wd = inotify_add_watch(fw->fd, dir, IN_CREATE | IN_MOVED_TO);
+		if (fw->dir_wd < 0) {
+			pr_perror("Can't watch %s", dir);
+			goto err;
+		}
+	}
+
+	free(fw->dir);
+	free(fw->name);
+	fw->dir = dir;
+	fw->name = name;
+	return 0;
+err:
+	free(dir);
+	free(name);
+	return -1;
+}
+
+/*
+ * Sleep until the file or its directory changes. Events
+ * are wakeups only, the caller checks what has changed.
+ */
+int follow_wait(struct follow *fw)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd = {
+		.fd	= fw->fd,
+		.events	= POLLIN,
+	};
+
+	while (poll(&pfd, 1, -1) < 0) {
+		if (errno != EINTR) {
+			pr_perror("Can't wait for %s", fw->name);
+			return -1;
+		}
+	}
+
+	for (;;) {
+		ssize_t ret = read(fw->fd, buf, sizeof(buf));
+
+		if (ret > 0 || (ret < 0 && errno == EINTR))
+			continue;
+		if (ret < 0 && errno != EAGAIN) {
+			pr_perror("Can't read inotify events");
+			return -1;
+		}
+		return 0;
+	}
+}
+
+static bool is_xlog(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 5 && !strcmp(name + len - 5, ".xlog");
+}
+
+/*
+ * Find the xlog which follows the current one. Names are
+ * vclock signatures of the same width so they compare as
+ * strings. Returns 1 and the path if there is one.
+ */
+int follow_next(struct follow *fw, char **path)
+{
+	struct dirent *de;
+	char *next = NULL;
+	DIR *dir;
+	int ret = 0;
+
+	dir = opendir(fw->dir);
+	if (!dir) {
+		pr_perror("Can't open %s", fw->dir);
+		return -1;
+	}
+
+	while ((de = readdir(dir))) {
+		if (!is_xlog(de->d_name) || strcmp(de->d_name, fw->name) <= 0)
+			continue;
+		if (next && strcmp(de->d_name, next) >= 0)
+			continue;
+
+		free(next);
+		next = strdup(de->d_name);
+		if (!next) {
+			pr_perror("Can't allocate path");
+			ret = -1;
+			break;
+		}
+	}
+	closedir(dir);
+
+	if (ret || !next)
+		return ret;
+
+	ret = 1;
+	if (path && asprintf(path, "%s/%s", fw->dir, next) < 0) {
+		pr_perror("Can't allocate path");
+		ret = -1;
+	}
+	free(next);
+	return ret;
+}
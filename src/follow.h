@@ -0,0 +1,23 @@
+#ifndef FOLLOW_H__
+#define FOLLOW_H__
+
+/*
+ * Waiting for a live xlog to grow and for the next
+ * xlog to appear in its directory, inotify based so
+ * there is no polling and a write wakes us at once.
+ */
+struct follow {
+	int		fd;
+	int		file_wd;
+	int		dir_wd;
+	char		*dir;
+	char		*name;
+};
+
+extern int follow_init(struct follow *fw, const char *path);
+extern void follow_fini(struct follow *fw);
+extern int follow_set_file(struct follow *fw, const char *path);
+extern int follow_wait(struct follow *fw);
+extern int follow_next(struct follow *fw, char **path);
+
+#endif /* FOLLOW_H__ */
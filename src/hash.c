@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "log.h"
+
+void id_hash_init(struct id_hash *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void id_hash_fini(struct id_hash *h)
+{
+	free(h->slots);
+	memset(h, 0, sizeof(*h));
+}
+
+void *id_hash_get(const struct id_hash *h, uint64_t id)
+{
+	if (!h->nr)
+		return NULL;
+
+	for (size_t i = id_hash_slot(h, id);; i = (i + 1) & (h->size - 1)) {
+		const struct id_hash_slot *s = &h->slots[i];
+
+		if (!s->val)
+			return NULL;
+		if (s->id == id)
+			return s->val;
+	}
+}
+
+static void id_hash_insert(struct id_hash *h, uint64_t id, void *val)
+{
+	size_t i = id_hash_slot(h, id);
+
+	while (h->slots[i].val)
+		i = (i + 1) & (h->size - 1);
+
+	h->slots[i].id = id;
+	h->slots[i].val = val;
+	h->nr++;
+}
+
+/* Keep the load factor under a half */
+static int id_hash_grow(struct id_hash *h)
+{
+	struct id_hash old = *h;
+	struct id_hash_slot *s;
+
+	h->size = old.size ? old.size * 2 : 64;
+	h->slots = calloc(h->size, sizeof(h->slots[0]));
+	if (!h->slots) {
+		pr_perror("Can't grow hash");
+		*h = old;
+		return -1;
+	}
+
+	h->nr = 0;
+	id_hash_foreach(&old, s)
+		id_hash_insert(h, s->id, s->val);
+
+	free(old.slots);
+	return 0;
+}
+
+/* Insert or replace the value of @id */
+int id_hash_put(struct id_hash *h, uint64_t id, void *val)
+{
+	if (h->nr) {
+		for (size_t i = id_hash_slot(h, id); h->slots[i].val;
+		     i = (i + 1) & (h->size - 1)) {
+			if (h->slots[i].id == id) {
+				h->slots[i].val = val;
+				return 0;
+			}
+		}
+	}
+
+	if (2 * (h->nr + 1) > h->size && id_hash_grow(h))
+		return -1;
+
+	id_hash_insert(h, id, val);
+	return 0;
+}
+
+void *id_hash_del(struct id_hash *h, uint64_t id)
+{
+	size_t mask = h->size - 1, i, j;
+	void *val;
+
+	if (!h->nr)
+		return NULL;
+
+	for (i = id_hash_slot(h, id);; i = (i + 1) & mask) {
+		if (!h->slots[i].val)
+			return NULL;
+		if (h->slots[i].id == id)
+			break;
+	}
+
+	val = h->slots[i].val;
+	h->slots[i].val = NULL;
+	h->nr--;
+
+	/* Move back entries which can't be found past the hole */
+	for (j = (i + 1) & mask; h->slots[j].val; j = (j + 1) & mask) {
+		size_t home = id_hash_slot(h, h->slots[j].id);
+
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			h->slots[i] = h->slots[j];
+			h->slots[j].val = NULL;
+			i = j;
+		}
+	}
+	return val;
+}
+
+static int id_cmp(const void *x, const void *y)
+{
+	uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+
+	return a < b ? -1 : a > b;
+}
+
+/* Sorted ids of a hash, to be freed by the caller */
+uint64_t *id_hash_ids(const struct id_hash *h)
+{
+	uint64_t *ids = malloc((h->nr ? h->nr : 1) * sizeof(ids[0]));
+	struct id_hash_slot *s;
+	size_t nr = 0;
+
+	if (!ids) {
+		pr_perror("Can't allocate ids");
+		return NULL;
+	}
+
+	id_hash_foreach(h, s)
+		ids[nr++] = s->id;
+	qsort(ids, nr, sizeof(ids[0]), id_cmp);
+	return ids;
+}
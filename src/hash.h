@@ -0,0 +1,40 @@
+#ifndef HASH_H__
+#define HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Open addressing hash of pointers keyed by 64 bit
+ * ids with linear probing, NULL values mark empty
+ * slots. Deletion shifts the following entries back
+ * so there are no tombstones.
+ */
+struct id_hash_slot {
+	uint64_t	id;
+	void		*val;
+};
+
+struct id_hash {
+	struct id_hash_slot	*slots;
+	size_t			size;
+	size_t			nr;
+};
+
+extern void id_hash_init(struct id_hash *h);
+extern void id_hash_fini(struct id_hash *h);
+extern void *id_hash_get(const struct id_hash *h, uint64_t id);
+extern int id_hash_put(struct id_hash *h, uint64_t id, void *val);
+extern void *id_hash_del(struct id_hash *h, uint64_t id);
+extern uint64_t *id_hash_ids(const struct id_hash *h);
+
+static inline size_t id_hash_slot(const struct id_hash *h, uint64_t id)
+{
+	return (id * 0x9e3779b97f4a7c15ull) >> 32 & (h->size - 1);
+}
+
+#define id_hash_foreach(h, s)						\
+	for ((s) = (h)->slots; (s) < (h)->slots + (h)->size; (s)++)	\
+		if ((s)->val)
+
+#endif /* HASH_H__ */
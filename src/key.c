@@ -0,0 +1,469 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "key.h"
+#include "load.h"
+#include "log.h"
+
+#include "msgpuck/msgpuck.h"
+
+/* Field number of a part, [field, type, ...] or {field = ..., ...} */
+static int part_field(const char **pos, uint32_t *field)
+{
+	uint32_t size, len;
+	const char *str;
+	uint64_t val;
+	int ret = -1;
+
+	switch (mp_typeof(**pos)) {
+	case MP_ARRAY:
+		size = mp_decode_array(pos);
+		for (uint32_t i = 0; i < size; i++) {
+			if (i || mp_typeof(**pos) != MP_UINT) {
+				mp_next(pos);
+				continue;
+			}
+			val = mp_decode_uint(pos);
+			if (val < UINT32_MAX) {
+				*field = val;
+				ret = 0;
+			}
+		}
+		return ret;
+	case MP_MAP:
+		size = mp_decode_map(pos);
+		for (uint32_t i = 0; i < size; i++) {
+			if (mp_typeof(**pos) != MP_STR) {
+				mp_next(pos);
+				mp_next(pos);
+				continue;
+			}
+			str = mp_decode_str(pos, &len);
+			if (len != 5 || memcmp(str, "field", 5) ||
+			    mp_typeof(**pos) != MP_UINT) {
+				mp_next(pos);
+				continue;
+			}
+			val = mp_decode_uint(pos);
+			if (val < UINT32_MAX) {
+				*field = val;
+				ret = 0;
+			}
+		}
+		return ret;
+	default:
+		mp_next(pos);
+		return -1;
+	}
+}
+
+/*
+ * Key parts of an _index tuple. Since 1.7 it is [space, iid,
+ * name, type, opts, parts] with every part either an array
+ * or a map, 1.6 has [space, iid, name, type, unique, count,
+ * field, type, ...] instead. The tuple must be valid.
+ */
+int key_def_decode(struct key_def *kd, const char *tuple)
+{
+	uint32_t count, nr;
+
+	if (mp_typeof(*tuple) != MP_ARRAY)
+		return -1;
+	count = mp_decode_array(&tuple);
+	if (count < 6)
+		return -1;
+	for (int i = 0; i < 4; i++)
+		mp_next(&tuple);
+
+	if (mp_typeof(*tuple) == MP_UINT) {
+		mp_next(&tuple);
+		if (mp_typeof(*tuple) != MP_UINT)
+			return -1;
+		nr = mp_decode_uint(&tuple);
+		if (!nr || nr > KEY_PARTS_MAX || count < 6 + 2 * nr)
+			return -1;
+
+		for (uint32_t i = 0; i < nr; i++) {
+			if (mp_typeof(*tuple) != MP_UINT)
+				return -1;
+			kd->fields[i] = mp_decode_uint(&tuple);
+			mp_next(&tuple);
+		}
+	} else {
+		mp_next(&tuple);
+		if (mp_typeof(*tuple) != MP_ARRAY)
+			return -1;
+		nr = mp_decode_array(&tuple);
+		if (!nr || nr > KEY_PARTS_MAX)
+			return -1;
+
+		for (uint32_t i = 0; i < nr; i++) {
+			if (part_field(&tuple, &kd->fields[i]))
+				return -1;
+		}
+	}
+
+	kd->nr_parts = nr;
+	return 0;
+}
+
+/* A number in its shortest encoding, integral ones are integers */
+static char *canon_number(const char **pos, char *p)
+{
+	double d;
+
+	switch (mp_typeof(**pos)) {
+	case MP_UINT:
+		return mp_encode_uint(p, mp_decode_uint(pos));
+	case MP_INT: {
+		int64_t v = mp_decode_int(pos);
+
+		if (v >= 0)
+			return mp_encode_uint(p, v);
+		return mp_encode_int(p, v);
+	}
+	case MP_FLOAT:
+		d = mp_decode_float(pos);
+		break;
+	default:
+		d = mp_decode_double(pos);
+	}
+
+	if (d >= 0 && d < 0x1p64 && d == (double)(uint64_t)d)
+		return mp_encode_uint(p, (uint64_t)d);
+	if (d < 0 && d >= -0x1p63 && d == (double)(int64_t)d)
+		return mp_encode_int(p, (int64_t)d);
+	return mp_encode_double(p, d);
+}
+
+/*
+ * Append a value in its shortest encoding, so that equal
+ * keys are equal bytes whatever the encoder was: numbers
+ * are integers if they are integral, strings get minimal
+ * headers, the rest is copied as is.
+ */
+static int canon_value(const char **pos, struct obuf *out)
+{
+	const char *start = *pos;
+	uint32_t len;
+	char *p;
+
+	p = obuf_reserve(out, 9);
+	if (!p)
+		return -1;
+
+	switch (mp_typeof(**pos)) {
+	case MP_UINT:
+	case MP_INT:
+	case MP_FLOAT:
+	case MP_DOUBLE:
+		out->len += canon_number(pos, p) - p;
+		return 0;
+	case MP_STR:
+		start = mp_decode_str(pos, &len);
+		p = obuf_reserve(out, 5 + len);
+		if (!p)
+			return -1;
+		out->len += mp_encode_str(p, start, len) - p;
+		return 0;
+	case MP_BIN:
+		start = mp_decode_bin(pos, &len);
+		p = obuf_reserve(out, 5 + len);
+		if (!p)
+			return -1;
+		out->len += mp_encode_bin(p, start, len) - p;
+		return 0;
+	default:
+		mp_next(pos);
+		obuf_put(out, start, *pos - start);
+		return out->error ? -1 : 0;
+	}
+}
+
+/* Whether a value is equal to a canonical one, nothing is copied */
+static bool canon_equal(const char **pos, const char **canon)
+{
+	const char *a = *pos, *b = *canon;
+	uint32_t la, lb;
+	char buf[9];
+
+	mp_next(canon);
+	switch (mp_typeof(*a)) {
+	case MP_UINT:
+	case MP_INT:
+	case MP_FLOAT:
+	case MP_DOUBLE:
+		la = canon_number(pos, buf) - buf;
+		return la == *canon - b && !memcmp(buf, b, la);
+	case MP_STR:
+		a = mp_decode_str(pos, &la);
+		if (mp_typeof(*b) != MP_STR)
+			return false;
+		b = mp_decode_str(&b, &lb);
+		return la == lb && !memcmp(a, b, la);
+	case MP_BIN:
+		a = mp_decode_bin(pos, &la);
+		if (mp_typeof(*b) != MP_BIN)
+			return false;
+		b = mp_decode_bin(&b, &lb);
+		return la == lb && !memcmp(a, b, la);
+	default:
+		mp_next(pos);
+		return *pos - a == *canon - b && !memcmp(a, b, *pos - a);
+	}
+}
+
+static int put_array(struct obuf *out, uint32_t size)
+{
+	char *p = obuf_reserve(out, 5);
+
+	if (!p)
+		return -1;
+	out->len += mp_encode_array(p, size) - p;
+	return 0;
+}
+
+/* Canonical key of a valid tuple, -1 if it has no such fields */
+int key_from_tuple(const struct key_def *kd, const char *tuple,
+		   struct obuf *out)
+{
+	const char *fields[KEY_PARTS_MAX];
+	uint32_t count, max = 0;
+
+	for (uint32_t i = 0; i < kd->nr_parts; i++) {
+		if (kd->fields[i] >= max)
+			max = kd->fields[i] + 1;
+	}
+
+	if (mp_typeof(*tuple) != MP_ARRAY)
+		return -1;
+	count = mp_decode_array(&tuple);
+	if (count < max)
+		return -1;
+
+	for (uint32_t i = 0; i < max; i++) {
+		for (uint32_t j = 0; j < kd->nr_parts; j++) {
+			if (kd->fields[j] == i)
+				fields[j] = tuple;
+		}
+		mp_next(&tuple);
+	}
+
+	if (put_array(out, kd->nr_parts))
+		return -1;
+	for (uint32_t i = 0; i < kd->nr_parts; i++) {
+		if (canon_value(&fields[i], out))
+			return -1;
+	}
+	return 0;
+}
+
+/* Canonical form of a valid key, a scalar is a one part key */
+int key_canon(const char *key, struct obuf *out)
+{
+	uint32_t size = 1;
+
+	if (mp_typeof(*key) == MP_ARRAY)
+		size = mp_decode_array(&key);
+
+	if (put_array(out, size))
+		return -1;
+	for (uint32_t i = 0; i < size; i++) {
+		if (canon_value(&key, out))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Whether the key of a valid tuple starts with a canonical
+ * one, which has no more parts than the key definition.
+ */
+bool key_match_tuple(const struct key_def *kd, const char *tuple,
+		     const char *canon)
+{
+	const char *fields[KEY_PARTS_MAX];
+	uint32_t count, nr, max = 0;
+
+	nr = mp_decode_array(&canon);
+	for (uint32_t i = 0; i < nr; i++) {
+		if (kd->fields[i] >= max)
+			max = kd->fields[i] + 1;
+	}
+
+	if (mp_typeof(*tuple) != MP_ARRAY)
+		return false;
+	count = mp_decode_array(&tuple);
+	if (count < max)
+		return false;
+
+	for (uint32_t i = 0; i < max; i++) {
+		for (uint32_t j = 0; j < nr; j++) {
+			if (kd->fields[j] == i)
+				fields[j] = tuple;
+		}
+		mp_next(&tuple);
+	}
+
+	for (uint32_t i = 0; i < nr; i++) {
+		if (!canon_equal(&fields[i], &canon))
+			return false;
+	}
+	return true;
+}
+
+/* Whether a valid key starts with a canonical one */
+bool key_match(const char *key, const char *canon)
+{
+	uint32_t size = 1, nr = mp_decode_array(&canon);
+
+	if (mp_typeof(*key) == MP_ARRAY)
+		size = mp_decode_array(&key);
+	if (size < nr)
+		return false;
+
+	for (uint32_t i = 0; i < nr; i++) {
+		if (!canon_equal(&key, &canon))
+			return false;
+	}
+	return true;
+}
+
+uint32_t key_hash(const char *key, size_t len)
+{
+	uint64_t h = len * 0x9e3779b97f4a7c15ull, w;
+
+	for (; len >= 8; key += 8, len -= 8) {
+		h = (h ^ load_u64(key)) * 0xff51afd7ed558ccdull;
+		h ^= h >> 32;
+	}
+	if (len) {
+		w = 0;
+		memcpy(&w, key, len);
+		h = (h ^ w) * 0xff51afd7ed558ccdull;
+	}
+
+	h ^= h >> 29;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	return h ^ h >> 32;
+}
+
+/* Order of types when values of different ones are compared */
+static int type_class(const char *pos)
+{
+	switch (mp_typeof(*pos)) {
+	case MP_NIL:
+		return 0;
+	case MP_BOOL:
+		return 1;
+	case MP_UINT:
+	case MP_INT:
+	case MP_FLOAT:
+	case MP_DOUBLE:
+		return 2;
+	case MP_STR:
+		return 3;
+	case MP_BIN:
+		return 4;
+	default:
+		return 5;
+	}
+}
+
+/* A number as an integer if it is one, as a double otherwise */
+static bool decode_number(const char **pos, __int128 *i, double *d)
+{
+	switch (mp_typeof(**pos)) {
+	case MP_UINT:
+		*i = mp_decode_uint(pos);
+		return true;
+	case MP_INT:
+		*i = mp_decode_int(pos);
+		return true;
+	case MP_FLOAT:
+		*d = mp_decode_float(pos);
+		return false;
+	default:
+		*d = mp_decode_double(pos);
+		return false;
+	}
+}
+
+static int compare_bytes(const char *a, uint32_t alen,
+			 const char *b, uint32_t blen)
+{
+	int ret = memcmp(a, b, alen < blen ? alen : blen);
+
+	if (ret)
+		return ret;
+	return alen < blen ? -1 : alen > blen;
+}
+
+static int value_compare(const char **a, const char **b)
+{
+	int ca = type_class(*a), cb = type_class(*b);
+	const char *sa, *sb;
+	uint32_t la, lb;
+	__int128 ia, ib;
+	double da, db;
+	bool ai, bi;
+
+	if (ca != cb) {
+		mp_next(a);
+		mp_next(b);
+		return ca < cb ? -1 : 1;
+	}
+
+	switch (ca) {
+	case 0:
+		mp_next(a);
+		mp_next(b);
+		return 0;
+	case 1:
+		return (int)mp_decode_bool(a) - (int)mp_decode_bool(b);
+	case 2:
+		ai = decode_number(a, &ia, &da);
+		bi = decode_number(b, &ib, &db);
+		if (ai && bi)
+			return ia < ib ? -1 : ia > ib;
+		if (ai)
+			da = ia;
+		if (bi)
+			db = ib;
+		return da < db ? -1 : da > db;
+	case 3:
+		sa = mp_decode_str(a, &la);
+		sb = mp_decode_str(b, &lb);
+		return compare_bytes(sa, la, sb, lb);
+	case 4:
+		sa = mp_decode_bin(a, &la);
+		sb = mp_decode_bin(b, &lb);
+		return compare_bytes(sa, la, sb, lb);
+	default:
+		sa = *a;
+		sb = *b;
+		mp_next(a);
+		mp_next(b);
+		return compare_bytes(sa, *a - sa, sb, *b - sb);
+	}
+}
+
+/* Order of valid keys, parts compare as tarantool's scalar type does */
+int key_compare(const char *a, const char *b)
+{
+	uint32_t na, nb;
+	int ret;
+
+	if (mp_typeof(*a) != MP_ARRAY || mp_typeof(*b) != MP_ARRAY)
+		return value_compare(&a, &b);
+
+	na = mp_decode_array(&a);
+	nb = mp_decode_array(&b);
+	for (uint32_t i = 0; i < na && i < nb; i++) {
+		ret = value_compare(&a, &b);
+		if (ret)
+			return ret;
+	}
+	return na < nb ? -1 : na > nb;
+}
@@ -0,0 +1,31 @@
+#ifndef KEY_H__
+#define KEY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "obuf.h"
+
+enum {
+	/** Parts of a key, way more than any real index has */
+	KEY_PARTS_MAX		= 64,
+};
+
+/* Tuple fields making up a key, zero based */
+struct key_def {
+	uint32_t	nr_parts;
+	uint32_t	fields[KEY_PARTS_MAX];
+};
+
+extern int key_def_decode(struct key_def *kd, const char *tuple);
+extern int key_from_tuple(const struct key_def *kd, const char *tuple,
+			  struct obuf *out);
+extern int key_canon(const char *key, struct obuf *out);
+extern bool key_match_tuple(const struct key_def *kd, const char *tuple,
+			    const char *canon);
+extern bool key_match(const char *key, const char *canon);
+extern uint32_t key_hash(const char *key, size_t len);
+extern int key_compare(const char *a, const char *b);
+
+#endif /* KEY_H__ */
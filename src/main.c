@@ -4,55 +4,422 @@
 #include <fcntl.h>
 #include <getopt.h>
 
-#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "log.h"
 #include "xlog.h"
+#include "reader.h"
+#include "opts.h"
+#include "pool.h"
+#include "crc32c.h"
+#include "marker.h"
+#include "obuf.h"
+#include "emit.h"
+#include "files.h"
+#include "stats.h"
+#include "memtx.h"
+#include "writer.h"
+
+struct opts opts = {
+	.reader		= READER_READ,
+	.bufsize	= READER_BUFSIZE_DEF,
+	.jobs		= 1,
+	.format		= "text",
+	.zstd_level	= WRITER_ZSTD_LEVEL_DEF,
+};
+
+static void usage(const char *name)
+{
+	pr_info("Usage: %s [options] path...\n"
+		"\n"
+		"A path may be a file, a directory or a glob pattern, snapshots\n"
+		"and xlogs of directories and patterns are dumped in vclock order.\n"
+		"Lists of IDS and TYPES are comma separated, TIME is seconds\n"
+		"since the epoch or an UTC date like '2020-06-13 12:05:59'.\n"
+		"\n"
+		"Options:\n"
+		"  -r, --reader=TYPE       input backend: mmap, read (default), window, uring\n"
+		"  -b, --buffer-size=SIZE  read buffer or mmap window size (default 8M)\n"
+		"  -j, --jobs=N            decode blocks with N threads, 0 for all CPUs\n"
+		"  -f, --format=FORMAT     output format: text (default), json\n"
+		"  -s, --space=IDS         show rows of these spaces only\n"
+		"  -t, --type=TYPES        show rows of these request types only\n"
+		"      --replica=IDS       show rows of these replicas only\n"
+		"      --group=IDS         show rows of these groups only\n"
+		"      --from-lsn=LSN      show rows with LSN >= LSN\n"
+		"      --to-lsn=LSN        show rows with LSN <= LSN\n"
+		"      --from-time=TIME    show rows written at or after TIME\n"
+		"      --to-time=TIME      show rows written at or before TIME\n"
+		"  -k, --key=KEY           show the rows of --space changing the tuple\n"
+		"                          with this primary key, comma separated parts\n"
+		"                          of which strings may be double quoted; a key\n"
+		"                          with fewer parts matches those it starts,\n"
+		"                          rows by secondary keys are not matched\n"
+		"      --key-fields=FIELDS the primary key fields, one based (default 1)\n"
+		"  -x, --index             seek by LSN or time with a block index kept\n"
+		"                          next to the file, build it if needed, xlogs\n"
+		"                          are bisected without it by time, or by LSN\n"
+		"                          if --replica leaves a single replica\n"
+		"      --index-dir=DIR     keep block indexes in DIR, implies --index\n"
+		"  -L, --layout            replay a vylog and show the vinyl layout\n"
+		"  -F, --follow            wait for the last xlog to grow and go on with\n"
+		"                          the xlogs written after it, like tail -f\n"
+		"  -T, --tx                show rows grouped by transaction, with its\n"
+		"                          size, duration and statement counts\n"
+		"  -S, --stats             show rows, bytes, request types, tuple sizes\n"
+		"                          and write rates by space and replica\n"
+		"  -u, --summary           read row headers only, show a line per file\n"
+		"                          with its row count, LSN and time range\n"
+		"  -R, --recover           skip damaged blocks up to the next good one\n"
+		"                          and go on, showing the byte ranges skipped\n"
+		"  -P, --replay            rebuild memtx spaces from the last snapshot\n"
+		"                          and the xlogs after it up to --to-lsn or\n"
+		"                          --to-time and show their tuples\n"
+		"  -w, --write=PATH        write the rows passing the filters of a file\n"
+		"                          to a new one, a directory gets it under the\n"
+		"                          same name; with --replay write the spaces to\n"
+		"                          a snapshot named by vclock in a directory\n"
+		"      --zstd-level=N      compress written blocks at level N, 0 for\n"
+		"                          none (default 3)\n"
+		"  -V, --verify            verify block checksums instead of dumping\n"
+		"  -h, --help              show this help\n",
+		name);
+}
+
+static int parse_size(const char *str, size_t *size)
+{
+	char *end;
+	unsigned long long v = strtoull(str, &end, 0);
+
+	switch (*end) {
+	case 'G': case 'g':
+		v <<= 10;
+		/* fallthrough */
+	case 'M': case 'm':
+		v <<= 10;
+		/* fallthrough */
+	case 'K': case 'k':
+		v <<= 10;
+		end++;
+	}
+
+	if (end == str || *end != '\0') {
+		pr_err("Invalid size %s\n", str);
+		return -1;
+	}
+
+	*size = v;
+	return 0;
+}
+
+enum {
+	OPT_REPLICA = 256,
+	OPT_GROUP,
+	OPT_FROM_LSN,
+	OPT_TO_LSN,
+	OPT_FROM_TIME,
+	OPT_TO_TIME,
+	OPT_INDEX_DIR,
+	OPT_ZSTD_LEVEL,
+	OPT_KEY_FIELDS,
+};
 
 int main(int argc, char *argv[])
 {
-	xlog_ctx_t ctx;
+	static const char short_opts[] = "r:b:j:f:s:t:k:xLFTSuRPw:Vh";
+	static const struct option long_opts[] = {
+		{ "reader",		required_argument,	0, 'r' },
+		{ "buffer-size",	required_argument,	0, 'b' },
+		{ "jobs",		required_argument,	0, 'j' },
+		{ "format",		required_argument,	0, 'f' },
+		{ "space",		required_argument,	0, 's' },
+		{ "type",		required_argument,	0, 't' },
+		{ "replica",		required_argument,	0, OPT_REPLICA },
+		{ "group",		required_argument,	0, OPT_GROUP },
+		{ "from-lsn",		required_argument,	0, OPT_FROM_LSN },
+		{ "to-lsn",		required_argument,	0, OPT_TO_LSN },
+		{ "from-time",		required_argument,	0, OPT_FROM_TIME },
+		{ "to-time",		required_argument,	0, OPT_TO_TIME },
+		{ "key",		required_argument,	0, 'k' },
+		{ "key-fields",		required_argument,	0, OPT_KEY_FIELDS },
+		{ "index",		no_argument,		0, 'x' },
+		{ "index-dir",		required_argument,	0, OPT_INDEX_DIR },
+		{ "layout",		no_argument,		0, 'L' },
+		{ "follow",		no_argument,		0, 'F' },
+		{ "tx",			no_argument,		0, 'T' },
+		{ "stats",		no_argument,		0, 'S' },
+		{ "summary",		no_argument,		0, 'u' },
+		{ "recover",		no_argument,		0, 'R' },
+		{ "replay",		no_argument,		0, 'P' },
+		{ "write",		required_argument,	0, 'w' },
+		{ "zstd-level",		required_argument,	0, OPT_ZSTD_LEVEL },
+		{ "verify",		no_argument,		0, 'V' },
+		{ "help",		no_argument,		0, 'h' },
+		{ },
+	};
 
-	if (argc < 2) {
+	struct xfile_list files = { };
+	const struct emitter *em;
+	struct obuf out;
+	struct stat st;
+	struct filter *f = &opts.filter;
+	int opt, ret;
+	char *end;
+	long jobs;
+
+	filter_init(f);
+
+	while ((opt = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			opts.reader = reader_lookup(optarg);
+			if (opts.reader < 0) {
+				pr_err("Unknown reader %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b':
+			if (parse_size(optarg, &opts.bufsize))
+				return 1;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' ||
+			    jobs < 0 || jobs > POOL_WORKERS_MAX) {
+				pr_err("Invalid number of jobs %s\n", optarg);
+				return 1;
+			}
+			opts.jobs = jobs ? jobs : pool_nr_cpus();
+			break;
+		case 'f':
+			opts.format = optarg;
+			break;
+		case 's':
+			ret = filter_parse_ids(&f->space_ids, optarg);
+			goto filter;
+		case 't':
+			ret = filter_parse_types(&f->types, optarg);
+			goto filter;
+		case OPT_REPLICA:
+			ret = filter_parse_ids(&f->replica_ids, optarg);
+			goto filter;
+		case OPT_GROUP:
+			ret = filter_parse_ids(&f->group_ids, optarg);
+			goto filter;
+		case OPT_FROM_LSN:
+			ret = filter_parse_lsn(&f->from_lsn, optarg);
+			goto filter;
+		case OPT_TO_LSN:
+			ret = filter_parse_lsn(&f->to_lsn, optarg);
+			goto filter;
+		case OPT_FROM_TIME:
+			ret = filter_parse_time(&f->from_tm, optarg);
+			goto filter;
+		case OPT_TO_TIME:
+			ret = filter_parse_time(&f->to_tm, optarg);
+			goto filter;
+		case 'k':
+			ret = filter_parse_key(f, optarg);
+			goto filter;
+		case OPT_KEY_FIELDS:
+			ret = filter_parse_key_fields(&f->key_def, optarg);
+filter:
+			if (ret)
+				return 1;
+			f->enabled = true;
+			break;
+		case OPT_INDEX_DIR:
+			opts.index_dir = optarg;
+			/* fallthrough */
+		case 'x':
+			opts.index = true;
+			break;
+		case 'L':
+			opts.layout = true;
+			break;
+		case 'F':
+			opts.follow = true;
+			break;
+		case 'T':
+			opts.tx = true;
+			break;
+		case 'S':
+			opts.stats = true;
+			break;
+		case 'u':
+			opts.summary = true;
+			break;
+		case 'R':
+			opts.recover = true;
+			break;
+		case 'P':
+			opts.replay = true;
+			break;
+		case 'w':
+			opts.write = optarg;
+			break;
+		case OPT_ZSTD_LEVEL:
+			opts.zstd_level = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' ||
+			    opts.zstd_level < ZSTD_minCLevel() ||
+			    opts.zstd_level > ZSTD_maxCLevel()) {
+				pr_err("Invalid zstd level %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'V':
+			opts.verify = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
 		pr_err("Provide path\n");
 		return 1;
 	}
 
-	int fd = open(argv[1], O_RDWR);
-	if (fd < 0) {
-		pr_perror("Can't open %s", argv[1]);
+	if (opts.follow) {
+		if (opts.verify || opts.layout) {
+			pr_err("Can't follow with --verify or --layout\n");
+			return 1;
+		}
+		/* These map the file size known at open only */
+		if (opts.reader == READER_MMAP || opts.reader == READER_URING)
+			opts.reader = READER_READ;
+	}
+
+	if (opts.tx && (opts.verify || opts.layout)) {
+		pr_err("Can't group transactions with --verify or --layout\n");
 		return 1;
 	}
 
-	struct stat st;
-	if (fstat(fd, &st) < 0) {
-		pr_perror("Can't stat %s", argv[1]);
-		close(fd);
+	if (opts.stats && (opts.verify || opts.layout || opts.follow || opts.tx)) {
+		pr_err("Can't collect statistics with --verify, --layout, --follow or --tx\n");
+		return 1;
+	}
+
+	if (opts.summary && (opts.verify || opts.layout || opts.follow ||
+			     opts.tx || opts.stats)) {
+		pr_err("Can't summarize with --verify, --layout, --follow, --tx or --stats\n");
 		return 1;
 	}
 
-	void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
-			  MAP_PRIVATE, fd, 0);
-	if (addr == MAP_FAILED) {
-		pr_perror("Can't mmap %s", argv[1]);
-		close(fd);
+	if (opts.recover && (opts.verify || opts.layout || opts.follow)) {
+		pr_err("Can't recover with --verify, --layout or --follow\n");
 		return 1;
 	}
 
-	xlog_ctx_create(&ctx);
+	if (opts.replay && (opts.verify || opts.layout || opts.follow ||
+			    opts.tx || opts.stats || opts.summary || opts.recover)) {
+		pr_err("Can't replay with --verify, --layout, --follow, --tx, --stats, --summary or --recover\n");
+		return 1;
+	}
 
-	ctx.path = argv[1];
-	ctx.data = addr;
-	ctx.end = addr + st.st_size;
-	ctx.meta = addr;
-	ctx.size = st.st_size;
+	/* A replay starts from a snapshot and goes over all rows */
+	if (opts.replay && (f->from_lsn != INT64_MIN || f->from_tm != -INFINITY ||
+			    !id_set_empty(&f->types) || !id_set_empty(&f->group_ids) ||
+			    f->key)) {
+		pr_err("Can't replay with --from-lsn, --from-time, --type, --group or --key\n");
+		return 1;
+	}
+
+	/* Keys of different spaces have nothing in common */
+	if (f->key && id_set_empty(&f->space_ids)) {
+		pr_err("Can't look up a key without --space\n");
+		return 1;
+	}
+
+	if (f->key && f->key_parts > f->key_def.nr_parts) {
+		pr_err("Key has %u parts, the primary key has %u\n",
+		       f->key_parts, f->key_def.nr_parts);
+		return 1;
+	}
+
+	if (opts.write && (opts.verify || opts.layout || opts.follow ||
+			   opts.tx || opts.stats || opts.summary)) {
+		pr_err("Can't write with --verify, --layout, --follow, --tx, --stats or --summary\n");
+		return 1;
+	}
+
+	/* A file is rewritten as a whole, not a directory or a pattern */
+	if (opts.write && !opts.replay &&
+	    (optind != argc - 1 || stat(argv[optind], &st) || S_ISDIR(st.st_mode))) {
+		pr_err("Can only write a single file without --replay\n");
+		return 1;
+	}
+
+	em = emitter_lookup(opts.format);
+	if (!em) {
+		pr_err("Unknown format %s\n", opts.format);
+		return 1;
+	}
+
+	crc32c_init();
+	marker_init();
+
+	if (obuf_init(&out, STDOUT_FILENO, OBUF_SIZE_DEF))
+		return 1;
+
+	/* A single file is dumped as is, whatever its name is */
+	if (opts.write && !opts.replay) {
+		ret = xfile_rewrite(argv[optind], opts.write, &out);
+	} else if (!opts.replay && optind == argc - 1 && !stat(argv[optind], &st) &&
+		   !S_ISDIR(st.st_mode)) {
+		ret = opts.follow ? xfile_follow(argv[optind], &out) :
+			xfile_dump(argv[optind], &out, opts.jobs);
+	} else {
+		ret = 0;
+		for (int i = optind; i < argc && !ret; i++)
+			ret = xfile_list_add(&files, argv[i]);
+		if (!ret && !files.nr) {
+			pr_err("No snapshots or xlogs found\n");
+			ret = -1;
+		}
+		if (!ret)
+			ret = xfile_list_sort(&files);
+		if (!ret && !files.nr) {
+			pr_err("No readable snapshots or xlogs found\n");
+			ret = -1;
+		}
+		if (!ret && opts.replay) {
+			ret = memtx_replay(&files, &out);
+		} else if (!ret && opts.follow) {
+			/* The newest file is the live one */
+			files.nr--;
+			ret = xfile_list_dump(&files, &out, opts.jobs);
+			files.nr++;
+			if (!ret)
+				ret = xfile_follow(files.files[files.nr - 1].path, &out);
+		} else if (!ret) {
+			ret = xfile_list_dump(&files, &out, opts.jobs);
+		}
+		if (files.nr_broken)
+			ret = -1;
+		xfile_list_fini(&files);
+	}
+
+	if (opts.stats) {
+		struct stats *st = stats_collect();
+
+		if (st)
+			em->stats(&out, st);
+		else
+			ret = -1;
+		stats_fini();
+	}
 
-	int ret = parse_file(&ctx);
-	munmap(addr, st.st_size);
-	close(fd);
+	if (obuf_flush(&out))
+		ret = -1;
 
-	xlog_ctx_destroy(&ctx);
+	obuf_fini(&out);
+	xlog_dctx_cache_fini();
+	filter_fini(f);
 	return ret;
 }
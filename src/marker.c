@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "marker.h"
+#include "load.h"
+
+#include "msgpuck/msgpuck.h"
+
+#if defined(__x86_64__)
+# include <immintrin.h>
+#endif
+
+/*
+ * All markers start with 0xd5, the second byte is 0xba
+ * for row and zrow markers and 0x10 for the eof one.
+ */
+enum {
+	MARKER_BYTE0		= 0xd5,
+	MARKER_BYTE1_ROW	= 0xba,
+	MARKER_BYTE1_EOF	= 0x10,
+};
+
+static bool marker_at(const char *pos)
+{
+	switch (load_u32(pos)) {
+	case mp_bswap_u32(0xd5ba0bab):
+	case mp_bswap_u32(0xd5ba0bba):
+	case mp_bswap_u32(0xd510aded):
+		return true;
+	}
+	return false;
+}
+
+static const char *marker_find_sw(const char *pos, const char *end)
+{
+	while (end - pos >= 4) {
+		pos = memchr(pos, MARKER_BYTE0, end - pos - 3);
+		if (!pos)
+			return NULL;
+		if (marker_at(pos))
+			return pos;
+		pos++;
+	}
+	return NULL;
+}
+
+const char *(*marker_find)(const char *pos, const char *end) = marker_find_sw;
+
+#if defined(__x86_64__)
+
+/*
+ * Candidates are positions having the first two marker
+ * bytes, they are checked one by one.
+ */
+static const char *marker_find_sse2(const char *pos, const char *end)
+{
+	const __m128i b0 = _mm_set1_epi8((char)MARKER_BYTE0);
+	const __m128i b1 = _mm_set1_epi8((char)MARKER_BYTE1_ROW);
+	const __m128i b1e = _mm_set1_epi8((char)MARKER_BYTE1_EOF);
+
+	/* Every candidate of a vector has its whole marker in bounds */
+	while (end - pos >= 16 + 3) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)pos);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(pos + 1));
+		unsigned int m;
+
+		m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0, b0),
+				      _mm_or_si128(_mm_cmpeq_epi8(v1, b1),
+						   _mm_cmpeq_epi8(v1, b1e))));
+		for (; m; m &= m - 1) {
+			const char *p = pos + __builtin_ctz(m);
+
+			if (marker_at(p))
+				return p;
+		}
+		pos += 16;
+	}
+	return marker_find_sw(pos, end);
+}
+
+/* Candidates of a vector with its first marker bytes found in @e */
+__attribute__((target("avx2")))
+static const char *marker_check_avx2(const char *pos, __m256i e)
+{
+	__m256i v1 = _mm256_loadu_si256((const __m256i *)(pos + 1));
+	unsigned int m;
+
+	e = _mm256_and_si256(e, _mm256_or_si256(
+		_mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)MARKER_BYTE1_ROW)),
+		_mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)MARKER_BYTE1_EOF))));
+	for (m = _mm256_movemask_epi8(e); m; m &= m - 1) {
+		if (marker_at(pos + __builtin_ctz(m)))
+			return pos + __builtin_ctz(m);
+	}
+	return NULL;
+}
+
+/*
+ * Here a chunk without the first marker byte, which is
+ * the common case, is skipped after a compare per vector.
+ */
+__attribute__((target("avx2")))
+static const char *marker_find_avx2(const char *pos, const char *end)
+{
+	const __m256i b0 = _mm256_set1_epi8((char)MARKER_BYTE0);
+	const char *p;
+
+	/* Aligned loads don't cross cache lines */
+	p = (const char *)(((uintptr_t)pos + 31) & ~(uintptr_t)31);
+	if (p > pos && end - pos >= 32 + 3) {
+		p = marker_find_sse2(pos, p + 3);
+		if (p)
+			return p;
+		pos = (const char *)(((uintptr_t)pos + 31) & ~(uintptr_t)31);
+	}
+
+	while (end - pos >= 128 + 3) {
+		const __m256i *v = (const __m256i *)pos;
+		__m256i e0 = _mm256_cmpeq_epi8(_mm256_load_si256(v), b0);
+		__m256i e1 = _mm256_cmpeq_epi8(_mm256_load_si256(v + 1), b0);
+		__m256i e2 = _mm256_cmpeq_epi8(_mm256_load_si256(v + 2), b0);
+		__m256i e3 = _mm256_cmpeq_epi8(_mm256_load_si256(v + 3), b0);
+		__m256i any = _mm256_or_si256(_mm256_or_si256(e0, e1),
+					      _mm256_or_si256(e2, e3));
+
+		if (!_mm256_testz_si256(any, any) &&
+		    ((p = marker_check_avx2(pos, e0)) ||
+		     (p = marker_check_avx2(pos + 32, e1)) ||
+		     (p = marker_check_avx2(pos + 64, e2)) ||
+		     (p = marker_check_avx2(pos + 96, e3))))
+			return p;
+		pos += 128;
+	}
+	return marker_find_sse2(pos, end);
+}
+
+#endif /* __x86_64__ */
+
+void marker_init(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		marker_find = marker_find_avx2;
+	else
+		marker_find = marker_find_sse2;
+#endif
+}
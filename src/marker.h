@@ -0,0 +1,13 @@
+#ifndef MARKER_H__
+#define MARKER_H__
+
+/*
+ * Look for a row, zrow or eof marker of an xlog block
+ * fully within [@pos, @end), NULL if there is none. Used
+ * to get back in sync after garbage.
+ */
+extern const char *(*marker_find)(const char *pos, const char *end);
+
+extern void marker_init(void);
+
+#endif /* MARKER_H__ */
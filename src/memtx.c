@@ -0,0 +1,1075 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "memtx.h"
+#include "arena.h"
+#include "key.h"
+#include "update.h"
+#include "hash.h"
+#include "files.h"
+#include "xlog.h"
+#include "emit.h"
+#include "writer.h"
+#include "opts.h"
+#include "log.h"
+
+#include "msgpuck/msgpuck.h"
+
+/* A slot of a space table, empty ones have no data */
+struct memtx_tuple {
+	const char	*data;
+	uint32_t	size;
+	uint32_t	hash;
+};
+
+/*
+ * Tuples of a space by primary key, an open addressing table
+ * with linear probing kept under 3/4 full. Snapshot rows are
+ * appended unhashed, their keys are known once _index is.
+ * Replaced tuples stay in the arena till it is compacted.
+ */
+struct memtx_space {
+	uint32_t		id;
+	struct key_def		kd;
+	struct memtx_tuple	*slots;
+	size_t			size;
+	size_t			nr;
+	bool			hashed;
+	struct arena		arena;
+	size_t			live;
+	size_t			garbage;
+};
+
+struct memtx {
+	struct id_hash		spaces;
+	struct update		update;
+	/* Key of the current row and a key to compare with */
+	struct obuf		key;
+	struct obuf		tmp;
+	struct memtx_summary	sum;
+	/* Loading the snapshot */
+	bool			snap;
+	/* The target is reached */
+	bool			done;
+	/* Out of memory */
+	bool			error;
+};
+
+/* Request fields of a DML body */
+struct dml {
+	uint32_t	space_id;
+	uint32_t	index_id;
+	int		index_base;
+	const char	*tuple;
+	const char	*tuple_end;
+	const char	*key;
+	const char	*ops;
+};
+
+/* System spaces are kept anyway, they define the others */
+static bool space_wanted(uint32_t id)
+{
+	const struct id_set *ids = &opts.filter.space_ids;
+
+	return id <= BOX_SYSTEM_ID_MAX || id_set_empty(ids) || id_set_has(ids, id);
+}
+
+static struct memtx_space *space_new(struct memtx *mx, uint32_t id)
+{
+	struct memtx_space *s = calloc(1, sizeof(*s));
+
+	if (!s) {
+		pr_perror("Can't allocate space %u", id);
+		mx->error = true;
+		return NULL;
+	}
+
+	s->id = id;
+	arena_create(&s->arena);
+	if (id_hash_put(&mx->spaces, id, s)) {
+		free(s);
+		mx->error = true;
+		return NULL;
+	}
+	return s;
+}
+
+static void space_clear(struct memtx_space *s)
+{
+	free(s->slots);
+	s->slots = NULL;
+	s->size = 0;
+	s->nr = 0;
+	s->live = 0;
+	s->garbage = 0;
+	arena_destroy(&s->arena);
+}
+
+static void space_free(struct memtx_space *s)
+{
+	space_clear(s);
+	free(s);
+}
+
+/* The slot of a key or the empty one it would go to */
+static bool space_find(struct memtx *mx, struct memtx_space *s,
+		       const char *key, size_t len, uint32_t hash, size_t *slot)
+{
+	size_t mask = s->size - 1, i;
+
+	if (!s->size)
+		return false;
+
+	for (i = hash & mask; s->slots[i].data; i = (i + 1) & mask) {
+		const struct memtx_tuple *t = &s->slots[i];
+
+		if (t->hash != hash)
+			continue;
+		mx->tmp.len = 0;
+		if (key_from_tuple(&s->kd, t->data, &mx->tmp))
+			continue;
+		if (mx->tmp.len == len && !memcmp(mx->tmp.buf, key, len))
+			break;
+	}
+
+	*slot = i;
+	return s->slots[i].data != NULL;
+}
+
+static int space_grow(struct memtx *mx, struct memtx_space *s)
+{
+	size_t size = s->size ? s->size * 2 : 64, mask = size - 1;
+	struct memtx_tuple *slots = calloc(size, sizeof(slots[0]));
+
+	if (!slots) {
+		pr_perror("Can't grow space %u", s->id);
+		mx->error = true;
+		return -1;
+	}
+
+	for (size_t i = 0; i < s->size; i++) {
+		const struct memtx_tuple *t = &s->slots[i];
+		size_t j;
+
+		if (!t->data)
+			continue;
+		for (j = t->hash & mask; slots[j].data; j = (j + 1) & mask)
+			;
+		slots[j] = *t;
+	}
+
+	free(s->slots);
+	s->slots = slots;
+	s->size = size;
+	return 0;
+}
+
+/* Move live tuples to a new arena when most of the old one is garbage */
+static int space_compact(struct memtx *mx, struct memtx_space *s)
+{
+	struct arena arena;
+	char *p;
+
+	if (s->garbage < MEMTX_GARBAGE_MIN || s->garbage < s->live)
+		return 0;
+
+	/* Everything is deleted, as a queue does all the time */
+	if (!s->live) {
+		arena_destroy(&s->arena);
+		s->garbage = 0;
+		return 0;
+	}
+
+	arena_create(&arena);
+	p = arena_alloc(&arena, s->live);
+	if (!p) {
+		pr_err("Can't compact space %u\n", s->id);
+		mx->error = true;
+		return -1;
+	}
+
+	for (size_t i = 0; i < s->size; i++) {
+		struct memtx_tuple *t = &s->slots[i];
+
+		if (!t->data)
+			continue;
+		memcpy(p, t->data, t->size);
+		t->data = p;
+		p += t->size;
+	}
+
+	arena_destroy(&s->arena);
+	s->arena = arena;
+	s->garbage = 0;
+	return 0;
+}
+
+static char *space_copy(struct memtx *mx, struct memtx_space *s,
+			const char *tuple, uint32_t size)
+{
+	char *data = arena_alloc(&s->arena, size);
+
+	if (!data) {
+		pr_err("Can't store a tuple of space %u\n", s->id);
+		mx->error = true;
+		return NULL;
+	}
+	memcpy(data, tuple, size);
+	return data;
+}
+
+/* Insert or replace a tuple in the arena with the key in mx->key */
+static int space_put(struct memtx *mx, struct memtx_space *s,
+		     const char *data, uint32_t size)
+{
+	uint32_t hash = key_hash(mx->key.buf, mx->key.len);
+	struct memtx_tuple *t;
+	size_t slot;
+
+	if (4 * (s->nr + 1) > 3 * s->size && space_grow(mx, s))
+		return -1;
+
+	if (space_find(mx, s, mx->key.buf, mx->key.len, hash, &slot)) {
+		s->live -= s->slots[slot].size;
+		s->garbage += s->slots[slot].size;
+	} else
+		s->nr++;
+
+	t = &s->slots[slot];
+	t->data = data;
+	t->size = size;
+	t->hash = hash;
+	s->live += size;
+	return space_compact(mx, s);
+}
+
+static int space_replace(struct memtx *mx, struct memtx_space *s,
+			 const char *tuple, uint32_t size)
+{
+	char *data = space_copy(mx, s, tuple, size);
+
+	if (!data)
+		return -1;
+	return space_put(mx, s, data, size);
+}
+
+/* Move back the tuples which can't be found past the hole */
+static int space_delete(struct memtx *mx, struct memtx_space *s, size_t i)
+{
+	size_t mask = s->size - 1, j;
+
+	s->live -= s->slots[i].size;
+	s->garbage += s->slots[i].size;
+	s->slots[i].data = NULL;
+	s->nr--;
+
+	for (j = (i + 1) & mask; s->slots[j].data; j = (j + 1) & mask) {
+		size_t home = s->slots[j].hash & mask;
+
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			s->slots[i] = s->slots[j];
+			s->slots[j].data = NULL;
+			i = j;
+		}
+	}
+	return space_compact(mx, s);
+}
+
+/* A snapshot row, there are no duplicates in a consistent one */
+static int space_append(struct memtx *mx, struct memtx_space *s,
+			const char *tuple, uint32_t size)
+{
+	struct memtx_tuple *t;
+
+	if (s->nr == s->size) {
+		size_t nr = s->size ? s->size * 2 : 64;
+
+		t = realloc(s->slots, nr * sizeof(t[0]));
+		if (!t) {
+			pr_perror("Can't grow space %u", s->id);
+			mx->error = true;
+			return -1;
+		}
+		s->slots = t;
+		s->size = nr;
+	}
+
+	t = &s->slots[s->nr];
+	t->data = space_copy(mx, s, tuple, size);
+	if (!t->data)
+		return -1;
+	t->size = size;
+	s->nr++;
+	s->live += size;
+	return 0;
+}
+
+/*
+ * Put the tuples into the table by their keys, after the
+ * snapshot and when the primary key changes. The ones
+ * without the key fields are dropped.
+ */
+static int space_hash(struct memtx *mx, struct memtx_space *s)
+{
+	struct memtx_tuple *vec = s->slots;
+	size_t nr = 0, size = 64;
+
+	if (s->hashed) {
+		for (size_t i = 0; i < s->size; i++) {
+			if (vec[i].data)
+				vec[nr++] = vec[i];
+		}
+	} else
+		nr = s->nr;
+
+	while (4 * (nr + 1) > 3 * size)
+		size *= 2;
+	s->slots = calloc(size, sizeof(s->slots[0]));
+	if (!s->slots) {
+		pr_perror("Can't allocate space %u", s->id);
+		s->slots = vec;
+		s->nr = nr;
+		s->hashed = false;
+		mx->error = true;
+		return -1;
+	}
+
+	s->size = size;
+	s->nr = 0;
+	s->live = 0;
+	s->hashed = true;
+	for (size_t i = 0; i < nr; i++) {
+		uint32_t hash;
+		size_t slot;
+
+		mx->key.len = 0;
+		if (key_from_tuple(&s->kd, vec[i].data, &mx->key)) {
+			s->garbage += vec[i].size;
+			mx->sum.failed++;
+			continue;
+		}
+
+		hash = key_hash(mx->key.buf, mx->key.len);
+		if (space_find(mx, s, mx->key.buf, mx->key.len, hash, &slot)) {
+			s->live -= s->slots[slot].size;
+			s->garbage += s->slots[slot].size;
+		} else
+			s->nr++;
+
+		s->slots[slot] = vec[i];
+		s->slots[slot].hash = hash;
+		s->live += vec[i].size;
+	}
+
+	free(vec);
+	return space_compact(mx, s);
+}
+
+/* Primary key of a space as _index has it, the first field if it doesn't */
+static void space_key_def(struct memtx *mx, uint32_t id, struct key_def *kd)
+{
+	struct memtx_space *s = id_hash_get(&mx->spaces, BOX_INDEX_ID);
+	struct key_def def;
+	char buf[16], *p;
+	size_t slot;
+
+	kd->nr_parts = 1;
+	kd->fields[0] = 0;
+	if (id == BOX_INDEX_ID) {
+		kd->nr_parts = 2;
+		kd->fields[1] = 1;
+		return;
+	}
+	if (!s || !s->hashed)
+		return;
+
+	p = mp_encode_array(buf, 2);
+	p = mp_encode_uint(p, id);
+	p = mp_encode_uint(p, 0);
+	if (space_find(mx, s, buf, p - buf, key_hash(buf, p - buf), &slot) &&
+	    !key_def_decode(&def, s->slots[slot].data))
+		*kd = def;
+}
+
+/* Space of an xlog row, created on the first use */
+static struct memtx_space *space_get(struct memtx *mx, uint32_t id)
+{
+	struct memtx_space *s = id_hash_get(&mx->spaces, id);
+
+	if (s)
+		return s;
+
+	s = space_new(mx, id);
+	if (s) {
+		space_key_def(mx, id, &s->kd);
+		s->hashed = true;
+	}
+	return s;
+}
+
+/* _index goes first, the other keys are defined by it */
+static int memtx_build(struct memtx *mx)
+{
+	struct memtx_space *s = id_hash_get(&mx->spaces, BOX_INDEX_ID);
+	struct id_hash_slot *slot;
+
+	if (s) {
+		space_key_def(mx, BOX_INDEX_ID, &s->kd);
+		if (space_hash(mx, s))
+			return -1;
+	}
+
+	id_hash_foreach(&mx->spaces, slot) {
+		s = slot->val;
+		if (s->hashed)
+			continue;
+		space_key_def(mx, s->id, &s->kd);
+		if (space_hash(mx, s))
+			return -1;
+	}
+	return 0;
+}
+
+static int dml_decode(const struct xrow_header *hdr, struct dml *d)
+{
+	const char *pos, *end, *val;
+	bool has_space = false;
+	uint32_t size;
+
+	memset(d, 0, sizeof(*d));
+	if (!hdr->bodycnt)
+		return -1;
+
+	pos = hdr->body[0].iov_base;
+	end = pos + hdr->body[0].iov_len;
+	val = pos;
+	if (mp_check(&val, end) || mp_typeof(*pos) != MP_MAP)
+		return -1;
+
+	size = mp_decode_map(&pos);
+	for (uint32_t i = 0; i < size; i++) {
+		uint64_t key;
+
+		if (mp_typeof(*pos) != MP_UINT) {
+			mp_next(&pos);
+			mp_next(&pos);
+			continue;
+		}
+		key = mp_decode_uint(&pos);
+		val = pos;
+		mp_next(&pos);
+
+		switch (key) {
+		case IPROTO_SPACE_ID:
+		case IPROTO_INDEX_ID:
+		case IPROTO_INDEX_BASE:
+			if (mp_typeof(*val) != MP_UINT)
+				return -1;
+			if (key == IPROTO_SPACE_ID) {
+				d->space_id = mp_decode_uint(&val);
+				has_space = true;
+			} else if (key == IPROTO_INDEX_ID)
+				d->index_id = mp_decode_uint(&val);
+			else
+				d->index_base = mp_decode_uint(&val) ? 1 : 0;
+			break;
+		case IPROTO_TUPLE:
+			if (mp_typeof(*val) != MP_ARRAY)
+				return -1;
+			d->tuple = val;
+			d->tuple_end = pos;
+			break;
+		case IPROTO_KEY:
+			if (mp_typeof(*val) != MP_ARRAY)
+				return -1;
+			d->key = val;
+			break;
+		case IPROTO_OPS:
+			d->ops = val;
+			break;
+		}
+	}
+	return has_space ? 0 : -1;
+}
+
+/*
+ * Apply operations to the tuple in @slot, the key is in mx->key.
+ * The size of the result is known before it is written, so it
+ * is put right into the arena.
+ */
+static int space_update(struct memtx *mx, struct memtx_space *s, size_t slot,
+			const struct dml *d, bool upsert)
+{
+	const struct memtx_tuple *old = &s->slots[slot];
+	struct update *u = &mx->update;
+	char *data;
+
+	/* Upsert keeps the tuple if its operations make no sense */
+	if (update_decode(u, d->ops, d->index_base))
+		return upsert ? 0 : -1;
+	if (update_apply(u, old->data, old->size, upsert))
+		return -1;
+
+	data = arena_alloc(&s->arena, u->len);
+	if (!data) {
+		pr_err("Can't store a tuple of space %u\n", s->id);
+		mx->error = true;
+		return -1;
+	}
+	update_write(u, data);
+
+	/* The primary key can't change */
+	mx->tmp.len = 0;
+	if (key_from_tuple(&s->kd, data, &mx->tmp) ||
+	    mx->tmp.len != mx->key.len ||
+	    memcmp(mx->tmp.buf, mx->key.buf, mx->key.len)) {
+		s->garbage += u->len;
+		return upsert ? 0 : -1;
+	}
+
+	return space_put(mx, s, data, u->len);
+}
+
+/* 0 if applied, 1 if it can't be resolved by the primary key */
+static int apply_dml(struct memtx *mx, uint32_t type, const struct dml *d)
+{
+	struct memtx_space *s;
+	size_t slot;
+
+	switch (type) {
+	case IPROTO_INSERT:
+	case IPROTO_REPLACE:
+	case IPROTO_UPSERT:
+		if (!d->tuple || (type == IPROTO_UPSERT && !d->ops))
+			return -1;
+		s = space_get(mx, d->space_id);
+		if (!s)
+			return -1;
+		mx->key.len = 0;
+		if (key_from_tuple(&s->kd, d->tuple, &mx->key))
+			return -1;
+		if (type == IPROTO_UPSERT &&
+		    space_find(mx, s, mx->key.buf, mx->key.len,
+			       key_hash(mx->key.buf, mx->key.len), &slot))
+			return space_update(mx, s, slot, d, true);
+		return space_replace(mx, s, d->tuple, d->tuple_end - d->tuple);
+	case IPROTO_DELETE:
+	case IPROTO_UPDATE:
+		if (!d->key || (type == IPROTO_UPDATE && !d->ops))
+			return -1;
+		if (d->index_id)
+			return 1;
+		s = id_hash_get(&mx->spaces, d->space_id);
+		if (!s)
+			return -1;
+		mx->key.len = 0;
+		if (key_canon(d->key, &mx->key) ||
+		    !space_find(mx, s, mx->key.buf, mx->key.len,
+				key_hash(mx->key.buf, mx->key.len), &slot))
+			return -1;
+		if (type == IPROTO_DELETE)
+			return space_delete(mx, s, slot);
+		return space_update(mx, s, slot, d, false);
+	default:
+		return 0;
+	}
+}
+
+/* The first two fields of a tuple or a key, if they are ids */
+static int decode_ids(const char *pos, uint32_t *a, uint32_t *b)
+{
+	uint32_t size = mp_decode_array(&pos);
+
+	*b = 0;
+	if (!size || mp_typeof(*pos) != MP_UINT)
+		return -1;
+	*a = mp_decode_uint(&pos);
+	if (size > 1 && mp_typeof(*pos) == MP_UINT)
+		*b = mp_decode_uint(&pos);
+	return 0;
+}
+
+/*
+ * Follow the schema: a dropped space goes away, a truncated
+ * one is emptied, a new primary key rehashes the tuples.
+ */
+static int apply_schema(struct memtx *mx, uint32_t type, const struct dml *d)
+{
+	const char *pos = d->tuple;
+	struct memtx_space *s;
+	struct key_def kd;
+	uint32_t id, iid;
+
+	if (d->space_id != BOX_SPACE_ID && d->space_id != BOX_INDEX_ID &&
+	    d->space_id != BOX_TRUNCATE_ID)
+		return 0;
+	if (type == IPROTO_DELETE || type == IPROTO_UPDATE)
+		pos = d->key;
+	if (!pos || decode_ids(pos, &id, &iid))
+		return 0;
+
+	s = id_hash_get(&mx->spaces, id);
+	if (!s || id == d->space_id)
+		return 0;
+
+	switch (d->space_id) {
+	case BOX_SPACE_ID:
+		if (type == IPROTO_DELETE) {
+			id_hash_del(&mx->spaces, id);
+			space_free(s);
+		}
+		return 0;
+	case BOX_TRUNCATE_ID:
+		if (type != IPROTO_DELETE)
+			space_clear(s);
+		return 0;
+	default:
+		if (type == IPROTO_DELETE || iid)
+			return 0;
+		space_key_def(mx, id, &kd);
+		if (kd.nr_parts == s->kd.nr_parts &&
+		    !memcmp(kd.fields, s->kd.fields,
+			    kd.nr_parts * sizeof(kd.fields[0])))
+			return 0;
+		s->kd = kd;
+		return space_hash(mx, s);
+	}
+}
+
+/* The first row past the target ends the replay, transactions aren't split */
+static bool past_target(const struct xrow_header *hdr)
+{
+	const struct filter *f = &opts.filter;
+
+	if (hdr->tm > f->to_tm)
+		return true;
+	if (!id_set_empty(&f->replica_ids) &&
+	    !id_set_has(&f->replica_ids, hdr->replica_id))
+		return false;
+	return hdr->tsn > f->to_lsn;
+}
+
+static int replay_row(const struct xrow_header *hdr, void *arg)
+{
+	struct memtx *mx = arg;
+	struct memtx_space *s;
+	struct dml d;
+	int ret;
+
+	if (mx->snap) {
+		if (hdr->type != IPROTO_INSERT && hdr->type != IPROTO_REPLACE)
+			return 0;
+		mx->sum.snap_rows++;
+		if (dml_decode(hdr, &d) || !d.tuple) {
+			mx->sum.failed++;
+			return 0;
+		}
+		if (!space_wanted(d.space_id))
+			return 0;
+		s = id_hash_get(&mx->spaces, d.space_id);
+		if (!s)
+			s = space_new(mx, d.space_id);
+		if (!s || space_append(mx, s, d.tuple, d.tuple_end - d.tuple))
+			return -1;
+		return 0;
+	}
+
+	if (hdr->replica_id >= VCLOCK_MAX) {
+		mx->sum.failed++;
+		return 0;
+	}
+	if (hdr->lsn <= mx->sum.vclock[hdr->replica_id]) {
+		mx->sum.skipped++;
+		return 0;
+	}
+	if (past_target(hdr)) {
+		mx->done = true;
+		return -1;
+	}
+	mx->sum.vclock[hdr->replica_id] = hdr->lsn;
+
+	if (hdr->type < IPROTO_INSERT || hdr->type > IPROTO_UPSERT)
+		return 0;
+	if (dml_decode(hdr, &d)) {
+		mx->sum.failed++;
+		return 0;
+	}
+	/* Operations of an update go in place of the tuple */
+	if (hdr->type == IPROTO_UPDATE && !d.ops)
+		d.ops = d.tuple;
+	if (!space_wanted(d.space_id))
+		return 0;
+
+	ret = apply_dml(mx, hdr->type, &d);
+	if (!ret)
+		ret = apply_schema(mx, hdr->type, &d);
+	if (ret > 0)
+		mx->sum.unresolved++;
+	else if (ret < 0)
+		mx->sum.failed++;
+	else
+		mx->sum.applied++;
+	return mx->error ? -1 : 0;
+}
+
+struct dump_entry {
+	const char	*tuple;
+	size_t		key;
+};
+
+static int dump_cmp(const void *x, const void *y, void *arg)
+{
+	const struct dump_entry *a = x, *b = y;
+	const char *keys = arg;
+
+	return key_compare(keys + a->key, keys + b->key);
+}
+
+/* Tuples of a space in the primary key order, to be freed by the caller */
+static struct dump_entry *space_sort(struct memtx *mx, struct memtx_space *s,
+				     size_t *nr)
+{
+	struct dump_entry *e = malloc((s->nr ? s->nr : 1) * sizeof(e[0]));
+
+	if (!e) {
+		pr_perror("Can't allocate space %u", s->id);
+		return NULL;
+	}
+
+	*nr = 0;
+	mx->key.len = 0;
+	for (size_t i = 0; i < s->size; i++) {
+		if (!s->slots[i].data)
+			continue;
+		e[*nr].tuple = s->slots[i].data;
+		e[*nr].key = mx->key.len;
+		if (key_from_tuple(&s->kd, e[*nr].tuple, &mx->key)) {
+			free(e);
+			return NULL;
+		}
+		(*nr)++;
+	}
+
+	qsort_r(e, *nr, sizeof(e[0]), dump_cmp, mx->key.buf);
+	return e;
+}
+
+static int dump_space(struct memtx *mx, struct memtx_space *s,
+		      const struct emitter *em, struct obuf *out)
+{
+	struct dump_entry *e;
+	size_t nr;
+
+	e = space_sort(mx, s, &nr);
+	if (!e)
+		return -1;
+	for (size_t i = 0; i < nr; i++)
+		em->tuple(out, s->id, e[i].tuple);
+
+	mx->sum.spaces++;
+	mx->sum.tuples += nr;
+	free(e);
+	return 0;
+}
+
+/* Snapshot rows are inserts numbered from zero */
+static int write_space(struct memtx *mx, struct memtx_space *s,
+		       struct writer *w, double tm)
+{
+	struct xrow_header hdr = {
+		.type		= IPROTO_INSERT,
+		.tm		= tm,
+		.is_commit	= true,
+		.bodycnt	= 2,
+	};
+	struct dump_entry *e;
+	char body[16], *p;
+	size_t nr;
+	int ret = 0;
+
+	e = space_sort(mx, s, &nr);
+	if (!e)
+		return -1;
+
+	/* The space id is a uint32 whatever it is, as tarantool puts it */
+	p = mp_encode_map(body, 2);
+	p = mp_encode_uint(p, IPROTO_SPACE_ID);
+	*p++ = 0xce;
+	p = mp_store_u32(p, s->id);
+	p = mp_encode_uint(p, IPROTO_TUPLE);
+	hdr.body[0].iov_base = body;
+	hdr.body[0].iov_len = p - body;
+
+	for (size_t i = 0; i < nr && !ret; i++) {
+		const char *end = e[i].tuple;
+
+		mp_next(&end);
+		hdr.lsn = w->rows;
+		hdr.body[1].iov_base = (void *)e[i].tuple;
+		hdr.body[1].iov_len = end - e[i].tuple;
+		ret = writer_row(w, &hdr);
+	}
+
+	mx->sum.spaces++;
+	mx->sum.tuples += nr;
+	free(e);
+	return ret;
+}
+
+/* A directory gets a file named by the signature, as tarantool names them */
+static char *snap_path(const char *path, const int64_t *vclock)
+{
+	int64_t signature = 0;
+	struct stat st;
+	char *name;
+
+	if (stat(path, &st) || !S_ISDIR(st.st_mode))
+		return strdup(path);
+
+	for (int i = 0; i < VCLOCK_MAX; i++)
+		signature += vclock[i];
+	if (asprintf(&name, "%s/%020lld.snap", path, (long long)signature) < 0)
+		return NULL;
+	return name;
+}
+
+/*
+ * Put all spaces kept into a snapshot at the vclock the replay
+ * stopped at, system ones go first as their ids are lower.
+ */
+static int memtx_write(struct memtx *mx, const struct xfile *src)
+{
+	struct writer_meta meta = {
+		.instance	= src ? src->instance : NULL,
+		.version	= src ? src->version : NULL,
+	};
+	char vclock[VCLOCK_MAX * 24];
+	uint64_t *spaces = id_hash_ids(&mx->spaces);
+	size_t nr = mx->spaces.nr;
+	struct timespec ts;
+	struct writer w;
+	char *path;
+	int ret = 0;
+
+	if (!spaces)
+		return -1;
+	vclock_format(vclock, sizeof(vclock), mx->sum.vclock);
+	meta.vclock = vclock;
+	path = snap_path(opts.write, mx->sum.vclock);
+	if (!path) {
+		pr_perror("Can't allocate path");
+		free(spaces);
+		return -1;
+	}
+	if (writer_open(&w, path, WAL_TYPE_SNAP, &meta, opts.zstd_level,
+			opts.jobs)) {
+		free(path);
+		free(spaces);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	for (size_t i = 0; i < nr && !ret; i++)
+		ret = write_space(mx, id_hash_get(&mx->spaces, spaces[i]), &w,
+				  ts.tv_sec + ts.tv_nsec / 1e9);
+	free(spaces);
+
+	if (ret)
+		writer_abort(&w);
+	else
+		ret = writer_close(&w);
+	if (!ret)
+		mx->sum.written = path;
+	else
+		free(path);
+	return ret;
+}
+
+static int memtx_dump(struct memtx *mx, struct obuf *out)
+{
+	const struct emitter *em = emitter_lookup(opts.format);
+	const struct id_set *ids = &opts.filter.space_ids;
+	uint64_t *spaces = id_hash_ids(&mx->spaces);
+	size_t nr = mx->spaces.nr;
+	int ret = 0;
+
+	if (!spaces)
+		return -1;
+
+	for (size_t i = 0; i < nr && !ret; i++) {
+		if (!id_set_empty(ids) && !id_set_has(ids, spaces[i]))
+			continue;
+		ret = dump_space(mx, id_hash_get(&mx->spaces, spaces[i]), em, out);
+	}
+	free(spaces);
+	return ret;
+}
+
+static void memtx_create(struct memtx *mx)
+{
+	memset(mx, 0, sizeof(*mx));
+	id_hash_init(&mx->spaces);
+	update_create(&mx->update);
+	mx->key.fd = -1;
+	mx->tmp.fd = -1;
+}
+
+static void memtx_destroy(struct memtx *mx)
+{
+	struct id_hash_slot *s;
+
+	id_hash_foreach(&mx->spaces, s)
+		space_free(s->val);
+	id_hash_fini(&mx->spaces);
+	update_destroy(&mx->update);
+	obuf_fini(&mx->key);
+	obuf_fini(&mx->tmp);
+}
+
+static bool vclock_le(const int64_t *a, const int64_t *b)
+{
+	for (int i = 0; i < VCLOCK_MAX; i++) {
+		if (a[i] > b[i])
+			return false;
+	}
+	return true;
+}
+
+/*
+ * The last xlog started before a snapshot, which has the rows
+ * right after it. The files after the snapshot if there is none,
+ * the replay reports the rows missing then.
+ */
+static size_t snap_xlog(const struct xfile_list *l, const struct xfile *snap)
+{
+	size_t first = snap - l->files;
+
+	for (size_t i = 0; i < l->nr; i++) {
+		if (l->files[i].type == WAL_TYPE_XLOG &&
+		    vclock_le(l->files[i].vclock, snap->vclock))
+			first = i;
+	}
+	return first;
+}
+
+struct snap_probe {
+	const int64_t	*vclock;
+	double		tm;
+	bool		found;
+};
+
+static int snap_probe_row(const struct xrow_header *hdr, void *arg)
+{
+	struct snap_probe *p = arg;
+
+	if (hdr->replica_id >= VCLOCK_MAX ||
+	    hdr->lsn <= p->vclock[hdr->replica_id])
+		return 0;
+	p->tm = hdr->tm;
+	p->found = true;
+	return -1;
+}
+
+/*
+ * A snapshot taken before the target. Snapshots have no times,
+ * the row right after one tells when it was taken, its mtime
+ * does if there are no rows after it.
+ */
+static bool snap_usable(const struct xfile_list *l, const struct xfile *snap)
+{
+	struct snap_probe p = { .vclock = snap->vclock, };
+	struct stat st;
+
+	for (uint32_t r = 0; r < VCLOCK_MAX; r++) {
+		if ((id_set_empty(&opts.filter.replica_ids) ||
+		     id_set_has(&opts.filter.replica_ids, r)) &&
+		    snap->vclock[r] > opts.filter.to_lsn)
+			return false;
+	}
+	if (opts.filter.to_tm == INFINITY)
+		return true;
+
+	for (size_t i = snap_xlog(l, snap); i < l->nr && !p.found; i++) {
+		if (l->files[i].type == WAL_TYPE_XLOG)
+			xlog_scan(l->files[i].path, WAL_TYPE_XLOG, snap_probe_row, &p);
+	}
+	if (p.found)
+		return p.tm <= opts.filter.to_tm;
+	return !stat(snap->path, &st) && st.st_mtime <= opts.filter.to_tm;
+}
+
+/*
+ * Rebuild the state of memtx spaces at the target: load the
+ * last snapshot before it, then apply xlog rows not covered
+ * by the snapshot vclock in the order they were written.
+ * The files must be sorted.
+ */
+int memtx_replay(struct xfile_list *l, struct obuf *out)
+{
+	const struct xfile *snap = NULL, *src;
+	size_t first = 0;
+	struct memtx mx;
+	int ret = 0;
+
+	for (size_t i = l->nr; i-- > 0 && !snap;) {
+		if (l->files[i].type == WAL_TYPE_SNAP && snap_usable(l, &l->files[i]))
+			snap = &l->files[i];
+	}
+
+	memtx_create(&mx);
+
+	/* The meta of a snapshot written comes from the first file replayed */
+	src = snap;
+	if (snap) {
+		mx.sum.snap = snap->path;
+		mx.snap = true;
+		ret = xlog_scan(snap->path, WAL_TYPE_SNAP, replay_row, &mx);
+		mx.snap = false;
+		if (!ret)
+			ret = memtx_build(&mx);
+		memcpy(mx.sum.vclock, snap->vclock, sizeof(mx.sum.vclock));
+		first = snap_xlog(l, snap);
+	}
+
+	for (size_t i = first; i < l->nr && !ret && !mx.done; i++) {
+		const struct xfile *f = &l->files[i];
+
+		if (f->type != WAL_TYPE_XLOG)
+			continue;
+		if (!vclock_le(f->vclock, mx.sum.vclock)) {
+			char have[VCLOCK_MAX * 24], want[VCLOCK_MAX * 24];
+
+			vclock_format(have, sizeof(have), mx.sum.vclock);
+			vclock_format(want, sizeof(want), f->vclock);
+			pr_err("%s: missing .xlog file between %s and %s\n",
+			       f->path, have, want);
+			ret = -1;
+			break;
+		}
+
+		if (!src)
+			src = f;
+		mx.sum.nr_xlogs++;
+		ret = xlog_scan(f->path, WAL_TYPE_XLOG, replay_row, &mx);
+		if (ret && mx.done)
+			ret = 0;
+	}
+
+	if (!ret && mx.error)
+		ret = -1;
+	if (!ret && opts.write)
+		ret = memtx_write(&mx, src);
+	else if (!ret)
+		ret = memtx_dump(&mx, out);
+	if (!ret)
+		emitter_lookup(opts.format)->replay(out, &mx.sum);
+	free(mx.sum.written);
+
+	memtx_destroy(&mx);
+	return ret;
+}
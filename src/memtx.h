@@ -0,0 +1,38 @@
+#ifndef MEMTX_H__
+#define MEMTX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+struct xfile_list;
+struct obuf;
+
+enum {
+	/** Tuples are moved to a new arena once this much is freed */
+	MEMTX_GARBAGE_MIN	= 1u << 20,
+};
+
+/* What a replay went through */
+struct memtx_summary {
+	const char	*snap;
+	uint64_t	nr_xlogs;
+	uint64_t	snap_rows;
+	/** Xlog rows applied, covered by the snapshot, not applicable */
+	uint64_t	applied;
+	uint64_t	skipped;
+	uint64_t	failed;
+	/** Deletes and updates by secondary keys */
+	uint64_t	unresolved;
+	uint64_t	spaces;
+	uint64_t	tuples;
+	/** Where the replay stopped */
+	int64_t		vclock[VCLOCK_MAX];
+	/** The snapshot written instead of showing tuples */
+	char		*written;
+};
+
+extern int memtx_replay(struct xfile_list *l, struct obuf *out);
+
+#endif /* MEMTX_H__ */
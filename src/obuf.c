@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sys/uio.h>
+
+#include "obuf.h"
+#include "log.h"
+
+const char obuf_digits2[200] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+int obuf_init(struct obuf *ob, int fd, size_t size)
+{
+	ob->fd = fd;
+	ob->error = 0;
+	ob->len = 0;
+	ob->size = size;
+	ob->buf = malloc(size);
+	if (!ob->buf) {
+		pr_perror("Can't allocate output buffer");
+		return -1;
+	}
+	return 0;
+}
+
+void obuf_fini(struct obuf *ob)
+{
+	free(ob->buf);
+	ob->buf = NULL;
+}
+
+static int obuf_writev(struct obuf *ob, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt) {
+		ssize_t ret = writev(ob->fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!ob->error)
+				pr_perror("Can't write output");
+			ob->error = errno;
+			return -1;
+		}
+
+		while (iovcnt && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base += ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+int obuf_flush(struct obuf *ob)
+{
+	struct iovec iov = {
+		.iov_base	= ob->buf,
+		.iov_len	= ob->len,
+	};
+
+	if (ob->fd < 0 || !ob->len)
+		return ob->error ? -1 : 0;
+
+	ob->len = 0;
+	if (ob->error)
+		return -1;
+	return obuf_writev(ob, &iov, 1);
+}
+
+/* Make room for at least @len bytes */
+int obuf_grow(struct obuf *ob, size_t len)
+{
+	if (ob->fd >= 0) {
+		obuf_flush(ob);
+		if (ob->size >= len)
+			return ob->error ? -1 : 0;
+	}
+
+	size_t size = ob->size ? ob->size : 4096;
+	while (size - ob->len < len)
+		size *= 2;
+
+	char *buf = realloc(ob->buf, size);
+	if (!buf) {
+		pr_perror("Can't grow output buffer");
+		ob->error = ENOMEM;
+		return -1;
+	}
+	ob->buf = buf;
+	ob->size = size;
+	return 0;
+}
+
+/*
+ * Append a chunk of formatted data, the large ones
+ * are written together with the buffer in one go
+ * without copying.
+ */
+void obuf_write(struct obuf *ob, const char *data, size_t len)
+{
+	if (ob->fd < 0 || len < ob->size - ob->len) {
+		obuf_put(ob, data, len);
+		return;
+	}
+
+	struct iovec iov[2] = {
+		{ .iov_base = ob->buf,		.iov_len = ob->len, },
+		{ .iov_base = (void *)data,	.iov_len = len, },
+	};
+
+	ob->len = 0;
+	if (!ob->error)
+		obuf_writev(ob, iov, 2);
+}
+
+void obuf_printf(struct obuf *ob, const char *fmt, ...)
+{
+	size_t avail = ob->size - ob->len;
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(ob->buf + ob->len, avail, fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return;
+
+	if ((size_t)len >= avail) {
+		if (!obuf_reserve(ob, len + 1))
+			return;
+		va_start(args, fmt);
+		vsnprintf(ob->buf + ob->len, len + 1, fmt, args);
+		va_end(args);
+	}
+	ob->len += len;
+}
+
+/*
+ * Same as "%g": integral values are the common case
+ * and printed exactly the same way as integers while
+ * they fit into six significant digits.
+ */
+void obuf_put_double(struct obuf *ob, double v)
+{
+	if (v > -1e6 && v < 1e6 && v == (int64_t)v && (v != 0 || !signbit(v))) {
+		obuf_put_i64(ob, (int64_t)v);
+		return;
+	}
+	obuf_printf(ob, "%g", v);
+}
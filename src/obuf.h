@@ -0,0 +1,120 @@
+#ifndef OBUF_H__
+#define OBUF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "compiler.h"
+
+enum {
+	/** Default size of the output buffer (1MiB) */
+	OBUF_SIZE_DEF		= 1u << 20,
+};
+
+/*
+ * Output buffer. When bound to a file descriptor the
+ * data is flushed once the buffer is full, otherwise
+ * (fd < 0) the buffer grows and keeps everything.
+ */
+struct obuf {
+	int		fd;
+	int		error;
+	char		*buf;
+	size_t		size;
+	size_t		len;
+};
+
+extern int obuf_init(struct obuf *ob, int fd, size_t size);
+extern void obuf_fini(struct obuf *ob);
+extern int obuf_flush(struct obuf *ob);
+extern int obuf_grow(struct obuf *ob, size_t len);
+extern void obuf_write(struct obuf *ob, const char *data, size_t len);
+extern void obuf_printf(struct obuf *ob, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+extern void obuf_put_double(struct obuf *ob, double v);
+
+static inline char *obuf_reserve(struct obuf *ob, size_t len)
+{
+	if (ob->size - ob->len < len && obuf_grow(ob, len))
+		return NULL;
+	return ob->buf + ob->len;
+}
+
+static inline void obuf_put(struct obuf *ob, const char *data, size_t len)
+{
+	char *p = obuf_reserve(ob, len);
+	if (p) {
+		memcpy(p, data, len);
+		ob->len += len;
+	}
+}
+
+static inline void obuf_puts(struct obuf *ob, const char *str)
+{
+	obuf_put(ob, str, strlen(str));
+}
+
+static inline void obuf_putc(struct obuf *ob, char c)
+{
+	char *p = obuf_reserve(ob, 1);
+	if (p) {
+		*p = c;
+		ob->len++;
+	}
+}
+
+extern const char obuf_digits2[200];
+
+/* Same as "%llu" */
+static inline void obuf_put_u64(struct obuf *ob, uint64_t v)
+{
+	char tmp[20], *end = tmp + sizeof(tmp), *p = end;
+
+	while (v >= 100) {
+		unsigned int i = (v % 100) * 2;
+		v /= 100;
+		*--p = obuf_digits2[i + 1];
+		*--p = obuf_digits2[i];
+	}
+	if (v >= 10) {
+		*--p = obuf_digits2[v * 2 + 1];
+		*--p = obuf_digits2[v * 2];
+	} else
+		*--p = '0' + v;
+
+	obuf_put(ob, p, end - p);
+}
+
+/* Same as "%lld" */
+static inline void obuf_put_i64(struct obuf *ob, int64_t v)
+{
+	if (v < 0) {
+		obuf_putc(ob, '-');
+		obuf_put_u64(ob, -(uint64_t)v);
+	} else
+		obuf_put_u64(ob, v);
+}
+
+/* Same as "%#llx" */
+static inline void obuf_put_hex(struct obuf *ob, uint64_t v)
+{
+	static const char xdigits[] = "0123456789abcdef";
+	char tmp[18], *end = tmp + sizeof(tmp), *p = end;
+
+	if (!v) {
+		obuf_putc(ob, '0');
+		return;
+	}
+
+	while (v) {
+		*--p = xdigits[v & 0xf];
+		v >>= 4;
+	}
+	*--p = 'x';
+	*--p = '0';
+
+	obuf_put(ob, p, end - p);
+}
+
+#endif /* OBUF_H__ */
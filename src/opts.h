@@ -0,0 +1,31 @@
+#ifndef OPTS_H__
+#define OPTS_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "filter.h"
+
+struct opts {
+	int		reader;
+	size_t		bufsize;
+	int		jobs;
+	bool		verify;
+	bool		layout;
+	bool		follow;
+	bool		tx;
+	bool		stats;
+	bool		summary;
+	bool		recover;
+	bool		replay;
+	const char	*write;
+	int		zstd_level;
+	const char	*format;
+	bool		index;
+	const char	*index_dir;
+	struct filter	filter;
+};
+
+extern struct opts opts;
+
+#endif /* OPTS_H__ */
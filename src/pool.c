@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "log.h"
+
+enum {
+	ITEM_FREE,
+	ITEM_QUEUED,
+	ITEM_DONE,
+};
+
+struct pool_worker {
+	struct pool		*pool;
+	pthread_t		thread;
+	int			id;
+};
+
+struct pool {
+	pthread_mutex_t		lock;
+	pthread_cond_t		work_cond;
+	pthread_cond_t		done_cond;
+
+	struct pool_worker	*workers;
+	int			nr_workers;
+
+	char			*items;
+	int			*state;
+	int			nr_items;
+	size_t			item_size;
+
+	/* Sequence numbers of items */
+	unsigned long		head;
+	unsigned long		next;
+	unsigned long		tail;
+
+	bool			stop;
+	int			rc;
+
+	pool_work_t		work;
+	pool_done_t		done;
+	void			*arg;
+};
+
+static void *pool_item(struct pool *p, unsigned long seq)
+{
+	return p->items + (seq % p->nr_items) * p->item_size;
+}
+
+static void *pool_worker_fn(void *arg)
+{
+	struct pool_worker *w = arg;
+	struct pool *p = w->pool;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		unsigned long seq;
+
+		while (p->next == p->tail && !p->stop)
+			pthread_cond_wait(&p->work_cond, &p->lock);
+		if (p->next == p->tail)
+			break;
+
+		seq = p->next++;
+		pthread_mutex_unlock(&p->lock);
+
+		p->work(pool_item(p, seq), w->id, p->arg);
+
+		pthread_mutex_lock(&p->lock);
+		p->state[seq % p->nr_items] = ITEM_DONE;
+		pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+int pool_nr_cpus(void)
+{
+	long nr = sysconf(_SC_NPROCESSORS_ONLN);
+	return nr > 0 ? nr : 1;
+}
+
+struct pool *pool_create(int nr_workers, int nr_items, size_t item_size,
+			 pool_work_t work, pool_done_t done, void *arg)
+{
+	struct pool *p = calloc(1, sizeof(*p));
+	if (!p) {
+		pr_perror("Can't allocate pool");
+		return NULL;
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+
+	p->nr_items	= nr_items;
+	p->item_size	= item_size;
+	p->work		= work;
+	p->done		= done;
+	p->arg		= arg;
+
+	p->items = calloc(nr_items, item_size);
+	p->state = calloc(nr_items, sizeof(p->state[0]));
+	p->workers = calloc(nr_workers ? nr_workers : 1, sizeof(p->workers[0]));
+	if (!p->items || !p->state || !p->workers) {
+		pr_perror("Can't allocate pool items");
+		pool_destroy(p);
+		return NULL;
+	}
+
+	for (int i = 0; i < nr_workers; i++) {
+		struct pool_worker *w = &p->workers[i];
+
+		w->pool = p;
+		w->id = i;
+		if (pthread_create(&w->thread, NULL, pool_worker_fn, w)) {
+			pr_perror("Can't create worker thread");
+			pool_destroy(p);
+			return NULL;
+		}
+		p->nr_workers++;
+	}
+
+	return p;
+}
+
+/* Retire the oldest item, waiting for it if @block is set */
+static bool pool_retire(struct pool *p, bool block)
+{
+	int idx = p->head % p->nr_items;
+
+	if (p->head == p->tail)
+		return false;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->state[idx] != ITEM_DONE && block)
+		pthread_cond_wait(&p->done_cond, &p->lock);
+	if (p->state[idx] != ITEM_DONE) {
+		pthread_mutex_unlock(&p->lock);
+		return false;
+	}
+	p->state[idx] = ITEM_FREE;
+	pthread_mutex_unlock(&p->lock);
+
+	if (!p->rc && p->done(pool_item(p, p->head), p->arg))
+		p->rc = -1;
+	p->head++;
+	return true;
+}
+
+/*
+ * Get a free item to fill in, completed items
+ * are retired on the way.
+ */
+void *pool_next(struct pool *p)
+{
+	while (pool_retire(p, false))
+		;
+
+	if (p->tail - p->head == (unsigned long)p->nr_items)
+		pool_retire(p, true);
+
+	return p->rc ? NULL : pool_item(p, p->tail);
+}
+
+void pool_submit(struct pool *p)
+{
+	int idx = p->tail % p->nr_items;
+
+	if (!p->nr_workers) {
+		p->work(pool_item(p, p->tail), 0, p->arg);
+		p->state[idx] = ITEM_DONE;
+		p->tail++;
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->state[idx] = ITEM_QUEUED;
+	p->tail++;
+	pthread_cond_signal(&p->work_cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+int pool_wait(struct pool *p)
+{
+	while (pool_retire(p, true))
+		;
+	return p->rc;
+}
+
+void pool_for_each_item(struct pool *p, void (*fn)(void *item))
+{
+	for (int i = 0; i < p->nr_items; i++)
+		fn(p->items + i * p->item_size);
+}
+
+void pool_destroy(struct pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->stop = true;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->lock);
+
+	for (int i = 0; i < p->nr_workers; i++)
+		pthread_join(p->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&p->done_cond);
+	pthread_cond_destroy(&p->work_cond);
+	pthread_mutex_destroy(&p->lock);
+
+	free(p->workers);
+	free(p->state);
+	free(p->items);
+	free(p);
+}
@@ -0,0 +1,28 @@
+#ifndef POOL_H__
+#define POOL_H__
+
+#include <stddef.h>
+
+/*
+ * Ordered work pool: items are processed by worker
+ * threads in any order but retired by the submitter
+ * strictly in the order of submission.
+ */
+#define POOL_WORKERS_MAX	256
+
+typedef void (*pool_work_t)(void *item, int worker, void *arg);
+typedef int (*pool_done_t)(void *item, void *arg);
+
+struct pool;
+
+extern struct pool *pool_create(int nr_workers, int nr_items, size_t item_size,
+				pool_work_t work, pool_done_t done, void *arg);
+extern void *pool_next(struct pool *p);
+extern void pool_submit(struct pool *p);
+extern int pool_wait(struct pool *p);
+extern void pool_for_each_item(struct pool *p, void (*fn)(void *item));
+extern void pool_destroy(struct pool *p);
+
+extern int pool_nr_cpus(void);
+
+#endif /* POOL_H__ */
@@ -0,0 +1,528 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+#include "uring.h"
+#include "log.h"
+
+static size_t page_size;
+
+/*
+ * Data behind the window is not needed anymore,
+ * don't let it pollute the page cache. Data skipped
+ * by a seek hasn't been read and is left as is.
+ */
+static void reader_drop_cache(struct reader *r, off_t off)
+{
+	off_t start = r->win_off & ~((off_t)page_size - 1);
+	off_t end = off & ~((off_t)page_size - 1);
+
+	if (end > r->win_off + (off_t)r->win_len)
+		end = (r->win_off + r->win_len) & ~((off_t)page_size - 1);
+
+	if (end > start)
+		posix_fadvise(r->fd, start, end - start, POSIX_FADV_DONTNEED);
+}
+
+static int mmap_open(struct reader *r)
+{
+	if (r->size == 0)
+		return 0;
+
+	r->map_addr = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+	if (r->map_addr == MAP_FAILED) {
+		r->map_addr = NULL;
+		pr_perror("Can't mmap %s", r->path);
+		return -1;
+	}
+	r->map_len = r->size;
+	madvise(r->map_addr, r->map_len, MADV_SEQUENTIAL);
+
+	r->win = r->map_addr;
+	r->win_off = 0;
+	r->win_len = r->size;
+	return 0;
+}
+
+static int mmap_map(struct reader *r, off_t off, size_t len)
+{
+	pr_err("Out of mapping %lld:%zu\n", (long long)off, len);
+	return -1;
+}
+
+static void mmap_close(struct reader *r)
+{
+	if (r->map_addr)
+		munmap(r->map_addr, r->map_len);
+}
+
+static int read_open(struct reader *r)
+{
+	posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return 0;
+}
+
+/*
+ * Two buffers are used in turn: the tail of the current
+ * window is moved to the spare buffer and the rest is
+ * read from the file.
+ */
+static int read_map(struct reader *r, off_t off, size_t len)
+{
+	int idx = r->buf_idx ^ 1;
+	size_t want = len > r->bufsize ? len : r->bufsize;
+	size_t copied = 0;
+
+	if ((off_t)want > r->size - off)
+		want = r->size - off;
+
+	if (want > r->buf_size[idx]) {
+		char *buf = realloc(r->buf[idx], want);
+		if (!buf) {
+			pr_perror("Can't allocate read buffer");
+			return -1;
+		}
+		r->buf[idx] = buf;
+		r->buf_size[idx] = want;
+	}
+
+	if (r->win && off >= r->win_off &&
+	    off < r->win_off + (off_t)r->win_len) {
+		copied = r->win_off + r->win_len - off;
+		if (copied > want)
+			copied = want;
+		memcpy(r->buf[idx], r->win + (off - r->win_off), copied);
+	}
+
+	while (copied < want) {
+		ssize_t ret = pread(r->fd, r->buf[idx] + copied,
+				    want - copied, off + copied);
+		if (ret < 0) {
+			pr_perror("Can't read %s", r->path);
+			return -1;
+		} else if (ret == 0) {
+			pr_err("Unexpected end of %s at %lld\n", r->path,
+			       (long long)(off + copied));
+			return -1;
+		}
+		copied += ret;
+	}
+
+	reader_drop_cache(r, off);
+
+	r->buf_idx = idx;
+	r->win = r->buf[idx];
+	r->win_off = off;
+	r->win_len = want;
+	return 0;
+}
+
+static void read_close(struct reader *r)
+{
+	free(r->buf[0]);
+	free(r->buf[1]);
+}
+
+static int window_open(struct reader *r)
+{
+	posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return 0;
+}
+
+static int window_map(struct reader *r, off_t off, size_t len)
+{
+	off_t start = off & ~((off_t)page_size - 1);
+	size_t want = len + (off - start);
+	void *addr;
+
+	if (want < r->bufsize)
+		want = r->bufsize;
+	if ((off_t)want > r->size - start)
+		want = r->size - start;
+
+	addr = mmap(NULL, want, PROT_READ, MAP_PRIVATE, r->fd, start);
+	if (addr == MAP_FAILED) {
+		pr_perror("Can't mmap %s at %lld", r->path, (long long)start);
+		return -1;
+	}
+	madvise(addr, want, MADV_SEQUENTIAL);
+
+	if (r->map_addr) {
+		munmap(r->map_addr, r->map_len);
+		reader_drop_cache(r, start);
+	}
+
+	r->map_addr = addr;
+	r->map_len = want;
+	r->win = addr;
+	r->win_off = start;
+	r->win_len = want;
+	return 0;
+}
+
+struct uring_chunk {
+	char			*buf;
+	off_t			off;
+	size_t			len;
+	size_t			done;
+	bool			busy;
+};
+
+/*
+ * The file is read sequentially by chunks of the buffer
+ * size, READER_URING_DEPTH chunks are kept in flight ahead
+ * of the parser. A window which fits into a single chunk
+ * is served in place, otherwise it is assembled in a
+ * staging buffer.
+ */
+struct uring_reader {
+	struct uring		ring;
+	struct uring_chunk	chunk[READER_URING_DEPTH];
+	unsigned int		head;
+	unsigned int		nr;
+	off_t			next_off;
+};
+
+static const struct reader_ops reader_ops[READER_MAX];
+
+static int uring_queue(struct reader *r, unsigned int idx)
+{
+	struct uring_reader *u = r->priv;
+	struct uring_chunk *c = &u->chunk[idx];
+	size_t len = c->len - c->done;
+
+	if (len > (1u << 30))
+		len = 1u << 30;
+
+	c->busy = true;
+	return uring_prep_read(&u->ring, r->fd, c->buf + c->done,
+			       len, c->off + c->done, idx);
+}
+
+static int uring_schedule(struct reader *r)
+{
+	struct uring_reader *u = r->priv;
+
+	while (u->nr < READER_URING_DEPTH && u->next_off < r->size) {
+		unsigned int idx = (u->head + u->nr) % READER_URING_DEPTH;
+		struct uring_chunk *c = &u->chunk[idx];
+
+		c->off = u->next_off;
+		c->len = r->bufsize;
+		if ((off_t)c->len > r->size - c->off)
+			c->len = r->size - c->off;
+		c->done = 0;
+
+		if (uring_queue(r, idx))
+			return -1;
+
+		u->next_off += c->len;
+		u->nr++;
+	}
+
+	return uring_submit(&u->ring);
+}
+
+static int uring_reap(struct reader *r, struct uring_chunk *c)
+{
+	struct uring_reader *u = r->priv;
+
+	while (c->busy) {
+		struct uring_chunk *done;
+		uint64_t idx;
+		int res;
+
+		if (uring_wait(&u->ring, &idx, &res)) {
+			pr_perror("io_uring wait failed");
+			return -1;
+		}
+
+		done = &u->chunk[idx];
+		if (res < 0) {
+			errno = -res;
+			pr_perror("Can't read %s at %lld", r->path,
+				  (long long)(done->off + done->done));
+			done->busy = false;
+			return -1;
+		} else if (res == 0) {
+			pr_err("Unexpected end of %s at %lld\n", r->path,
+			       (long long)(done->off + done->done));
+			done->busy = false;
+			return -1;
+		}
+
+		done->done += res;
+		if (done->done < done->len) {
+			if (uring_queue(r, idx) || uring_submit(&u->ring))
+				return -1;
+		} else
+			done->busy = false;
+	}
+
+	return 0;
+}
+
+/* Wait for the reads in flight, chunks can't be reused before */
+static int uring_drain(struct reader *r)
+{
+	struct uring_reader *u = r->priv;
+
+	for (unsigned int i = 0; i < READER_URING_DEPTH; i++) {
+		while (u->chunk[i].busy) {
+			uint64_t idx;
+			int ret, res;
+
+			ret = uring_wait(&u->ring, &idx, &res);
+			if (ret) {
+				pr_err("Can't wait for reads of %s: %s\n",
+				       r->path, strerror(-ret));
+				return -1;
+			}
+			u->chunk[idx].busy = false;
+		}
+	}
+
+	u->head = 0;
+	u->nr = 0;
+	return 0;
+}
+
+static int uring_open(struct reader *r)
+{
+	struct uring_reader *u;
+	int ret;
+
+	u = calloc(1, sizeof(*u));
+	if (!u) {
+		pr_perror("Can't allocate io_uring reader");
+		return -1;
+	}
+
+	ret = uring_init(&u->ring, READER_URING_DEPTH);
+	if (ret) {
+		/*
+		 * No io_uring in the kernel or it is
+		 * prohibited, fallback to plain reads.
+		 */
+		free(u);
+		r->ops = &reader_ops[READER_READ];
+		return r->ops->open(r);
+	}
+
+	for (int i = 0; i < READER_URING_DEPTH; i++) {
+		u->chunk[i].buf = malloc(r->bufsize);
+		if (!u->chunk[i].buf) {
+			pr_perror("Can't allocate io_uring buffer");
+			goto err;
+		}
+	}
+
+	r->priv = u;
+	posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return 0;
+
+err:
+	for (int i = 0; i < READER_URING_DEPTH; i++)
+		free(u->chunk[i].buf);
+	uring_fini(&u->ring);
+	free(u);
+	return -1;
+}
+
+static int uring_map(struct reader *r, off_t off, size_t len)
+{
+	struct uring_reader *u = r->priv;
+	struct uring_chunk *c;
+	size_t copied = 0;
+
+	/* Out of sequence, restart reading from the new position */
+	if (!u->nr || off < u->chunk[u->head].off || off >= u->next_off) {
+		if (uring_drain(r))
+			return -1;
+		u->next_off = off;
+	}
+
+	/* Recycle chunks which are behind the window */
+	while (u->nr) {
+		c = &u->chunk[u->head];
+		if (c->off + (off_t)c->len > off)
+			break;
+		if (uring_reap(r, c))
+			return -1;
+		u->head = (u->head + 1) % READER_URING_DEPTH;
+		u->nr--;
+	}
+
+	if (uring_schedule(r))
+		return -1;
+
+	reader_drop_cache(r, off);
+
+	c = &u->chunk[u->head];
+	if (uring_reap(r, c))
+		return -1;
+
+	if (off + (off_t)len <= c->off + (off_t)c->len) {
+		r->win = c->buf + (off - c->off);
+		r->win_off = off;
+		r->win_len = c->off + c->len - off;
+		return 0;
+	}
+
+	if (len > r->buf_size[0]) {
+		char *buf = realloc(r->buf[0], len);
+		if (!buf) {
+			pr_perror("Can't allocate staging buffer");
+			return -1;
+		}
+		r->buf[0] = buf;
+		r->buf_size[0] = len;
+	}
+
+	for (unsigned int i = 0; i < u->nr && copied < len; i++) {
+		size_t from, n;
+
+		c = &u->chunk[(u->head + i) % READER_URING_DEPTH];
+		if (uring_reap(r, c))
+			return -1;
+
+		from = off + copied - c->off;
+		n = c->len - from;
+		if (n > len - copied)
+			n = len - copied;
+		memcpy(r->buf[0] + copied, c->buf + from, n);
+		copied += n;
+	}
+
+	/* The window is larger than all chunks in flight */
+	while (copied < len) {
+		ssize_t ret = pread(r->fd, r->buf[0] + copied,
+				    len - copied, off + copied);
+		if (ret <= 0) {
+			pr_perror("Can't read %s", r->path);
+			return -1;
+		}
+		copied += ret;
+	}
+
+	r->win = r->buf[0];
+	r->win_off = off;
+	r->win_len = len;
+	return 0;
+}
+
+static void uring_close(struct reader *r)
+{
+	struct uring_reader *u = r->priv;
+	bool drained = !uring_drain(r);
+
+	/*
+	 * The kernel may still be reading into the chunks if they
+	 * are not drained, these are left alone then.
+	 */
+	uring_fini(&u->ring);
+	for (int i = 0; i < READER_URING_DEPTH && drained; i++)
+		free(u->chunk[i].buf);
+	free(u);
+	free(r->buf[0]);
+}
+
+static const struct reader_ops reader_ops[READER_MAX] = {
+	[READER_MMAP] = {
+		.name	= "mmap",
+		.open	= mmap_open,
+		.map	= mmap_map,
+		.close	= mmap_close,
+	},
+	[READER_READ] = {
+		.name	= "read",
+		.open	= read_open,
+		.map	= read_map,
+		.close	= read_close,
+	},
+	[READER_WINDOW] = {
+		.name	= "window",
+		.open	= window_open,
+		.map	= window_map,
+		.close	= mmap_close,
+	},
+	[READER_URING] = {
+		.name	= "uring",
+		.open	= uring_open,
+		.map	= uring_map,
+		.close	= uring_close,
+	},
+};
+
+int reader_lookup(const char *name)
+{
+	for (int i = 0; i < READER_MAX; i++) {
+		if (!strcmp(reader_ops[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+int reader_open(struct reader *r, const char *path, int type, size_t bufsize)
+{
+	struct stat st;
+
+	memset(r, 0, sizeof(*r));
+
+	if (!page_size)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	r->ops = &reader_ops[type];
+	r->path = path;
+	r->bufsize = bufsize < READER_BUFSIZE_MIN ?
+		READER_BUFSIZE_MIN : bufsize;
+
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0) {
+		pr_perror("Can't open %s", path);
+		return -1;
+	}
+
+	if (fstat(r->fd, &st) < 0) {
+		pr_perror("Can't stat %s", path);
+		close(r->fd);
+		return -1;
+	}
+	r->size = st.st_size;
+
+	if (r->ops->open(r)) {
+		close(r->fd);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Pick up the file growth. The window is dropped since
+ * the data past the last block may be rewritten in place.
+ */
+int reader_update(struct reader *r)
+{
+	struct stat st;
+
+	if (fstat(r->fd, &st) < 0) {
+		pr_perror("Can't stat %s", r->path);
+		return -1;
+	}
+	r->size = st.st_size;
+	r->win_len = 0;
+	return 0;
+}
+
+void reader_close(struct reader *r)
+{
+	r->ops->close(r);
+	close(r->fd);
+}
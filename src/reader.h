@@ -0,0 +1,99 @@
+#ifndef READER_H__
+#define READER_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+enum {
+	READER_MMAP,
+	READER_READ,
+	READER_WINDOW,
+	READER_URING,
+
+	READER_MAX,
+};
+
+enum {
+	/** Default size of a read buffer or mmap window (8MiB) */
+	READER_BUFSIZE_DEF	= 8u << 20,
+	/** Minimal size of a read buffer or mmap window */
+	READER_BUFSIZE_MIN	= 64u << 10,
+	/** Number of reads kept in flight by io_uring reader */
+	READER_URING_DEPTH	= 4,
+};
+
+struct reader;
+
+struct reader_ops {
+	const char	*name;
+	int		(*open)(struct reader *r);
+	/*
+	 * Make [off, off + len) available in r->win, the
+	 * range is already clamped to the file size.
+	 */
+	int		(*map)(struct reader *r, off_t off, size_t len);
+	void		(*close)(struct reader *r);
+};
+
+/*
+ * Input file is consumed via a window which slides
+ * over the file. A pointer obtained from reader_peek()
+ * is valid until the next reader_peek() call only, so
+ * the memory footprint doesn't depend on the file size.
+ */
+struct reader {
+	const struct reader_ops	*ops;
+
+	const char		*path;
+	int			fd;
+	off_t			size;
+	size_t			bufsize;
+
+	const char		*win;
+	off_t			win_off;
+	size_t			win_len;
+
+	/* Backend specific data */
+	char			*buf[2];
+	size_t			buf_size[2];
+	int			buf_idx;
+	void			*map_addr;
+	size_t			map_len;
+	void			*priv;
+};
+
+extern int reader_lookup(const char *name);
+extern int reader_open(struct reader *r, const char *path,
+		       int type, size_t bufsize);
+extern int reader_update(struct reader *r);
+extern void reader_close(struct reader *r);
+
+/*
+ * Get a pointer to the file data at @off with at least @len
+ * bytes available unless end of file is reached. The number
+ * of available bytes is returned in @avail.
+ */
+static inline const char *reader_peek(struct reader *r, off_t off,
+				      size_t len, size_t *avail)
+{
+	if (off >= r->size) {
+		*avail = 0;
+		return NULL;
+	}
+
+	if ((off_t)len > r->size - off)
+		len = r->size - off;
+
+	if (off < r->win_off ||
+	    off + (off_t)len > r->win_off + (off_t)r->win_len) {
+		if (r->ops->map(r, off, len))
+			return NULL;
+	}
+
+	*avail = r->win_off + r->win_len - off;
+	return r->win + (off - r->win_off);
+}
+
+#endif /* READER_H__ */
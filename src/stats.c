@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "stats.h"
+#include "xlog.h"
+#include "log.h"
+
+#include "msgpuck/msgpuck.h"
+
+static __thread struct stats *thread_stats;
+static struct stats *stats_list;
+static struct stats *stats_total;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct stats *stats_new(void)
+{
+	struct stats *st = calloc(1, sizeof(*st));
+
+	if (!st) {
+		pr_perror("Can't allocate statistics");
+		return NULL;
+	}
+
+	id_hash_init(&st->spaces);
+	id_hash_init(&st->replicas);
+	id_hash_init(&st->rates);
+	return st;
+}
+
+static void stats_free(struct stats *st)
+{
+	struct id_hash *hashes[] = { &st->spaces, &st->replicas, &st->rates, };
+	struct id_hash_slot *s;
+
+	for (size_t i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+		id_hash_foreach(hashes[i], s)
+			free(s->val);
+		id_hash_fini(hashes[i]);
+	}
+	free(st);
+}
+
+/* Counters of the calling thread, NULL if out of memory */
+struct stats *stats_get(void)
+{
+	struct stats *st = thread_stats;
+
+	if (st)
+		return st;
+
+	st = stats_new();
+	if (!st)
+		return NULL;
+
+	pthread_mutex_lock(&stats_lock);
+	st->next = stats_list;
+	stats_list = st;
+	pthread_mutex_unlock(&stats_lock);
+
+	thread_stats = st;
+	return st;
+}
+
+static void *stats_slot(struct stats *st, struct id_hash *h, uint64_t id,
+			size_t size)
+{
+	void *val = id_hash_get(h, id);
+
+	if (val)
+		return val;
+
+	val = calloc(1, size);
+	if (!val || id_hash_put(h, id, val)) {
+		if (!val)
+			pr_perror("Can't allocate statistics");
+		free(val);
+		st->error = -1;
+		return NULL;
+	}
+	return val;
+}
+
+void stats_file(struct stats *st)
+{
+	st->files++;
+}
+
+void stats_block(struct stats *st, bool zstd, size_t len)
+{
+	st->blocks++;
+	if (zstd)
+		st->zblocks++;
+	st->disk_bytes += len;
+}
+
+/* Space of a DML body and the size of its tuple or key */
+static uint32_t body_space(const char *pos, size_t *tuple_size)
+{
+	uint32_t space = STATS_NO_SPACE, size;
+
+	*tuple_size = 0;
+	if (mp_typeof(*pos) != MP_MAP)
+		return space;
+
+	size = mp_decode_map(&pos);
+	for (uint32_t i = 0; i < size; i++) {
+		const char *val;
+		uint64_t key;
+
+		if (mp_typeof(*pos) != MP_UINT)
+			break;
+		key = mp_decode_uint(&pos);
+		val = pos;
+		mp_next(&pos);
+
+		if (key == IPROTO_SPACE_ID && mp_typeof(*val) == MP_UINT)
+			space = mp_decode_uint(&val);
+		else if (key == IPROTO_TUPLE || (key == IPROTO_KEY && !*tuple_size))
+			*tuple_size = pos - val;
+	}
+	return space;
+}
+
+static unsigned int size_bucket(size_t size)
+{
+	unsigned int i = size ? 63 - __builtin_clzll(size) : 0;
+
+	return i < STATS_SIZE_BUCKETS ? i : STATS_SIZE_BUCKETS - 1;
+}
+
+static void counters_add(struct stats_counters *c, const struct xrow_header *hdr,
+			 size_t size, size_t tuple_size)
+{
+	/* Files may go in any order */
+	if (!c->rows || hdr->lsn < c->min_lsn)
+		c->min_lsn = hdr->lsn;
+	if (!c->rows || hdr->lsn > c->max_lsn)
+		c->max_lsn = hdr->lsn;
+	/* Vinyl files have no timestamps */
+	if (hdr->tm > 0 && (!c->min_tm || hdr->tm < c->min_tm))
+		c->min_tm = hdr->tm;
+	if (hdr->tm > c->max_tm)
+		c->max_tm = hdr->tm;
+
+	c->rows++;
+	c->bytes += size;
+	if (hdr->type < IPROTO_TYPE_STAT_MAX)
+		c->nr_types[hdr->type]++;
+	else
+		c->nr_other++;
+
+	if (tuple_size) {
+		c->tuple_bytes += tuple_size;
+		c->tuple_sizes[size_bucket(tuple_size)]++;
+	}
+}
+
+/* Rows not @shown are counted in the raw size only */
+void stats_row(struct stats *st, const struct xrow_header *hdr,
+	       size_t size, bool shown)
+{
+	struct stats_counters *c;
+	struct stats_rate *rate;
+	size_t tuple_size = 0;
+	uint32_t space = STATS_NO_SPACE;
+
+	st->raw_bytes += size;
+	if (!shown)
+		return;
+
+	if (hdr->bodycnt)
+		space = body_space(hdr->body[0].iov_base, &tuple_size);
+
+	counters_add(&st->total, hdr, size, tuple_size);
+
+	c = stats_slot(st, &st->spaces, space, sizeof(*c));
+	if (c)
+		counters_add(c, hdr, size, tuple_size);
+	c = stats_slot(st, &st->replicas, hdr->replica_id, sizeof(*c));
+	if (c)
+		counters_add(c, hdr, size, tuple_size);
+
+	if (hdr->tm > 0) {
+		rate = stats_slot(st, &st->rates,
+				  (uint64_t)(hdr->tm / STATS_TIME_STEP),
+				  sizeof(*rate));
+		if (rate) {
+			rate->rows++;
+			rate->bytes += size;
+		}
+	}
+}
+
+static void counters_merge(struct stats_counters *dst,
+			   const struct stats_counters *src)
+{
+	if (!src->rows)
+		return;
+
+	if (!dst->rows || src->min_lsn < dst->min_lsn)
+		dst->min_lsn = src->min_lsn;
+	if (!dst->rows || src->max_lsn > dst->max_lsn)
+		dst->max_lsn = src->max_lsn;
+	if (src->min_tm > 0 && (!dst->min_tm || src->min_tm < dst->min_tm))
+		dst->min_tm = src->min_tm;
+	if (src->max_tm > dst->max_tm)
+		dst->max_tm = src->max_tm;
+
+	dst->rows += src->rows;
+	dst->bytes += src->bytes;
+	for (size_t i = 0; i < IPROTO_TYPE_STAT_MAX; i++)
+		dst->nr_types[i] += src->nr_types[i];
+	dst->nr_other += src->nr_other;
+	dst->tuple_bytes += src->tuple_bytes;
+	for (size_t i = 0; i < STATS_SIZE_BUCKETS; i++)
+		dst->tuple_sizes[i] += src->tuple_sizes[i];
+}
+
+static void counters_merge_hash(struct stats *dst, struct id_hash *h,
+				const struct id_hash *src)
+{
+	struct id_hash_slot *s;
+
+	id_hash_foreach(src, s) {
+		struct stats_counters *c = stats_slot(dst, h, s->id, sizeof(*c));
+
+		if (c)
+			counters_merge(c, s->val);
+	}
+}
+
+static void stats_merge(struct stats *dst, const struct stats *src)
+{
+	struct id_hash_slot *s;
+
+	dst->files += src->files;
+	dst->blocks += src->blocks;
+	dst->zblocks += src->zblocks;
+	dst->disk_bytes += src->disk_bytes;
+	dst->raw_bytes += src->raw_bytes;
+	counters_merge(&dst->total, &src->total);
+	counters_merge_hash(dst, &dst->spaces, &src->spaces);
+	counters_merge_hash(dst, &dst->replicas, &src->replicas);
+
+	id_hash_foreach(&src->rates, s) {
+		const struct stats_rate *r = s->val;
+		struct stats_rate *rate = stats_slot(dst, &dst->rates, s->id,
+						     sizeof(*rate));
+		if (rate) {
+			rate->rows += r->rows;
+			rate->bytes += r->bytes;
+		}
+	}
+
+	if (src->error)
+		dst->error = src->error;
+}
+
+/*
+ * Merge counters of all threads, these must be done
+ * with decoding by now. NULL if some were lost.
+ */
+struct stats *stats_collect(void)
+{
+	if (!stats_total) {
+		stats_total = stats_new();
+		if (!stats_total)
+			return NULL;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	for (struct stats *st = stats_list; st; st = st->next)
+		stats_merge(stats_total, st);
+	pthread_mutex_unlock(&stats_lock);
+
+	if (stats_total->error) {
+		pr_err("Statistics are incomplete, out of memory\n");
+		return NULL;
+	}
+	return stats_total;
+}
+
+void stats_fini(void)
+{
+	struct stats *st, *next;
+
+	pthread_mutex_lock(&stats_lock);
+	for (st = stats_list; st; st = next) {
+		next = st->next;
+		stats_free(st);
+	}
+	stats_list = NULL;
+	pthread_mutex_unlock(&stats_lock);
+
+	thread_stats = NULL;
+	if (stats_total)
+		stats_free(stats_total);
+	stats_total = NULL;
+}
+
+/* Upper bound of the tuple size bucket holding quantile @q */
+uint64_t stats_size_quantile(const struct stats_counters *c, double q)
+{
+	uint64_t nr = 0, sum = 0, want;
+
+	for (size_t i = 0; i < STATS_SIZE_BUCKETS; i++)
+		nr += c->tuple_sizes[i];
+	if (!nr)
+		return 0;
+
+	want = q * nr;
+	if (want < q * nr || !want)
+		want++;
+	for (size_t i = 0; i < STATS_SIZE_BUCKETS; i++) {
+		sum += c->tuple_sizes[i];
+		if (sum >= want)
+			return (2ull << i) - 1;
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef STATS_H__
+#define STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "hash.h"
+
+struct xrow_header;
+
+enum {
+	/** Tuple sizes are counted by powers of two */
+	STATS_SIZE_BUCKETS	= 32,
+	/** Write rate is counted per this many seconds */
+	STATS_TIME_STEP		= 60,
+	/** Rows without a space, like vylog records */
+	STATS_NO_SPACE		= UINT32_MAX,
+};
+
+struct stats_counters {
+	uint64_t	rows;
+	uint64_t	bytes;
+	uint64_t	nr_types[IPROTO_TYPE_STAT_MAX];
+	uint64_t	nr_other;
+	uint64_t	tuple_bytes;
+	uint64_t	tuple_sizes[STATS_SIZE_BUCKETS];
+	int64_t		min_lsn;
+	int64_t		max_lsn;
+	double		min_tm;
+	double		max_tm;
+};
+
+struct stats_rate {
+	uint64_t	rows;
+	uint64_t	bytes;
+};
+
+/*
+ * Aggregates of rows, every thread counts into its own
+ * copy, they are merged once everything is decoded.
+ */
+struct stats {
+	uint64_t		files;
+	uint64_t		blocks;
+	uint64_t		zblocks;
+	uint64_t		disk_bytes;
+	uint64_t		raw_bytes;
+	struct stats_counters	total;
+	/* Counters by space id and by replica id */
+	struct id_hash		spaces;
+	struct id_hash		replicas;
+	/* Rates by STATS_TIME_STEP intervals since the epoch */
+	struct id_hash		rates;
+	int			error;
+	struct stats		*next;
+};
+
+extern struct stats *stats_get(void);
+extern void stats_file(struct stats *st);
+extern void stats_block(struct stats *st, bool zstd, size_t len);
+extern void stats_row(struct stats *st, const struct xrow_header *hdr,
+		      size_t size, bool shown);
+
+extern struct stats *stats_collect(void);
+extern void stats_fini(void);
+
+extern uint64_t stats_size_quantile(const struct stats_counters *c, double q);
+
+#endif /* STATS_H__ */
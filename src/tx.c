@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tx.h"
+#include "xlog.h"
+#include "log.h"
+
+const char *xtx_status_strs[] = {
+	[XTX_COMMITTED]		= "committed",
+	[XTX_PARTIAL]		= "partial",
+	[XTX_UNFINISHED]	= "unfinished",
+};
+
+void xtx_start(struct xtx *tx, const struct xrow_header *hdr)
+{
+	memset(tx, 0, sizeof(*tx));
+	tx->out.fd = -1;
+	tx->replica_id = hdr->replica_id;
+	tx->tsn = hdr->tsn;
+	tx->first_lsn = hdr->lsn;
+	tx->first_tm = hdr->tm;
+	/* Rows before the first one seen are lost */
+	tx->continued = hdr->lsn != hdr->tsn;
+}
+
+void xtx_account(struct xtx *tx, const struct xrow_header *hdr, size_t size)
+{
+	tx->last_lsn = hdr->lsn;
+	tx->last_tm = hdr->tm;
+	tx->nr_rows++;
+	tx->size += size;
+	if (hdr->type < IPROTO_TYPE_STAT_MAX)
+		tx->nr_stmts[hdr->type]++;
+	else
+		tx->nr_other++;
+}
+
+/* Drop the output once it is emitted, the statistics stay */
+void xtx_cut(struct xtx_set *s, struct xtx *tx)
+{
+	s->mem -= tx->out.size;
+	obuf_fini(&tx->out);
+	tx->out.size = 0;
+	tx->out.len = 0;
+	tx->nr_shown = 0;
+	tx->continued = true;
+}
+
+void xtx_set_init(struct xtx_set *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+void xtx_set_fini(struct xtx_set *s)
+{
+	for (size_t i = 0; i < s->nr; i++) {
+		obuf_fini(&s->txs[i]->out);
+		free(s->txs[i]);
+	}
+	free(s->txs);
+	memset(s, 0, sizeof(*s));
+}
+
+struct xtx *xtx_find(struct xtx_set *s, const struct xrow_header *hdr)
+{
+	/* The latest one is the likely one */
+	for (size_t i = s->nr; i-- > 0;) {
+		struct xtx *tx = s->txs[i];
+
+		if (tx->tsn == hdr->tsn && tx->replica_id == hdr->replica_id)
+			return tx;
+	}
+	return NULL;
+}
+
+struct xtx *xtx_open(struct xtx_set *s, const struct xrow_header *hdr)
+{
+	struct xtx *tx;
+
+	if (s->nr == s->size) {
+		size_t size = s->size ? s->size * 2 : 16;
+		struct xtx **txs = realloc(s->txs, size * sizeof(txs[0]));
+
+		if (!txs) {
+			pr_perror("Can't allocate transactions");
+			return NULL;
+		}
+		s->txs = txs;
+		s->size = size;
+	}
+
+	tx = malloc(sizeof(*tx));
+	if (!tx) {
+		pr_perror("Can't allocate transaction");
+		return NULL;
+	}
+
+	xtx_start(tx, hdr);
+	s->txs[s->nr++] = tx;
+	return tx;
+}
+
+void xtx_close(struct xtx_set *s, struct xtx *tx)
+{
+	for (size_t i = 0; i < s->nr; i++) {
+		if (s->txs[i] != tx)
+			continue;
+
+		memmove(&s->txs[i], &s->txs[i + 1],
+			(s->nr - i - 1) * sizeof(s->txs[0]));
+		s->nr--;
+		break;
+	}
+
+	s->mem -= tx->out.size;
+	obuf_fini(&tx->out);
+	free(tx);
+}
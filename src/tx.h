@@ -0,0 +1,74 @@
+#ifndef TX_H__
+#define TX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "obuf.h"
+
+struct xrow_header;
+
+enum {
+	/** Output of open transactions kept before it is cut */
+	XTX_MEM_MAX		= 64u << 20,
+};
+
+enum {
+	/** The commit row has been seen */
+	XTX_COMMITTED,
+	/** Cut to bound memory, the rest follows */
+	XTX_PARTIAL,
+	/** No commit row till the end of the file */
+	XTX_UNFINISHED,
+};
+
+extern const char *xtx_status_strs[];
+
+/*
+ * A transaction being assembled. The statistics cover
+ * all its rows, the output keeps formatted rows passing
+ * the filter only.
+ */
+struct xtx {
+	uint32_t	replica_id;
+	int64_t		tsn;
+	int64_t		first_lsn;
+	int64_t		last_lsn;
+	double		first_tm;
+	double		last_tm;
+	uint64_t	nr_rows;
+	uint64_t	size;
+	uint64_t	nr_stmts[IPROTO_TYPE_STAT_MAX];
+	uint64_t	nr_other;
+	/** The output doesn't start with the first row */
+	bool		continued;
+	int		status;
+	uint64_t	nr_shown;
+	struct obuf	out;
+};
+
+/*
+ * Open transactions in the order they are started. Only
+ * a few are interleaved at a time so they are looked up
+ * linearly, the oldest goes first when memory is short.
+ */
+struct xtx_set {
+	struct xtx	**txs;
+	size_t		nr;
+	size_t		size;
+	size_t		mem;
+};
+
+extern void xtx_start(struct xtx *tx, const struct xrow_header *hdr);
+extern void xtx_account(struct xtx *tx, const struct xrow_header *hdr, size_t size);
+extern void xtx_cut(struct xtx_set *s, struct xtx *tx);
+
+extern void xtx_set_init(struct xtx_set *s);
+extern void xtx_set_fini(struct xtx_set *s);
+extern struct xtx *xtx_find(struct xtx_set *s, const struct xrow_header *hdr);
+extern struct xtx *xtx_open(struct xtx_set *s, const struct xrow_header *hdr);
+extern void xtx_close(struct xtx_set *s, struct xtx *tx);
+
+#endif /* TX_H__ */
@@ -0,0 +1,483 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "update.h"
+#include "log.h"
+
+#include "msgpuck/msgpuck.h"
+
+void update_create(struct update *u)
+{
+	memset(u, 0, sizeof(*u));
+	u->scratch.fd = -1;
+}
+
+void update_destroy(struct update *u)
+{
+	free(u->ops);
+	free(u->fields);
+	obuf_fini(&u->scratch);
+	update_create(u);
+}
+
+static int decode_int(const char **pos, int64_t *val)
+{
+	uint64_t v;
+
+	switch (mp_typeof(**pos)) {
+	case MP_UINT:
+		v = mp_decode_uint(pos);
+		if (v > INT64_MAX)
+			return -1;
+		*val = v;
+		return 0;
+	case MP_INT:
+		*val = mp_decode_int(pos);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* An operation of a valid IPROTO_OPS array, -1 if it makes no sense */
+int update_op_decode(struct update_op *op, const char **pos)
+{
+	uint32_t size, len;
+	const char *str;
+
+	if (mp_typeof(**pos) != MP_ARRAY)
+		return -1;
+	size = mp_decode_array(pos);
+	if (size < 2 || mp_typeof(**pos) != MP_STR)
+		return -1;
+	str = mp_decode_str(pos, &len);
+	if (len != 1 || decode_int(pos, &op->field))
+		return -1;
+
+	op->opcode = str[0];
+	switch (op->opcode) {
+	case '=': case '!':
+	case '+': case '-':
+	case '&': case '|': case '^':
+		if (size != 3)
+			return -1;
+		op->arg = *pos;
+		mp_next(pos);
+		op->arg_len = *pos - op->arg;
+		return 0;
+	case '#':
+		if (size != 3 || decode_int(pos, &op->a) || op->a <= 0)
+			return -1;
+		return 0;
+	case ':':
+		if (size != 5 || decode_int(pos, &op->a) ||
+		    decode_int(pos, &op->b) || mp_typeof(**pos) != MP_STR)
+			return -1;
+		op->arg = mp_decode_str(pos, &op->arg_len);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* Whether a valid msgpack value is an array of operations */
+bool update_ops_valid(const char *pos)
+{
+	struct update_op op;
+	uint32_t nr;
+
+	if (mp_typeof(*pos) != MP_ARRAY)
+		return false;
+	nr = mp_decode_array(&pos);
+	for (uint32_t i = 0; i < nr; i++) {
+		if (update_op_decode(&op, &pos))
+			return false;
+	}
+	return true;
+}
+
+/* Operations of a valid IPROTO_OPS array, -1 if they make no sense */
+int update_decode(struct update *u, const char *pos, int index_base)
+{
+	uint32_t nr;
+
+	if (!u->ops) {
+		u->ops = malloc(UPDATE_OPS_MAX * sizeof(u->ops[0]));
+		if (!u->ops) {
+			pr_perror("Can't allocate update operations");
+			return -1;
+		}
+	}
+
+	u->nr_ops = 0;
+	u->index_base = index_base;
+	if (mp_typeof(*pos) != MP_ARRAY)
+		return -1;
+	nr = mp_decode_array(&pos);
+	if (nr > UPDATE_OPS_MAX)
+		return -1;
+
+	for (uint32_t i = 0; i < nr; i++) {
+		if (update_op_decode(&u->ops[i], &pos))
+			return -1;
+	}
+
+	u->nr_ops = nr;
+	return 0;
+}
+
+static int fields_reserve(struct update *u, uint32_t nr)
+{
+	struct update_field *fields;
+	uint32_t size;
+
+	if (nr <= u->size)
+		return 0;
+
+	size = u->size ? u->size : 16;
+	while (size < nr)
+		size *= 2;
+	fields = realloc(u->fields, size * sizeof(fields[0]));
+	if (!fields) {
+		pr_perror("Can't allocate tuple fields");
+		return -1;
+	}
+	u->fields = fields;
+	u->size = size;
+	return 0;
+}
+
+/* Fields are taken off the tail only as far as operations reach */
+static int split_fields(struct update *u, uint32_t nr)
+{
+	if (nr <= u->nr_fields)
+		return 0;
+	if (fields_reserve(u, nr))
+		return -1;
+
+	while (u->nr_fields < nr) {
+		struct update_field *f = &u->fields[u->nr_fields++];
+
+		f->data = u->tail;
+		mp_next(&u->tail);
+		f->len = u->tail - f->data;
+		u->tail_count--;
+	}
+	return 0;
+}
+
+static inline const char *field_data(const struct update *u,
+				     const struct update_field *f)
+{
+	return f->data ? f->data : u->scratch.buf + f->off;
+}
+
+/*
+ * Zero based field of an operation. Negative numbers count
+ * from the end, @count is the number of fields there may be
+ * at the resulting position.
+ */
+static int op_field(const struct update *u, const struct update_op *op,
+		    uint32_t count, uint32_t *fieldno)
+{
+	int64_t f = op->field;
+
+	if (f >= 0) {
+		if (f < u->index_base)
+			return -1;
+		f -= u->index_base;
+	} else
+		f += count;
+
+	if (f < 0 || f >= count)
+		return -1;
+	*fieldno = f;
+	return 0;
+}
+
+static int insert_field(struct update *u, uint32_t fieldno,
+			const char *data, uint32_t len)
+{
+	struct update_field *f;
+
+	if (fields_reserve(u, u->nr_fields + 1))
+		return -1;
+
+	f = &u->fields[fieldno];
+	memmove(f + 1, f, (u->nr_fields - fieldno) * sizeof(*f));
+	f->data = data;
+	f->len = len;
+	u->nr_fields++;
+	return 0;
+}
+
+/* Put a new value of a field into the scratch buffer */
+static char *field_reserve(struct update *u, struct update_field *f,
+			   uint32_t len)
+{
+	char *p = obuf_reserve(&u->scratch, len);
+
+	if (!p)
+		return NULL;
+	f->data = NULL;
+	f->off = u->scratch.len;
+	return p;
+}
+
+static void field_commit(struct update *u, struct update_field *f,
+			 const char *end)
+{
+	f->len = end - (u->scratch.buf + f->off);
+	u->scratch.len += f->len;
+}
+
+enum {
+	NUMBER_INT,
+	NUMBER_FLOAT,
+	NUMBER_DOUBLE,
+};
+
+struct number {
+	int		type;
+	__int128	i;
+	double		d;
+};
+
+static int number_decode(const char *pos, struct number *n)
+{
+	switch (mp_typeof(*pos)) {
+	case MP_UINT:
+		n->type = NUMBER_INT;
+		n->i = mp_decode_uint(&pos);
+		n->d = n->i;
+		return 0;
+	case MP_INT:
+		n->type = NUMBER_INT;
+		n->i = mp_decode_int(&pos);
+		n->d = n->i;
+		return 0;
+	case MP_FLOAT:
+		n->type = NUMBER_FLOAT;
+		n->d = mp_decode_float(&pos);
+		return 0;
+	case MP_DOUBLE:
+		n->type = NUMBER_DOUBLE;
+		n->d = mp_decode_double(&pos);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* Integers must stay in range, mixed ones are of the widest type */
+static int do_arith(struct update *u, struct update_field *f,
+		    const struct update_op *op)
+{
+	struct number a, b;
+	char *p, *end;
+
+	if (number_decode(field_data(u, f), &a) ||
+	    number_decode(op->arg, &b))
+		return -1;
+
+	if (a.type == NUMBER_INT && b.type == NUMBER_INT) {
+		__int128 r = op->opcode == '+' ? a.i + b.i : a.i - b.i;
+
+		if (r < INT64_MIN || r > (__int128)UINT64_MAX)
+			return -1;
+		p = field_reserve(u, f, 9);
+		if (!p)
+			return -1;
+		end = r >= 0 ? mp_encode_uint(p, r) : mp_encode_int(p, r);
+	} else {
+		double r = op->opcode == '+' ? a.d + b.d : a.d - b.d;
+
+		p = field_reserve(u, f, 9);
+		if (!p)
+			return -1;
+		if (a.type == NUMBER_DOUBLE || b.type == NUMBER_DOUBLE)
+			end = mp_encode_double(p, r);
+		else
+			end = mp_encode_float(p, r);
+	}
+
+	field_commit(u, f, end);
+	return 0;
+}
+
+static int do_bit(struct update *u, struct update_field *f,
+		  const struct update_op *op)
+{
+	const char *pos = field_data(u, f), *arg = op->arg;
+	uint64_t a, b;
+	char *p;
+
+	if (mp_typeof(*pos) != MP_UINT || mp_typeof(*arg) != MP_UINT)
+		return -1;
+	a = mp_decode_uint(&pos);
+	b = mp_decode_uint(&arg);
+
+	switch (op->opcode) {
+	case '&':
+		a &= b;
+		break;
+	case '|':
+		a |= b;
+		break;
+	default:
+		a ^= b;
+		break;
+	}
+
+	p = field_reserve(u, f, 9);
+	if (!p)
+		return -1;
+	field_commit(u, f, mp_encode_uint(p, a));
+	return 0;
+}
+
+/* Offset and cut are cropped to the string the way tarantool does */
+static int do_splice(struct update *u, struct update_field *f,
+		     const struct update_op *op)
+{
+	const char *pos = field_data(u, f), *str;
+	int64_t offset = op->a, cut = op->b;
+	uint32_t len, tail;
+	size_t str_off;
+	bool scratch;
+	char *p;
+
+	if (mp_typeof(*pos) != MP_STR)
+		return -1;
+	str = mp_decode_str(&pos, &len);
+
+	if (offset < 0) {
+		if (-offset > (int64_t)len + 1)
+			return -1;
+		offset += len + 1;
+	} else if (offset >= u->index_base) {
+		offset -= u->index_base;
+		if (offset > len)
+			offset = len;
+	} else
+		return -1;
+
+	if (cut < 0)
+		cut = -cut > len - offset ? 0 : cut + (len - offset);
+	else if (cut > len - offset)
+		cut = len - offset;
+	tail = offset + cut;
+
+	/* The string may be in the scratch buffer which moves */
+	scratch = !f->data;
+	str_off = scratch ? str - u->scratch.buf : 0;
+	p = field_reserve(u, f, 5 + len - cut + op->arg_len);
+	if (!p)
+		return -1;
+	if (scratch)
+		str = u->scratch.buf + str_off;
+
+	p = mp_encode_strl(p, offset + op->arg_len + len - tail);
+	memcpy(p, str, offset);
+	memcpy(p + offset, op->arg, op->arg_len);
+	memcpy(p + offset + op->arg_len, str + tail, len - tail);
+	field_commit(u, f, p + offset + op->arg_len + len - tail);
+	return 0;
+}
+
+static int do_op(struct update *u, const struct update_op *op)
+{
+	uint32_t fieldno, count = u->nr_fields + u->tail_count;
+	struct update_field *f;
+
+	switch (op->opcode) {
+	case '=':
+		/* Set of the field next to the last one appends */
+		if (op->field >= u->index_base &&
+		    op->field - u->index_base == count) {
+			if (split_fields(u, count))
+				return -1;
+			return insert_field(u, count, op->arg, op->arg_len);
+		}
+		if (op_field(u, op, count, &fieldno) ||
+		    split_fields(u, fieldno + 1))
+			return -1;
+		f = &u->fields[fieldno];
+		f->data = op->arg;
+		f->len = op->arg_len;
+		return 0;
+	case '!':
+		if (op_field(u, op, count + 1, &fieldno) ||
+		    split_fields(u, fieldno))
+			return -1;
+		return insert_field(u, fieldno, op->arg, op->arg_len);
+	case '#':
+		if (op_field(u, op, count, &fieldno))
+			return -1;
+		count = op->a < count - fieldno ? op->a : count - fieldno;
+		if (split_fields(u, fieldno + count))
+			return -1;
+		f = &u->fields[fieldno];
+		memmove(f, f + count,
+			(u->nr_fields - fieldno - count) * sizeof(*f));
+		u->nr_fields -= count;
+		return 0;
+	}
+
+	if (op_field(u, op, count, &fieldno) || split_fields(u, fieldno + 1))
+		return -1;
+	f = &u->fields[fieldno];
+
+	switch (op->opcode) {
+	case '+':
+	case '-':
+		return do_arith(u, f, op);
+	case ':':
+		return do_splice(u, f, op);
+	default:
+		return do_bit(u, f, op);
+	}
+}
+
+/*
+ * Apply decoded operations to a valid tuple of @size bytes.
+ * Upsert skips the operations failing instead of failing as
+ * a whole. The size of the result is in u->len, it is put
+ * by update_write() then.
+ */
+int update_apply(struct update *u, const char *tuple, uint32_t size,
+		 bool upsert)
+{
+	const char *pos = tuple;
+
+	if (mp_typeof(*pos) != MP_ARRAY)
+		return -1;
+	u->tail_count = mp_decode_array(&pos);
+	u->tail = pos;
+	u->tail_end = tuple + size;
+	u->nr_fields = 0;
+	u->scratch.len = 0;
+
+	for (uint32_t i = 0; i < u->nr_ops; i++) {
+		if (do_op(u, &u->ops[i]) && !upsert)
+			return -1;
+	}
+
+	u->len = mp_sizeof_array(u->nr_fields + u->tail_count) +
+		 (u->tail_end - u->tail);
+	for (uint32_t i = 0; i < u->nr_fields; i++)
+		u->len += u->fields[i].len;
+	return 0;
+}
+
+/* The tuple updated, u->len bytes at @p */
+char *update_write(const struct update *u, char *p)
+{
+	p = mp_encode_array(p, u->nr_fields + u->tail_count);
+	for (uint32_t i = 0; i < u->nr_fields; i++) {
+		memcpy(p, field_data(u, &u->fields[i]), u->fields[i].len);
+		p += u->fields[i].len;
+	}
+	memcpy(p, u->tail, u->tail_end - u->tail);
+	return p + (u->tail_end - u->tail);
+}
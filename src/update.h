@@ -0,0 +1,75 @@
+#ifndef UPDATE_H__
+#define UPDATE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "obuf.h"
+
+enum {
+	/** Operations of a request, same limit as tarantool has */
+	UPDATE_OPS_MAX		= 4000,
+};
+
+/* One operation of IPROTO_OPS: [opcode, field, args...] */
+struct update_op {
+	char		opcode;
+	/** As given, with the index base */
+	int64_t		field;
+	/** Fields to delete by '#', offset and cut of ':' */
+	int64_t		a;
+	int64_t		b;
+	/** Operand in msgpack, the string to paste for ':' */
+	const char	*arg;
+	uint32_t	arg_len;
+};
+
+/* A field of the tuple being updated */
+struct update_field {
+	/** NULL if the data is in the scratch buffer */
+	const char	*data;
+	uint32_t	off;
+	uint32_t	len;
+};
+
+/*
+ * Update state, kept between requests to reuse memory.
+ * Fields are split off the tuple up to the last one an
+ * operation changes, the rest is the tail copied as is.
+ * New values are put into the scratch buffer, fields
+ * refer to it by offsets as it may move.
+ */
+struct update {
+	struct update_op	*ops;
+	uint32_t		nr_ops;
+	int			index_base;
+	struct update_field	*fields;
+	uint32_t		nr_fields;
+	uint32_t		size;
+	const char		*tail;
+	const char		*tail_end;
+	uint32_t		tail_count;
+	/** Size of the tuple updated */
+	size_t			len;
+	struct obuf		scratch;
+};
+
+/* Body key holding operations, updates put them in place of the tuple */
+static inline bool update_ops_key(uint32_t type, uint64_t key)
+{
+	if (type == IPROTO_UPDATE)
+		return key == IPROTO_TUPLE || key == IPROTO_OPS;
+	return type == IPROTO_UPSERT && key == IPROTO_OPS;
+}
+
+extern void update_create(struct update *u);
+extern void update_destroy(struct update *u);
+extern int update_op_decode(struct update_op *op, const char **pos);
+extern bool update_ops_valid(const char *pos);
+extern int update_decode(struct update *u, const char *ops, int index_base);
+extern int update_apply(struct update *u, const char *tuple, uint32_t size,
+			bool upsert);
+extern char *update_write(const struct update *u, char *p);
+
+#endif /* UPDATE_H__ */
@@ -0,0 +1,139 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "log.h"
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+			      unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit,
+		       min_complete, flags, NULL, 0);
+}
+
+int uring_init(struct uring *u, unsigned int entries)
+{
+	struct io_uring_params p;
+	int ret;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+
+	u->fd = sys_io_uring_setup(entries, &p);
+	if (u->fd < 0)
+		return -errno;
+
+	u->entries = p.sq_entries;
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED ||
+	    u->sqes == MAP_FAILED) {
+		ret = -errno;
+		if (u->sq_ring != MAP_FAILED)
+			munmap(u->sq_ring, u->sq_ring_size);
+		if (u->cq_ring != MAP_FAILED)
+			munmap(u->cq_ring, u->cq_ring_size);
+		if (u->sqes != MAP_FAILED)
+			munmap(u->sqes, u->sqes_size);
+		close(u->fd);
+		return ret;
+	}
+
+	u->sq_head	= u->sq_ring + p.sq_off.head;
+	u->sq_tail	= u->sq_ring + p.sq_off.tail;
+	u->sq_mask	= u->sq_ring + p.sq_off.ring_mask;
+	u->sq_array	= u->sq_ring + p.sq_off.array;
+
+	u->cq_head	= u->cq_ring + p.cq_off.head;
+	u->cq_tail	= u->cq_ring + p.cq_off.tail;
+	u->cq_mask	= u->cq_ring + p.cq_off.ring_mask;
+	u->cqes		= u->cq_ring + p.cq_off.cqes;
+	return 0;
+}
+
+void uring_fini(struct uring *u)
+{
+	munmap(u->sqes, u->sqes_size);
+	munmap(u->cq_ring, u->cq_ring_size);
+	munmap(u->sq_ring, u->sq_ring_size);
+	close(u->fd);
+}
+
+int uring_prep_read(struct uring *u, int fd, void *buf,
+		    unsigned int len, off_t off, uint64_t data)
+{
+	unsigned int tail = *u->sq_tail;
+	unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+
+	if (tail - head >= u->entries)
+		return -EBUSY;
+
+	sqe = &u->sqes[tail & *u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode	= IORING_OP_READ;
+	sqe->fd		= fd;
+	sqe->addr	= (unsigned long)buf;
+	sqe->len	= len;
+	sqe->off	= off;
+	sqe->user_data	= data;
+
+	u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->pending++;
+	return 0;
+}
+
+int uring_submit(struct uring *u)
+{
+	while (u->pending) {
+		int ret = sys_io_uring_enter(u->fd, u->pending, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		u->pending -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Wait for a single completion, the result of
+ * the request is returned in @res.
+ */
+int uring_wait(struct uring *u, uint64_t *data, int *res)
+{
+	unsigned int head = *u->cq_head;
+	struct io_uring_cqe *cqe;
+
+	while (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		int ret = sys_io_uring_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR)
+			return -errno;
+	}
+
+	cqe = &u->cqes[head & *u->cq_mask];
+	*data = cqe->user_data;
+	*res = cqe->res;
+
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
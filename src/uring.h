@@ -0,0 +1,45 @@
+#ifndef URING_H__
+#define URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include <linux/io_uring.h>
+
+/*
+ * A minimal io_uring wrapper on top of raw syscalls,
+ * we only need plain reads so liburing is not required.
+ */
+struct uring {
+	int			fd;
+	unsigned int		entries;
+	unsigned int		pending;
+
+	unsigned int		*sq_head;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	struct io_uring_sqe	*sqes;
+
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ring;
+	size_t			sq_ring_size;
+	void			*cq_ring;
+	size_t			cq_ring_size;
+	size_t			sqes_size;
+};
+
+extern int uring_init(struct uring *u, unsigned int entries);
+extern void uring_fini(struct uring *u);
+extern int uring_prep_read(struct uring *u, int fd, void *buf,
+			   unsigned int len, off_t off, uint64_t data);
+extern int uring_submit(struct uring *u);
+extern int uring_wait(struct uring *u, uint64_t *data, int *res);
+
+#endif /* URING_H__ */
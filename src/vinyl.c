@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "constants.h"
+#include "vinyl.h"
+#include "xlog.h"
+#include "log.h"
+
+int vy_page_info_decode(struct vy_page_info *page,
+			const char *pos, const char *end)
+{
+	uint32_t size;
+
+	memset(page, 0, sizeof(*page));
+
+	if (mp_typeof(*pos) != MP_MAP)
+		goto error;
+
+	size = mp_decode_map(&pos);
+	for (uint32_t i = 0; i < size; i++) {
+		uint64_t *val;
+
+		if (mp_typeof(*pos) != MP_UINT)
+			goto error;
+
+		switch (mp_decode_uint(&pos)) {
+		case VY_PAGE_INFO_OFFSET:
+			val = &page->offset;
+			break;
+		case VY_PAGE_INFO_SIZE:
+			val = &page->size;
+			break;
+		case VY_PAGE_INFO_UNPACKED_SIZE:
+			val = &page->unpacked_size;
+			break;
+		case VY_PAGE_INFO_ROW_COUNT:
+			val = &page->row_count;
+			break;
+		case VY_PAGE_INFO_ROW_INDEX_OFFSET:
+			val = &page->row_index_offset;
+			break;
+		default:
+			/* Min key and unknown ones */
+			mp_next(&pos);
+			continue;
+		}
+
+		if (mp_typeof(*pos) != MP_UINT)
+			goto error;
+		*val = mp_decode_uint(&pos);
+	}
+
+	if (pos > end)
+		goto error;
+	return 0;
+
+error:
+	pr_err("Broken page info\n");
+	return -1;
+}
+
+static int vy_run_pages_add(const struct xrow_header *hdr, void *arg)
+{
+	struct vy_run_pages *rp = arg;
+	const char *pos, *end;
+
+	if (!hdr->bodycnt) {
+		pr_err("No body in a row of type %u\n", hdr->type);
+		return -1;
+	}
+
+	pos = hdr->body[0].iov_base;
+	end = pos + hdr->body[0].iov_len;
+
+	if (hdr->type == VY_INDEX_RUN_INFO) {
+		uint32_t size;
+
+		if (mp_typeof(*pos) != MP_MAP)
+			goto error;
+
+		size = mp_decode_map(&pos);
+		for (uint32_t i = 0; i < size; i++) {
+			if (mp_typeof(*pos) != MP_UINT)
+				goto error;
+
+			if (mp_decode_uint(&pos) == VY_RUN_INFO_PAGE_COUNT &&
+			    mp_typeof(*pos) == MP_UINT)
+				rp->page_count = mp_decode_uint(&pos);
+			else
+				mp_next(&pos);
+		}
+		return 0;
+	} else if (hdr->type != VY_INDEX_PAGE_INFO) {
+		pr_err("Unexpected row of type %u in index\n", hdr->type);
+		return -1;
+	}
+
+	if (rp->nr == rp->size) {
+		size_t size = rp->size ? rp->size * 2 : 64;
+		struct vy_page_info *pages;
+
+		pages = realloc(rp->pages, size * sizeof(pages[0]));
+		if (!pages) {
+			pr_perror("Can't allocate page info");
+			return -1;
+		}
+		rp->pages = pages;
+		rp->size = size;
+	}
+
+	return vy_page_info_decode(&rp->pages[rp->nr++], pos, end);
+
+error:
+	pr_err("Broken run info\n");
+	return -1;
+}
+
+/*
+ * Load page descriptions from the .index next to a
+ * .run file. Returns 1 if there is no index at all.
+ */
+int vy_run_pages_load(struct vy_run_pages *rp, const char *run_path)
+{
+	size_t len = strlen(run_path);
+	char *path;
+	int ret = 1;
+
+	memset(rp, 0, sizeof(*rp));
+
+	if (len < 4 || strcmp(run_path + len - 4, ".run"))
+		return 1;
+
+	if (asprintf(&path, "%.*s.index", (int)(len - 4), run_path) < 0) {
+		pr_perror("Can't allocate index path");
+		return -1;
+	}
+
+	if (access(path, R_OK)) {
+		if (errno != ENOENT) {
+			pr_perror("Can't access %s", path);
+			ret = -1;
+		}
+		goto out;
+	}
+
+	ret = -1;
+	if (xlog_scan(path, WAL_TYPE_VY_INDEX, vy_run_pages_add, rp))
+		goto out;
+
+	if (rp->nr != rp->page_count) {
+		pr_err("%s: %zu pages while run info tells %llu\n",
+		       path, rp->nr, (unsigned long long)rp->page_count);
+		goto out;
+	}
+
+	for (size_t i = 1; i < rp->nr; i++) {
+		const struct vy_page_info *prev = &rp->pages[i - 1];
+
+		if (rp->pages[i].offset < prev->offset + prev->size) {
+			pr_err("%s: page %zu at %llu overlaps the previous one\n",
+			       path, i, (unsigned long long)rp->pages[i].offset);
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	if (ret)
+		vy_run_pages_fini(rp);
+	free(path);
+	return ret;
+}
+
+void vy_run_pages_fini(struct vy_run_pages *rp)
+{
+	free(rp->pages);
+	memset(rp, 0, sizeof(*rp));
+}
@@ -0,0 +1,39 @@
+#ifndef VINYL_H__
+#define VINYL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "load.h"
+
+#include "msgpuck/msgpuck.h"
+
+/* A page of a .run file as described by the .index */
+struct vy_page_info {
+	uint64_t	offset;
+	uint64_t	size;
+	uint64_t	unpacked_size;
+	uint64_t	row_count;
+	uint64_t	row_index_offset;
+};
+
+/* Pages of a run in the file order */
+struct vy_run_pages {
+	struct vy_page_info	*pages;
+	size_t			nr;
+	size_t			size;
+	uint64_t		page_count;
+};
+
+extern int vy_page_info_decode(struct vy_page_info *page,
+			       const char *pos, const char *end);
+extern int vy_run_pages_load(struct vy_run_pages *rp, const char *run_path);
+extern void vy_run_pages_fini(struct vy_run_pages *rp);
+
+/* Offset of row @i of a page, the row index is big endian */
+static inline uint32_t vy_row_index_get(const char *data, uint32_t i)
+{
+	return mp_bswap_u32(load_u32(data + i * sizeof(uint32_t)));
+}
+
+#endif /* VINYL_H__ */
@@ -0,0 +1,498 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "constants.h"
+#include "vylog.h"
+#include "log.h"
+
+#include "msgpuck/msgpuck.h"
+
+/*
+ * Records are stored as IPROTO_INSERT with a tuple
+ * [type, {key: value}] for body, returns the map.
+ */
+const char *vy_log_record_fields(const char *body, uint32_t *type)
+{
+	uint32_t size;
+
+	if (mp_typeof(*body) != MP_MAP)
+		return NULL;
+
+	size = mp_decode_map(&body);
+	for (uint32_t i = 0; i < size; i++) {
+		if (mp_typeof(*body) != MP_UINT ||
+		    mp_decode_uint(&body) != IPROTO_TUPLE) {
+			mp_next(&body);
+			continue;
+		}
+
+		if (mp_typeof(*body) != MP_ARRAY || mp_decode_array(&body) != 2 ||
+		    mp_typeof(*body) != MP_UINT)
+			return NULL;
+		*type = mp_decode_uint(&body);
+		return mp_typeof(*body) == MP_MAP ? body : NULL;
+	}
+	return NULL;
+}
+
+int vy_log_record_decode(struct vy_log_record *rec, const char *body)
+{
+	const char *pos;
+	uint32_t size;
+
+	memset(rec, 0, sizeof(*rec));
+
+	pos = vy_log_record_fields(body, &rec->type);
+	if (!pos || rec->type >= vy_log_record_type_MAX)
+		goto error;
+
+	size = mp_decode_map(&pos);
+	for (uint32_t i = 0; i < size; i++) {
+		uint64_t key;
+		int64_t *val;
+		uint32_t v;
+
+		if (mp_typeof(*pos) != MP_UINT)
+			goto error;
+		key = mp_decode_uint(&pos);
+
+		switch (key) {
+		case VY_LOG_KEY_BEGIN:
+			rec->begin = pos;
+			mp_next(&pos);
+			continue;
+		case VY_LOG_KEY_END:
+			rec->end = pos;
+			mp_next(&pos);
+			continue;
+		case VY_LOG_KEY_DEF:
+			rec->key_def = pos;
+			mp_next(&pos);
+			continue;
+		case VY_LOG_KEY_LSM_ID:		val = &rec->lsm_id;	break;
+		case VY_LOG_KEY_RANGE_ID:	val = &rec->range_id;	break;
+		case VY_LOG_KEY_RUN_ID:		val = &rec->run_id;	break;
+		case VY_LOG_KEY_SLICE_ID:	val = &rec->slice_id;	break;
+		case VY_LOG_KEY_DUMP_LSN:	val = &rec->dump_lsn;	break;
+		case VY_LOG_KEY_GC_LSN:		val = &rec->gc_lsn;	break;
+		case VY_LOG_KEY_CREATE_LSN:	val = &rec->create_lsn;	break;
+		case VY_LOG_KEY_MODIFY_LSN:	val = &rec->modify_lsn;	break;
+		case VY_LOG_KEY_DROP_LSN:	val = &rec->drop_lsn;	break;
+		case VY_LOG_KEY_INDEX_ID:
+		case VY_LOG_KEY_SPACE_ID:
+		case VY_LOG_KEY_GROUP_ID:
+		case VY_LOG_KEY_DUMP_COUNT:
+			if (mp_typeof(*pos) != MP_UINT)
+				goto error;
+			v = mp_decode_uint(&pos);
+			if (key == VY_LOG_KEY_INDEX_ID)
+				rec->index_id = v;
+			else if (key == VY_LOG_KEY_SPACE_ID)
+				rec->space_id = v;
+			else if (key == VY_LOG_KEY_GROUP_ID)
+				rec->group_id = v;
+			else
+				rec->dump_count = v;
+			continue;
+		default:
+			/* Legacy truncate count and unknown keys */
+			mp_next(&pos);
+			continue;
+		}
+
+		if (mp_typeof(*pos) == MP_UINT)
+			*val = mp_decode_uint(&pos);
+		else if (mp_typeof(*pos) == MP_INT)
+			*val = mp_decode_int(&pos);
+		else
+			goto error;
+	}
+	return 0;
+
+error:
+	pr_err("Broken vylog record\n");
+	return -1;
+}
+
+/* Copy of a MsgPack value, records don't outlive the block */
+static char *mp_dup(const char *data)
+{
+	const char *end = data;
+	char *copy;
+
+	if (!data)
+		return NULL;
+
+	mp_next(&end);
+	copy = malloc(end - data);
+	if (copy)
+		memcpy(copy, data, end - data);
+	return copy;
+}
+
+void vy_recovery_init(struct vy_recovery *r)
+{
+	memset(r, 0, sizeof(*r));
+	id_hash_init(&r->lsms);
+	id_hash_init(&r->ranges);
+	id_hash_init(&r->runs);
+	id_hash_init(&r->slices);
+}
+
+static void lsm_free(struct vy_lsm_recovery_info *lsm)
+{
+	free(lsm->key_def);
+	free(lsm);
+}
+
+static void range_free(struct vy_range_recovery_info *range)
+{
+	free(range->begin);
+	free(range->end);
+	free(range);
+}
+
+static void slice_free(struct vy_slice_recovery_info *slice)
+{
+	free(slice->begin);
+	free(slice->end);
+	free(slice);
+}
+
+void vy_recovery_fini(struct vy_recovery *r)
+{
+	struct id_hash_slot *s;
+
+	id_hash_foreach(&r->lsms, s)
+		lsm_free(s->val);
+	id_hash_foreach(&r->ranges, s)
+		range_free(s->val);
+	id_hash_foreach(&r->runs, s)
+		free(s->val);
+	id_hash_foreach(&r->slices, s)
+		slice_free(s->val);
+
+	id_hash_fini(&r->lsms);
+	id_hash_fini(&r->ranges);
+	id_hash_fini(&r->runs);
+	id_hash_fini(&r->slices);
+}
+
+static void *recovery_new(struct id_hash *h, int64_t id, size_t size)
+{
+	void *obj = calloc(1, size);
+
+	if (!obj || id_hash_put(h, id, obj)) {
+		pr_perror("Can't allocate vylog object");
+		free(obj);
+		return NULL;
+	}
+	return obj;
+}
+
+static int process_lsm(struct vy_recovery *r, const struct vy_log_record *rec)
+{
+	struct vy_lsm_recovery_info *lsm = id_hash_get(&r->lsms, rec->lsm_id);
+
+	if (rec->type == VY_LOG_CREATE_LSM || rec->type == VY_LOG_PREPARE_LSM) {
+		/* Creation of a prepared LSM just commits it */
+		if (lsm && lsm->prepared && rec->type == VY_LOG_CREATE_LSM) {
+			lsm->create_lsn = rec->create_lsn;
+			lsm->prepared = false;
+			return 0;
+		} else if (lsm)
+			return 1;
+
+		lsm = recovery_new(&r->lsms, rec->lsm_id, sizeof(*lsm));
+		if (!lsm)
+			return -1;
+
+		lsm->id		= rec->lsm_id;
+		lsm->space_id	= rec->space_id;
+		lsm->index_id	= rec->index_id;
+		lsm->group_id	= rec->group_id;
+		lsm->create_lsn	= rec->create_lsn;
+		lsm->key_def	= mp_dup(rec->key_def);
+		lsm->prepared	= rec->type == VY_LOG_PREPARE_LSM;
+		return 0;
+	}
+
+	if (!lsm)
+		return 1;
+
+	switch (rec->type) {
+	case VY_LOG_MODIFY_LSM:
+		free(lsm->key_def);
+		lsm->key_def = mp_dup(rec->key_def);
+		lsm->modify_lsn = rec->modify_lsn;
+		break;
+	case VY_LOG_DROP_LSM:
+		lsm->dropped = true;
+		lsm->drop_lsn = rec->drop_lsn;
+		break;
+	case VY_LOG_DUMP_LSM:
+		lsm->dump_lsn = rec->dump_lsn;
+		break;
+	case VY_LOG_FORGET_LSM:
+		lsm_free(id_hash_del(&r->lsms, rec->lsm_id));
+		break;
+	}
+	return 0;
+}
+
+static int process_range(struct vy_recovery *r, const struct vy_log_record *rec)
+{
+	struct vy_range_recovery_info *range;
+
+	if (rec->type == VY_LOG_DELETE_RANGE) {
+		range = id_hash_del(&r->ranges, rec->range_id);
+		if (!range)
+			return 1;
+		range_free(range);
+		return 0;
+	}
+
+	if (!id_hash_get(&r->lsms, rec->lsm_id) ||
+	    id_hash_get(&r->ranges, rec->range_id))
+		return 1;
+
+	range = recovery_new(&r->ranges, rec->range_id, sizeof(*range));
+	if (!range)
+		return -1;
+
+	range->id	= rec->range_id;
+	range->lsm_id	= rec->lsm_id;
+	range->begin	= mp_dup(rec->begin);
+	range->end	= mp_dup(rec->end);
+	return 0;
+}
+
+static int process_run(struct vy_recovery *r, const struct vy_log_record *rec)
+{
+	struct vy_run_recovery_info *run = id_hash_get(&r->runs, rec->run_id);
+
+	switch (rec->type) {
+	case VY_LOG_PREPARE_RUN:
+	case VY_LOG_CREATE_RUN:
+		if (!id_hash_get(&r->lsms, rec->lsm_id))
+			return 1;
+		if (run && !(run->prepared && rec->type == VY_LOG_CREATE_RUN))
+			return 1;
+		if (!run) {
+			run = recovery_new(&r->runs, rec->run_id, sizeof(*run));
+			if (!run)
+				return -1;
+		}
+
+		run->id		= rec->run_id;
+		run->lsm_id	= rec->lsm_id;
+		run->dump_lsn	= rec->dump_lsn;
+		run->dump_count	= rec->dump_count;
+		run->prepared	= rec->type == VY_LOG_PREPARE_RUN;
+		break;
+	case VY_LOG_DROP_RUN:
+		if (!run)
+			return 1;
+		run->dropped = true;
+		run->gc_lsn = rec->gc_lsn;
+		break;
+	case VY_LOG_FORGET_RUN:
+		if (!run)
+			return 1;
+		free(id_hash_del(&r->runs, rec->run_id));
+		break;
+	}
+	return 0;
+}
+
+static int process_slice(struct vy_recovery *r, const struct vy_log_record *rec)
+{
+	struct vy_slice_recovery_info *slice;
+
+	if (rec->type == VY_LOG_DELETE_SLICE) {
+		slice = id_hash_del(&r->slices, rec->slice_id);
+		if (!slice)
+			return 1;
+		slice_free(slice);
+		return 0;
+	}
+
+	if (!id_hash_get(&r->ranges, rec->range_id) ||
+	    !id_hash_get(&r->runs, rec->run_id) ||
+	    id_hash_get(&r->slices, rec->slice_id))
+		return 1;
+
+	slice = recovery_new(&r->slices, rec->slice_id, sizeof(*slice));
+	if (!slice)
+		return -1;
+
+	slice->id	= rec->slice_id;
+	slice->range_id	= rec->range_id;
+	slice->run_id	= rec->run_id;
+	slice->begin	= mp_dup(rec->begin);
+	slice->end	= mp_dup(rec->end);
+	return 0;
+}
+
+/*
+ * Apply a record to the layout. Records which don't
+ * fit the current state are counted and skipped.
+ */
+int vy_recovery_process(struct vy_recovery *r, const struct vy_log_record *rec)
+{
+	int ret = 0;
+
+	r->nr_records++;
+
+	switch (rec->type) {
+	case VY_LOG_CREATE_LSM:
+	case VY_LOG_PREPARE_LSM:
+	case VY_LOG_MODIFY_LSM:
+	case VY_LOG_DROP_LSM:
+	case VY_LOG_FORGET_LSM:
+	case VY_LOG_DUMP_LSM:
+		ret = process_lsm(r, rec);
+		break;
+	case VY_LOG_INSERT_RANGE:
+	case VY_LOG_DELETE_RANGE:
+		ret = process_range(r, rec);
+		break;
+	case VY_LOG_PREPARE_RUN:
+	case VY_LOG_CREATE_RUN:
+	case VY_LOG_DROP_RUN:
+	case VY_LOG_FORGET_RUN:
+		ret = process_run(r, rec);
+		break;
+	case VY_LOG_INSERT_SLICE:
+	case VY_LOG_DELETE_SLICE:
+		ret = process_slice(r, rec);
+		break;
+	default:
+		/* Snapshot and rebootstrap markers, legacy truncate */
+		break;
+	}
+
+	if (ret > 0) {
+		pr_err("vylog record %llu: %s doesn't match the state "
+		       "(lsm %lld range %lld run %lld slice %lld)\n",
+		       (unsigned long long)r->nr_records,
+		       vy_log_type_name[rec->type],
+		       (long long)rec->lsm_id, (long long)rec->range_id,
+		       (long long)rec->run_id, (long long)rec->slice_id);
+		r->nr_errors++;
+		ret = 0;
+	}
+	return ret;
+}
+
+/* Collect hash values sorted by @cmp */
+static void **sorted_values(struct id_hash *h, int (*cmp)(const void *, const void *))
+{
+	void **vals = malloc((h->nr + 1) * sizeof(vals[0]));
+	struct id_hash_slot *s;
+	size_t nr = 0;
+
+	if (!vals) {
+		pr_perror("Can't allocate vylog report");
+		return NULL;
+	}
+
+	id_hash_foreach(h, s)
+		vals[nr++] = s->val;
+	qsort(vals, nr, sizeof(vals[0]), cmp);
+	return vals;
+}
+
+#define cmp_field(a, b, f)	((a)->f < (b)->f ? -1 : (a)->f > (b)->f)
+
+static int lsm_cmp(const void *x, const void *y)
+{
+	const struct vy_lsm_recovery_info *a = *(void **)x, *b = *(void **)y;
+
+	return cmp_field(a, b, space_id) ?: cmp_field(a, b, index_id) ?:
+	       cmp_field(a, b, id);
+}
+
+static int range_cmp(const void *x, const void *y)
+{
+	const struct vy_range_recovery_info *a = *(void **)x, *b = *(void **)y;
+
+	return cmp_field(a, b, lsm_id) ?: cmp_field(a, b, id);
+}
+
+static int run_cmp(const void *x, const void *y)
+{
+	const struct vy_run_recovery_info *a = *(void **)x, *b = *(void **)y;
+
+	return cmp_field(a, b, lsm_id) ?: cmp_field(a, b, id);
+}
+
+static int slice_cmp(const void *x, const void *y)
+{
+	const struct vy_slice_recovery_info *a = *(void **)x, *b = *(void **)y;
+
+	return cmp_field(a, b, range_id) ?: cmp_field(a, b, id);
+}
+
+/* First of the objects sorted by a parent id at @off which is @id */
+static size_t lower_bound(void **vals, size_t nr, size_t off, int64_t id)
+{
+	size_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (*(const int64_t *)((const char *)vals[mid] + off) < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+size_t vy_layout_ranges(const struct vy_layout *l, int64_t lsm_id)
+{
+	return lower_bound(l->ranges, l->nr_ranges,
+			   offsetof(struct vy_range_recovery_info, lsm_id), lsm_id);
+}
+
+size_t vy_layout_slices(const struct vy_layout *l, int64_t range_id)
+{
+	return lower_bound(l->slices, l->nr_slices,
+			   offsetof(struct vy_slice_recovery_info, range_id), range_id);
+}
+
+size_t vy_layout_runs(const struct vy_layout *l, int64_t lsm_id)
+{
+	return lower_bound(l->runs, l->nr_runs,
+			   offsetof(struct vy_run_recovery_info, lsm_id), lsm_id);
+}
+
+int vy_layout_create(struct vy_layout *l, struct vy_recovery *r)
+{
+	memset(l, 0, sizeof(*l));
+	l->nr_lsms = r->lsms.nr;
+	l->nr_ranges = r->ranges.nr;
+	l->nr_runs = r->runs.nr;
+	l->nr_slices = r->slices.nr;
+	l->nr_records = r->nr_records;
+	l->nr_errors = r->nr_errors;
+
+	if (!(l->lsms = sorted_values(&r->lsms, lsm_cmp)) ||
+	    !(l->ranges = sorted_values(&r->ranges, range_cmp)) ||
+	    !(l->runs = sorted_values(&r->runs, run_cmp)) ||
+	    !(l->slices = sorted_values(&r->slices, slice_cmp))) {
+		vy_layout_destroy(l);
+		return -1;
+	}
+	return 0;
+}
+
+void vy_layout_destroy(struct vy_layout *l)
+{
+	free(l->lsms);
+	free(l->ranges);
+	free(l->runs);
+	free(l->slices);
+}
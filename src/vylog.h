@@ -0,0 +1,110 @@
+#ifndef VYLOG_H__
+#define VYLOG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+
+/*
+ * A vylog record, keys which are not present
+ * in the record are zero or NULL.
+ */
+struct vy_log_record {
+	uint32_t	type;
+	int64_t		lsm_id;
+	int64_t		range_id;
+	int64_t		run_id;
+	int64_t		slice_id;
+	uint32_t	index_id;
+	uint32_t	space_id;
+	uint32_t	group_id;
+	const char	*begin;
+	const char	*end;
+	const char	*key_def;
+	int64_t		dump_lsn;
+	int64_t		gc_lsn;
+	int64_t		create_lsn;
+	int64_t		modify_lsn;
+	int64_t		drop_lsn;
+	uint32_t	dump_count;
+};
+
+/* Vinyl layout replayed from a vylog */
+struct vy_recovery {
+	struct id_hash	lsms;
+	struct id_hash	ranges;
+	struct id_hash	runs;
+	struct id_hash	slices;
+	uint64_t	nr_records;
+	uint64_t	nr_errors;
+};
+
+/* What the vylog says of an LSM tree, its ranges, slices and runs */
+struct vy_lsm_recovery_info {
+	int64_t		id;
+	uint32_t	space_id;
+	uint32_t	index_id;
+	uint32_t	group_id;
+	int64_t		create_lsn;
+	int64_t		modify_lsn;
+	int64_t		drop_lsn;
+	int64_t		dump_lsn;
+	char		*key_def;
+	bool		prepared;
+	bool		dropped;
+};
+
+struct vy_range_recovery_info {
+	int64_t		id;
+	int64_t		lsm_id;
+	char		*begin;
+	char		*end;
+};
+
+struct vy_run_recovery_info {
+	int64_t		id;
+	int64_t		lsm_id;
+	int64_t		dump_lsn;
+	int64_t		gc_lsn;
+	uint32_t	dump_count;
+	bool		prepared;
+	bool		dropped;
+};
+
+struct vy_slice_recovery_info {
+	int64_t		id;
+	int64_t		range_id;
+	int64_t		run_id;
+	char		*begin;
+	char		*end;
+};
+
+/* Objects of a replayed vylog, each sorted by its parent and id */
+struct vy_layout {
+	void		**lsms;
+	void		**ranges;
+	void		**runs;
+	void		**slices;
+	size_t		nr_lsms;
+	size_t		nr_ranges;
+	size_t		nr_runs;
+	size_t		nr_slices;
+	uint64_t	nr_records;
+	uint64_t	nr_errors;
+};
+
+extern const char *vy_log_record_fields(const char *body, uint32_t *type);
+extern int vy_log_record_decode(struct vy_log_record *rec, const char *body);
+
+extern void vy_recovery_init(struct vy_recovery *r);
+extern void vy_recovery_fini(struct vy_recovery *r);
+extern int vy_recovery_process(struct vy_recovery *r,
+			       const struct vy_log_record *rec);
+extern int vy_layout_create(struct vy_layout *l, struct vy_recovery *r);
+extern void vy_layout_destroy(struct vy_layout *l);
+extern size_t vy_layout_ranges(const struct vy_layout *l, int64_t lsm_id);
+extern size_t vy_layout_slices(const struct vy_layout *l, int64_t range_id);
+extern size_t vy_layout_runs(const struct vy_layout *l, int64_t lsm_id);
+
+#endif /* VYLOG_H__ */
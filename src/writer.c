@@ -0,0 +1,433 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "writer.h"
+#include "xlog.h"
+#include "pool.h"
+#include "crc32c.h"
+#include "log.h"
+
+#include "msgpuck/msgpuck.h"
+
+enum {
+	/** Room for an encoded row header */
+	WRITER_HEADER_MAX	= 128,
+};
+
+static const char writer_format[] = "0.13";
+
+/* Rows of a block, compressed in a worker if they are worth it */
+struct writer_block {
+	struct obuf	rows;
+	char		*zbuf;
+	size_t		zbuf_size;
+	size_t		zlen;
+	uint32_t	crc32c;
+	int		rc;
+};
+
+static void writer_block_work(void *item, int worker, void *arg)
+{
+	struct writer *w = arg;
+	struct writer_block *b = item;
+	size_t bound;
+
+	b->zlen = 0;
+	b->rc = 0;
+
+	if (w->level && b->rows.len > WRITER_ZSTD_MIN) {
+		bound = ZSTD_compressBound(b->rows.len);
+		if (bound > b->zbuf_size) {
+			char *buf = realloc(b->zbuf, bound);
+			if (!buf) {
+				pr_perror("Can't allocate compression buffer");
+				b->rc = -1;
+				return;
+			}
+			b->zbuf = buf;
+			b->zbuf_size = bound;
+		}
+
+		b->zlen = ZSTD_compressCCtx(w->cctx[worker], b->zbuf, b->zbuf_size,
+					    b->rows.buf, b->rows.len, w->level);
+		if (ZSTD_isError(b->zlen)) {
+			pr_err("Can't compress block: %s\n",
+			       ZSTD_getErrorName(b->zlen));
+			b->rc = -1;
+			return;
+		}
+		b->crc32c = crc32c(0, b->zbuf, b->zlen);
+	} else
+		b->crc32c = crc32c(0, b->rows.buf, b->rows.len);
+}
+
+/* Fixheader and data, crc32p chains blocks the way --verify checks */
+static int writer_block_done(void *item, void *arg)
+{
+	struct writer *w = arg;
+	struct writer_block *b = item;
+	const char *data = b->zlen ? b->zbuf : b->rows.buf;
+	size_t len = b->zlen ? b->zlen : b->rows.len;
+	char fixheader[XLOG_FIXHEADER_SIZE], *p;
+	ptrdiff_t padding;
+
+	if (b->rc)
+		return -1;
+
+	p = mp_store_u32(fixheader, b->zlen ? 0xd5ba0bba : 0xd5ba0bab);
+	p = mp_encode_uint(p, len);
+	p = mp_encode_uint(p, w->crc32p);
+	p = mp_encode_uint(p, b->crc32c);
+	padding = fixheader + sizeof(fixheader) - p;
+	if (padding > 0) {
+		p = mp_encode_strl(p, padding - 1);
+		memset(p, 0, padding - 1);
+	}
+
+	obuf_put(&w->out, fixheader, sizeof(fixheader));
+	obuf_write(&w->out, data, len);
+	w->crc32p = b->crc32c;
+	w->blocks++;
+	w->bytes += sizeof(fixheader) + len;
+	return w->out.error ? -1 : 0;
+}
+
+static void writer_block_free(void *item)
+{
+	struct writer_block *b = item;
+
+	obuf_fini(&b->rows);
+	free(b->zbuf);
+}
+
+static void put_meta_key(struct writer *w, int key, const char *val)
+{
+	if (val && val[0])
+		obuf_printf(&w->out, "%s: %s\n", xlog_meta_keys[key], val);
+}
+
+/* Keys go in the order tarantool puts them */
+static void put_meta(struct writer *w, int file_type,
+		     const struct writer_meta *meta)
+{
+	obuf_printf(&w->out, "%s\n%s\n", xlog_type_name(file_type), writer_format);
+	put_meta_key(w, XLOG_META_VERSION_KEY, meta->version);
+	put_meta_key(w, XLOG_META_INSTANCE_UUID_KEY, meta->instance);
+	obuf_printf(&w->out, "%s: %s\n",
+		    xlog_meta_keys[XLOG_META_XLOG_META_VCLOCK_KEY], meta->vclock);
+	put_meta_key(w, XLOG_META_PREV_VCLOCK_KEY, meta->prev_vclock);
+	obuf_putc(&w->out, '\n');
+	w->bytes = w->out.len;
+}
+
+/* Counters stay for the caller to report */
+static void writer_free(struct writer *w)
+{
+	if (w->pool) {
+		pool_for_each_item(w->pool, writer_block_free);
+		pool_destroy(w->pool);
+		w->pool = NULL;
+	}
+	for (int i = 0; i < w->nr_cctx; i++)
+		ZSTD_freeCCtx(w->cctx[i]);
+	free(w->cctx);
+	w->cctx = NULL;
+	w->nr_cctx = 0;
+	obuf_fini(&w->out);
+	obuf_fini(&w->held_body);
+	free(w->tmp_path);
+	free(w->path);
+	w->tmp_path = w->path = NULL;
+	w->out.fd = -1;
+}
+
+/*
+ * Start a file of @file_type at @path, blocks are compressed
+ * at zstd @level, not at all with 0, by @jobs threads.
+ */
+int writer_open(struct writer *w, const char *path, int file_type,
+		const struct writer_meta *meta, int level, int jobs)
+{
+	int nr_workers = jobs > 1 ? jobs : 0;
+	int fd;
+
+	memset(w, 0, sizeof(*w));
+	w->out.fd = -1;
+	w->held_body.fd = -1;
+	w->level = level;
+
+	w->path = strdup(path);
+	if (!w->path || asprintf(&w->tmp_path, "%s.inprogress", path) < 0) {
+		w->tmp_path = NULL;
+		pr_perror("Can't allocate path");
+		goto err;
+	}
+
+	w->nr_cctx = nr_workers ? nr_workers : 1;
+	w->cctx = calloc(w->nr_cctx, sizeof(w->cctx[0]));
+	if (!w->cctx) {
+		w->nr_cctx = 0;
+		pr_perror("Can't allocate compression contexts");
+		goto err;
+	}
+	for (int i = 0; i < w->nr_cctx; i++) {
+		w->cctx[i] = ZSTD_createCCtx();
+		if (!w->cctx[i]) {
+			pr_err("Can't create compression context\n");
+			goto err;
+		}
+	}
+
+	w->pool = pool_create(nr_workers, w->nr_cctx * 4, sizeof(struct writer_block),
+			      writer_block_work, writer_block_done, w);
+	if (!w->pool)
+		goto err;
+
+	fd = open(w->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pr_perror("Can't create %s", w->tmp_path);
+		goto err;
+	}
+	if (obuf_init(&w->out, fd, OBUF_SIZE_DEF)) {
+		close(fd);
+		w->out.fd = -1;
+		goto err;
+	}
+
+	put_meta(w, file_type, meta);
+	return 0;
+err:
+	if (w->out.fd >= 0) {
+		close(w->out.fd);
+		unlink(w->tmp_path);
+	}
+	writer_free(w);
+	return -1;
+}
+
+/* Same keys tarantool puts, the ones being zero are omitted */
+static char *encode_header(char *p, const struct xrow_header *hdr)
+{
+	char *map = p++;
+	uint32_t size = 0, flags;
+
+	p = mp_encode_uint(p, IPROTO_REQUEST_TYPE);
+	p = mp_encode_uint(p, hdr->type);
+	size++;
+	if (hdr->replica_id) {
+		p = mp_encode_uint(p, IPROTO_REPLICA_ID);
+		p = mp_encode_uint(p, hdr->replica_id);
+		size++;
+	}
+	if (hdr->group_id) {
+		p = mp_encode_uint(p, IPROTO_GROUP_ID);
+		p = mp_encode_uint(p, hdr->group_id);
+		size++;
+	}
+	if (hdr->sync) {
+		p = mp_encode_uint(p, IPROTO_SYNC);
+		p = mp_encode_uint(p, hdr->sync);
+		size++;
+	}
+	if (hdr->lsn) {
+		p = mp_encode_uint(p, IPROTO_LSN);
+		p = mp_encode_uint(p, hdr->lsn);
+		size++;
+	}
+	if (hdr->tm) {
+		p = mp_encode_uint(p, IPROTO_TIMESTAMP);
+		p = mp_encode_double(p, hdr->tm);
+		size++;
+	}
+	if (hdr->schema_version) {
+		p = mp_encode_uint(p, IPROTO_SCHEMA_VERSION);
+		p = mp_encode_uint(p, hdr->schema_version);
+		size++;
+	}
+	/* Statements of a transaction refer to its first one */
+	if (hdr->tsn && (hdr->tsn != hdr->lsn || !hdr->is_commit)) {
+		p = mp_encode_uint(p, IPROTO_TSN);
+		p = mp_encode_uint(p, hdr->lsn - hdr->tsn);
+		size++;
+	}
+	/* Synchronous replication flags are kept, the commit one is ours */
+	flags = hdr->flags & ~IPROTO_FLAG_COMMIT;
+	if (hdr->tsn && hdr->tsn != hdr->lsn && hdr->is_commit)
+		flags |= IPROTO_FLAG_COMMIT;
+	if (flags) {
+		p = mp_encode_uint(p, IPROTO_FLAGS);
+		p = mp_encode_uint(p, flags);
+		size++;
+	}
+
+	/* There are few keys, the map header is a byte */
+	mp_encode_map(map, size);
+	return p;
+}
+
+int writer_row(struct writer *w, const struct xrow_header *hdr)
+{
+	struct writer_block *b = w->block;
+	size_t len = WRITER_HEADER_MAX;
+	char *p;
+
+	if (!b) {
+		b = pool_next(w->pool);
+		if (!b)
+			return -1;
+		if (!b->rows.buf && obuf_init(&b->rows, -1, WRITER_BLOCK_SIZE * 2))
+			return -1;
+		b->rows.len = 0;
+		w->block = b;
+	}
+
+	for (int i = 0; i < hdr->bodycnt; i++)
+		len += hdr->body[i].iov_len;
+	p = obuf_reserve(&b->rows, len);
+	if (!p)
+		return -1;
+
+	p = encode_header(p, hdr);
+	for (int i = 0; i < hdr->bodycnt; i++) {
+		memcpy(p, hdr->body[i].iov_base, hdr->body[i].iov_len);
+		p += hdr->body[i].iov_len;
+	}
+	b->rows.len = p - b->rows.buf;
+	w->rows++;
+
+	/* Rows of a transaction go in one block */
+	if (b->rows.len >= WRITER_BLOCK_SIZE && hdr->is_commit) {
+		pool_submit(w->pool);
+		w->block = NULL;
+	}
+	return 0;
+}
+
+/* Keep a row till it is known whether it commits */
+static int writer_hold(struct writer *w, const struct xrow_header *hdr)
+{
+	char *p;
+
+	w->held_body.len = 0;
+	for (int i = 0; i < hdr->bodycnt; i++) {
+		obuf_put(&w->held_body, hdr->body[i].iov_base, hdr->body[i].iov_len);
+		if (w->held_body.error)
+			return -1;
+	}
+
+	w->held = *hdr;
+	p = w->held_body.buf;
+	w->held.bodycnt = hdr->bodycnt ? 1 : 0;
+	w->held.body[0].iov_base = p;
+	w->held.body[0].iov_len = w->held_body.len;
+	w->has_held = true;
+	return 0;
+}
+
+static int writer_release(struct writer *w, bool commit)
+{
+	if (!w->has_held)
+		return 0;
+	w->has_held = false;
+	w->held.is_commit = commit;
+	return writer_row(w, &w->held);
+}
+
+/*
+ * Write a row unless it is dropped. Rows of a transaction
+ * refer to its first one and the last one commits it, with
+ * some of them dropped those kept are linked anew: the last
+ * row kept waits for the next one to know if it commits.
+ */
+int writer_filter_row(struct writer *w, const struct xrow_header *hdr,
+		      bool keep)
+{
+	struct xrow_header row;
+
+	/* A single statement transaction */
+	if (hdr->tsn == hdr->lsn && hdr->is_commit) {
+		if (writer_release(w, false))
+			return -1;
+		return keep ? writer_row(w, hdr) : 0;
+	}
+
+	/* The previous one is not finished in the input either */
+	if (hdr->tsn != w->tx_src) {
+		if (writer_release(w, false))
+			return -1;
+		w->tx_src = hdr->tsn;
+		w->tx_tsn = 0;
+	}
+
+	if (!keep && !hdr->is_commit)
+		return 0;
+	/* The last row kept commits instead and waits as the commit did */
+	if (!keep) {
+		w->held.flags |= hdr->flags & ~IPROTO_FLAG_COMMIT;
+		return writer_release(w, true);
+	}
+	if (writer_release(w, false))
+		return -1;
+
+	row = *hdr;
+	if (!w->tx_tsn)
+		w->tx_tsn = hdr->lsn;
+	row.tsn = w->tx_tsn;
+	return hdr->is_commit ? writer_row(w, &row) : writer_hold(w, &row);
+}
+
+/* Write the rest and the eof marker, the file gets its name if all is well */
+int writer_close(struct writer *w)
+{
+	int fd = w->out.fd, ret = 0;
+	char *p;
+
+	if (writer_release(w, false))
+		ret = -1;
+	if (w->block) {
+		pool_submit(w->pool);
+		w->block = NULL;
+	}
+	if (pool_wait(w->pool))
+		ret = -1;
+
+	p = obuf_reserve(&w->out, sizeof(log_magic_t));
+	if (p) {
+		mp_store_u32(p, 0xd510aded);
+		w->out.len += sizeof(log_magic_t);
+		w->bytes += sizeof(log_magic_t);
+	}
+	if (obuf_flush(&w->out))
+		ret = -1;
+
+	if (!ret && fsync(fd)) {
+		pr_perror("Can't sync %s", w->tmp_path);
+		ret = -1;
+	}
+	if (close(fd) && !ret) {
+		pr_perror("Can't close %s", w->tmp_path);
+		ret = -1;
+	}
+	if (!ret && rename(w->tmp_path, w->path)) {
+		pr_perror("Can't rename %s", w->tmp_path);
+		ret = -1;
+	}
+	if (ret)
+		unlink(w->tmp_path);
+
+	writer_free(w);
+	return ret;
+}
+
+/* Drop the file written so far */
+void writer_abort(struct writer *w)
+{
+	pool_wait(w->pool);
+	close(w->out.fd);
+	unlink(w->tmp_path);
+	writer_free(w);
+}
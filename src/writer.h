@@ -0,0 +1,69 @@
+#ifndef WRITER_H__
+#define WRITER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <zstd.h>
+
+#include "obuf.h"
+#include "xlog.h"
+
+struct writer_block;
+struct pool;
+
+enum {
+	/** Blocks are cut at a commit past this size, as tarantool does */
+	WRITER_BLOCK_SIZE	= 128u << 10,
+	/** Blocks of this size and less are not compressed */
+	WRITER_ZSTD_MIN		= 2u << 10,
+	/** Compression level of tarantool */
+	WRITER_ZSTD_LEVEL_DEF	= 3,
+};
+
+/* Text meta of a file being written, vclocks are like {1: 8} */
+struct writer_meta {
+	const char	*instance;
+	const char	*version;
+	const char	*vclock;
+	/** NULL or empty if there is none */
+	const char	*prev_vclock;
+};
+
+/*
+ * Writes rows of a snapshot or an xlog. Blocks are
+ * compressed by worker threads and put into the file
+ * in order, into PATH.inprogress renamed at close.
+ */
+struct writer {
+	char			*path;
+	char			*tmp_path;
+	struct obuf		out;
+	int			level;
+	struct pool		*pool;
+	/* Being filled, NULL if none is */
+	struct writer_block	*block;
+	ZSTD_CCtx		**cctx;
+	int			nr_cctx;
+	uint32_t		crc32p;
+	/* The last row kept of a transaction being filtered */
+	struct xrow_header	held;
+	struct obuf		held_body;
+	bool			has_held;
+	/* Transaction of the input and its first row kept */
+	int64_t			tx_src;
+	int64_t			tx_tsn;
+	uint64_t		rows;
+	uint64_t		blocks;
+	uint64_t		bytes;
+};
+
+extern int writer_open(struct writer *w, const char *path, int file_type,
+		       const struct writer_meta *meta, int level, int jobs);
+extern int writer_row(struct writer *w, const struct xrow_header *hdr);
+extern int writer_filter_row(struct writer *w, const struct xrow_header *hdr,
+			     bool keep);
+extern int writer_close(struct writer *w);
+extern void writer_abort(struct writer *w);
+
+#endif /* WRITER_H__ */
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xindex.h"
+#include "filter.h"
+#include "crc32c.h"
+#include "log.h"
+
+#define XINDEX_MAGIC	0x58445454	/* "TTDX" */
+#define XINDEX_VERSION	1
+#define XINDEX_SUFFIX	".ttdx"
+
+struct xindex_hdr {
+	uint32_t		magic;
+	uint32_t		version;
+	struct xindex_key	key;
+	uint64_t		nr;
+	/** crc32c of the entries */
+	uint32_t		crc;
+	uint32_t		pad;
+};
+
+/*
+ * The index lives next to the file unless a cache
+ * directory is given, there it is named after the
+ * file identity so renames don't invalidate it.
+ */
+int xindex_open(struct xindex *idx, const char *path, int fd,
+		uint64_t data_off, const char *dir)
+{
+	struct stat st;
+	int len;
+
+	memset(idx, 0, sizeof(*idx));
+
+	if (fstat(fd, &st) < 0) {
+		pr_perror("Can't stat %s", path);
+		return -1;
+	}
+
+	idx->key.dev		= st.st_dev;
+	idx->key.ino		= st.st_ino;
+	idx->key.size		= st.st_size;
+	idx->key.mtime_sec	= st.st_mtim.tv_sec;
+	idx->key.mtime_nsec	= st.st_mtim.tv_nsec;
+	idx->key.data_off	= data_off;
+
+	if (dir)
+		len = asprintf(&idx->path, "%s/%llx-%llx-%llx-%llx.%09lld" XINDEX_SUFFIX,
+			       dir, (unsigned long long)idx->key.dev,
+			       (unsigned long long)idx->key.ino,
+			       (unsigned long long)idx->key.size,
+			       (long long)idx->key.mtime_sec,
+			       (long long)idx->key.mtime_nsec);
+	else
+		len = asprintf(&idx->path, "%s" XINDEX_SUFFIX, path);
+	if (len < 0) {
+		pr_perror("Can't allocate index path");
+		idx->path = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void xindex_close(struct xindex *idx)
+{
+	free(idx->path);
+	free(idx->entries);
+	free(idx->bounds);
+	memset(idx, 0, sizeof(*idx));
+}
+
+int xindex_add(struct xindex *idx, const struct xindex_entry *e)
+{
+	if (idx->nr == idx->size) {
+		size_t size = idx->size ? idx->size * 2 : 1024;
+		struct xindex_entry *entries;
+
+		entries = realloc(idx->entries, size * sizeof(entries[0]));
+		if (!entries) {
+			pr_perror("Can't grow index");
+			return -1;
+		}
+		idx->entries = entries;
+		idx->size = size;
+	}
+
+	idx->entries[idx->nr++] = *e;
+	return 0;
+}
+
+/* Precompute running bounds for the lookups */
+static int xindex_seal(struct xindex *idx)
+{
+	struct xindex_bound *b;
+
+	free(idx->bounds);
+	idx->bounds = b = malloc((idx->nr + 1) * sizeof(b[0]));
+	if (!b) {
+		pr_perror("Can't allocate index bounds");
+		return -1;
+	}
+
+	for (size_t i = 0; i < idx->nr; i++) {
+		const struct xindex_entry *e = &idx->entries[i];
+
+		b[i].max_lsn = e->max_lsn;
+		b[i].max_tm = e->max_tm;
+		if (i && b[i - 1].max_lsn > b[i].max_lsn)
+			b[i].max_lsn = b[i - 1].max_lsn;
+		if (i && b[i - 1].max_tm > b[i].max_tm)
+			b[i].max_tm = b[i - 1].max_tm;
+	}
+
+	b[idx->nr].min_lsn = INT64_MAX;
+	b[idx->nr].min_tm = INFINITY;
+	for (size_t i = idx->nr; i-- > 0;) {
+		const struct xindex_entry *e = &idx->entries[i];
+
+		b[i].min_lsn = e->min_lsn < b[i + 1].min_lsn ?
+			e->min_lsn : b[i + 1].min_lsn;
+		b[i].min_tm = e->min_tm < b[i + 1].min_tm ?
+			e->min_tm : b[i + 1].min_tm;
+	}
+	return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = read(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Returns 0 when a valid index is loaded, 1 if there
+ * is none or it is stale and -1 on error.
+ */
+int xindex_load(struct xindex *idx)
+{
+	struct xindex_hdr hdr;
+	size_t len;
+	int fd, ret = 1;
+
+	fd = open(idx->path, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 1;
+		pr_perror("Can't open index %s", idx->path);
+		return -1;
+	}
+
+	if (read_full(fd, &hdr, sizeof(hdr)) ||
+	    hdr.magic != XINDEX_MAGIC || hdr.version != XINDEX_VERSION ||
+	    memcmp(&hdr.key, &idx->key, sizeof(hdr.key)) ||
+	    hdr.nr > idx->key.size)
+		goto out;
+
+	len = hdr.nr * sizeof(idx->entries[0]);
+	idx->entries = malloc(len ? len : 1);
+	if (!idx->entries) {
+		pr_perror("Can't allocate index");
+		ret = -1;
+		goto out;
+	}
+
+	if (read_full(fd, idx->entries, len) ||
+	    crc32c(0, (const char *)idx->entries, len) != hdr.crc) {
+		free(idx->entries);
+		idx->entries = NULL;
+		goto out;
+	}
+
+	idx->nr = idx->size = hdr.nr;
+	ret = xindex_seal(idx) ? -1 : 0;
+out:
+	close(fd);
+	return ret;
+}
+
+/* Written aside and renamed so readers never see a partial index */
+int xindex_save(struct xindex *idx)
+{
+	size_t len = idx->nr * sizeof(idx->entries[0]);
+	struct xindex_hdr hdr = {
+		.magic		= XINDEX_MAGIC,
+		.version	= XINDEX_VERSION,
+		.key		= idx->key,
+		.nr		= idx->nr,
+		.crc		= crc32c(0, (const char *)idx->entries, len),
+	};
+	char *tmp;
+	int fd;
+
+	if (xindex_seal(idx))
+		return -1;
+
+	if (asprintf(&tmp, "%s.XXXXXX", idx->path) < 0) {
+		pr_perror("Can't allocate index path");
+		return -1;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		pr_perror("Can't create index %s", tmp);
+		free(tmp);
+		return -1;
+	}
+
+	if (write_full(fd, &hdr, sizeof(hdr)) ||
+	    write_full(fd, idx->entries, len) ||
+	    fchmod(fd, 0644) || close(fd)) {
+		pr_perror("Can't write index %s", tmp);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	if (rename(tmp, idx->path)) {
+		pr_perror("Can't rename index to %s", idx->path);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	free(tmp);
+	return 0;
+}
+
+/*
+ * Find entries [first, last) which may contain rows
+ * matching the LSN and time bounds of the filter.
+ */
+void xindex_range(const struct xindex *idx, const struct filter *f,
+		  size_t *first, size_t *last)
+{
+	const struct xindex_bound *b = idx->bounds;
+	size_t lo = 0, hi = idx->nr;
+
+	/* The first block having anything at or above the lower bounds */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (b[mid].max_lsn >= f->from_lsn && b[mid].max_tm >= f->from_tm)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*first = lo;
+
+	/* The first block after which everything is above the upper bounds */
+	hi = idx->nr;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (b[mid].min_lsn > f->to_lsn || b[mid].min_tm > f->to_tm)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*last = lo;
+}
@@ -0,0 +1,72 @@
+#ifndef XINDEX_H__
+#define XINDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct filter;
+
+/*
+ * Sidecar index of xlog blocks: a summary per
+ * fixheader which allows to seek by LSN or time
+ * without decoding the file from the start.
+ */
+
+/* Identity of the indexed file, any change makes the index stale */
+struct xindex_key {
+	uint64_t	dev;
+	uint64_t	ino;
+	uint64_t	size;
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	uint64_t	data_off;
+};
+
+struct xindex_entry {
+	/** Offset of the fixheader */
+	uint64_t	off;
+	int64_t		min_lsn;
+	int64_t		max_lsn;
+	double		min_tm;
+	double		max_tm;
+	uint32_t	nr_rows;
+	/** Payload length on disk and decompressed */
+	uint32_t	len;
+	uint32_t	raw_len;
+	uint32_t	pad;
+};
+
+/*
+ * LSNs are monotonic per replica only, so the lookup
+ * goes over the maximum of all blocks before and the
+ * minimum of all blocks after an entry.
+ */
+struct xindex_bound {
+	int64_t		max_lsn;
+	int64_t		min_lsn;
+	double		max_tm;
+	double		min_tm;
+};
+
+struct xindex {
+	char			*path;
+	struct xindex_key	key;
+
+	struct xindex_entry	*entries;
+	struct xindex_bound	*bounds;
+	size_t			nr;
+	size_t			size;
+};
+
+extern int xindex_open(struct xindex *idx, const char *path, int fd,
+		       uint64_t data_off, const char *dir);
+extern void xindex_close(struct xindex *idx);
+
+extern int xindex_load(struct xindex *idx);
+extern int xindex_add(struct xindex *idx, const struct xindex_entry *e);
+extern int xindex_save(struct xindex *idx);
+
+extern void xindex_range(const struct xindex *idx, const struct filter *f,
+			 size_t *first, size_t *last);
+
+#endif /* XINDEX_H__ */
@@ -1,9 +1,23 @@
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
 #include <zstd.h>
+#include <zstd_errors.h>
 
 #include "xlog.h"
+#include "crc32c.h"
+#include "marker.h"
 #include "load.h"
 #include "emit.h"
+#include "opts.h"
+#include "pool.h"
+#include "xindex.h"
+#include "vinyl.h"
+#include "follow.h"
+#include "tx.h"
+#include "stats.h"
+#include "vylog.h"
+#include "writer.h"
 #include "log.h"
 
 static char *wal_signatures[] = {
@@ -14,7 +28,7 @@ static char *wal_signatures[] = {
 	[WAL_TYPE_VY_INDEX]	= "INDEX",
 };
 
-static char *meta_keys[] = {
+const char *xlog_meta_keys[XLOG_META_MAX] = {
 	[XLOG_META_INSTANCE_UUID_KEY]			= "Instance",
 	[XLOG_META_INSTANCE_INSTANCE_UUID_KEY_V12]	= "Server",
 	[XLOG_META_XLOG_META_VCLOCK_KEY]		= "VClock",
@@ -22,38 +36,107 @@ static char *meta_keys[] = {
 	[XLOG_META_PREV_VCLOCK_KEY]			= "PrevVClock",
 };
 
+const char *xlog_type_name(int file_type)
+{
+	return file_type < WAL_TYPE_MAX ? wal_signatures[file_type] : "UNKNOWN";
+}
+
 static const log_magic_t row_marker = mp_bswap_u32(0xd5ba0bab);
 static const log_magic_t zrow_marker = mp_bswap_u32(0xd5ba0bba);
 static const log_magic_t eof_marker = mp_bswap_u32(0xd510aded);
 
+/*
+ * Check that a value of the type from iproto_key_type[] fits
+ * the buffer, scalars are checked by their header byte only.
+ */
+static inline int xrow_check_value(const char *pos, const char *end)
+{
+	switch (mp_typeof(*pos)) {
+	case MP_UINT:
+		return mp_check_uint(pos, end) > 0;
+	case MP_DOUBLE:
+		return mp_check_double(pos, end) > 0;
+	default:
+		return mp_check(&pos, end);
+	}
+}
+
+/*
+ * Skip a body with bounds checked. Values of top level keys
+ * which are integers per iproto_key_type[] are not walked by
+ * the generic mp_check(), anything else is.
+ */
+static int xrow_body_skip(const char **pos, const char *end)
+{
+	const char *p = *pos;
+	uint32_t size;
+
+	if (mp_typeof(*p) != MP_MAP)
+		return mp_check(pos, end);
+	if (mp_check_map(p, end) > 0)
+		return -1;
+
+	size = mp_decode_map(&p);
+	for (uint32_t i = 0; i < size; i++) {
+		uint64_t key;
+
+		if (p >= end)
+			return -1;
+		if (mp_typeof(*p) != MP_UINT) {
+			if (mp_check(&p, end) || p >= end || mp_check(&p, end))
+				return -1;
+			continue;
+		}
+
+		if (mp_check_uint(p, end) > 0)
+			return -1;
+		key = mp_decode_uint(&p);
+		if (p >= end)
+			return -1;
+
+		if (key < IPROTO_KEY_MAX && iproto_key_type[key] == MP_UINT &&
+		    mp_typeof(*p) == MP_UINT) {
+			if (mp_check_uint(p, end) > 0)
+				return -1;
+			mp_decode_uint(&p);
+		} else if (mp_check(&p, end)) {
+			return -1;
+		}
+	}
+
+	*pos = p;
+	return 0;
+}
+
+/*
+ * The header is validated while decoded so every byte
+ * of it is read once, the body is only skipped over.
+ */
 int xrow_header_decode(struct xrow_header *header, const char **pos,
 		       const char *end, bool end_is_exact)
 {
 	memset(header, 0, sizeof(struct xrow_header));
 
-	const char * const start = *pos;
-	const char *tmp = *pos;
-
-	if (mp_check(&tmp, end) != 0) {
+	if (*pos >= end || mp_typeof(**pos) != MP_MAP ||
+	    mp_check_map(*pos, end) > 0) {
 error:
 		pr_err("packet header\n");
 		return -1;
 	}
 
-	if (mp_typeof(**pos) != MP_MAP)
-		goto error;
-
 	bool has_tsn = false;
 	uint32_t flags = 0;
 
 	uint32_t size = mp_decode_map(pos);
 	for (uint32_t i = 0; i < size; i++) {
-		if (mp_typeof(**pos) != MP_UINT)
+		if (*pos >= end || mp_typeof(**pos) != MP_UINT ||
+		    mp_check_uint(*pos, end) > 0)
 			goto error;
 
 		uint64_t key = mp_decode_uint(pos);
-		if (key >= IPROTO_KEY_MAX ||
-		    iproto_key_type[key] != mp_typeof(**pos))
+		if (key >= IPROTO_KEY_MAX || *pos >= end ||
+		    iproto_key_type[key] != mp_typeof(**pos) ||
+		    xrow_check_value(*pos, end))
 			goto error;
 
 		switch (key) {
@@ -84,11 +167,12 @@ error:
 			break;
 		case IPROTO_FLAGS:
 			flags = mp_decode_uint(pos);
+			header->flags = flags;
 			header->is_commit = flags & IPROTO_FLAG_COMMIT;
 			break;
 		default:
 			/* unknown header */
-			pr_info("unknown key %lld\n", (long long)key);
+			pr_err("unknown key %lld\n", (long long)key);
 			mp_next(pos);
 		}
 	}
@@ -109,7 +193,7 @@ error:
 	/* Nop requests aren't supposed to have a body. */
 	if (*pos < end && header->type != IPROTO_NOP) {
 		const char *body = *pos;
-		if (mp_check(pos, end)) {
+		if (xrow_body_skip(pos, end)) {
 			pr_err("packet header\n");
 			return -1;
 		}
@@ -127,6 +211,106 @@ error:
 	return 0;
 }
 
+/*
+ * Header only decoding for scans. Integers and the timestamp
+ * are picked by their first byte with positive fixints, the
+ * most of them, taken right away. Other values and the body
+ * are skipped with bounds checked but not looked into.
+ */
+static int xrow_header_scan(struct xrow_header *hdr, const char **pos,
+			    const char *end)
+{
+	const char *p = *pos;
+	uint32_t size, flags = 0;
+	bool has_tsn = false;
+
+	if (p >= end || mp_typeof(*p) != MP_MAP || mp_check_map(p, end) > 0)
+		goto error;
+
+	memset(hdr, 0, sizeof(*hdr));
+	size = mp_decode_map(&p);
+	for (uint32_t i = 0; i < size; i++) {
+		uint64_t key, val;
+
+		if (end - p < 2)
+			goto error;
+		if ((uint8_t)*p < 0x80) {
+			key = (uint8_t)*p++;
+		} else {
+			if (mp_typeof(*p) != MP_UINT || mp_check_uint(p, end) > 0)
+				goto error;
+			key = mp_decode_uint(&p);
+			if (p >= end)
+				goto error;
+		}
+
+		if ((uint8_t)*p < 0x80) {
+			val = (uint8_t)*p++;
+		} else if (mp_typeof(*p) == MP_UINT) {
+			if (mp_check_uint(p, end) > 0)
+				goto error;
+			val = mp_decode_uint(&p);
+		} else if (mp_typeof(*p) == MP_DOUBLE && key == IPROTO_TIMESTAMP) {
+			if (mp_check_double(p, end) > 0)
+				goto error;
+			hdr->tm = mp_decode_double(&p);
+			continue;
+		} else {
+			if (mp_check(&p, end))
+				goto error;
+			continue;
+		}
+
+		switch (key) {
+		case IPROTO_REQUEST_TYPE:
+			hdr->type = val;
+			break;
+		case IPROTO_SYNC:
+			hdr->sync = val;
+			break;
+		case IPROTO_REPLICA_ID:
+			hdr->replica_id = val;
+			break;
+		case IPROTO_GROUP_ID:
+			hdr->group_id = val;
+			break;
+		case IPROTO_LSN:
+			hdr->lsn = val;
+			break;
+		case IPROTO_SCHEMA_VERSION:
+			hdr->schema_version = val;
+			break;
+		case IPROTO_TSN:
+			has_tsn = true;
+			hdr->tsn = val;
+			break;
+		case IPROTO_FLAGS:
+			flags = val;
+			break;
+		}
+	}
+
+	hdr->flags = flags;
+	hdr->is_commit = !has_tsn || (flags & IPROTO_FLAG_COMMIT);
+	hdr->tsn = hdr->lsn - hdr->tsn;
+
+	if (p < end && hdr->type != IPROTO_NOP) {
+		const char *body = p;
+
+		if (mp_check(&p, end))
+			goto error;
+		hdr->bodycnt = 1;
+		hdr->body[0].iov_base = (void *)body;
+		hdr->body[0].iov_len = p - body;
+	}
+
+	*pos = p;
+	return 0;
+error:
+	pr_err("packet header\n");
+	return -1;
+}
+
 static int parse_fixheader(struct xlog_fixheader *xhdr,
 			   const char **data, size_t *size)
 {
@@ -207,188 +391,1750 @@ static int parse_fixheader(struct xlog_fixheader *xhdr,
 	return 0;
 }
 
-static ssize_t decompress(ZSTD_DCtx *zdctx, char *dst, ssize_t dst_size,
-			  const char *src, ssize_t src_size)
+/*
+ * Contexts of finished files and workers are kept for the
+ * next ones, so the buffers aren't allocated and faulted
+ * in again for every file of a directory.
+ */
+static struct xlog_dctx dctx_cache[XLOG_DCTX_CACHE_MAX];
+static int dctx_cache_nr;
+static pthread_mutex_t dctx_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void xlog_dctx_create(struct xlog_dctx *dctx)
 {
-//	pr_info("decomp %zd\n", ZSTD_estimateDStreamSize_fromFrame(src, src_size));
-	ZSTD_inBuffer input = {
-		.src	= src,
-		.size	= src_size,
-		.pos	= 0,
-	};
+	memset(dctx, 0, sizeof(*dctx));
 
-	ZSTD_outBuffer output = {
-		.dst	= dst,
-		.size	= dst_size,
-		.pos	= 0,
-	};
+	pthread_mutex_lock(&dctx_cache_lock);
+	if (dctx_cache_nr)
+		*dctx = dctx_cache[--dctx_cache_nr];
+	pthread_mutex_unlock(&dctx_cache_lock);
+}
 
-	while (input.pos < input.size && output.pos < output.size) {
-		size_t rc = ZSTD_decompressStream(zdctx, &output, &input);
-		if (ZSTD_isError(rc)) {
-			pr_err("zstd: decompression failed %s\n", ZSTD_getErrorName(rc));
+static void dctx_free(struct xlog_dctx *dctx)
+{
+	if (dctx->zdctx)
+		ZSTD_freeDCtx(dctx->zdctx);
+	free(dctx->zbuf);
+}
+
+void xlog_dctx_destroy(struct xlog_dctx *dctx)
+{
+	if (!dctx->zdctx && !dctx->zbuf)
+		return;
+
+	pthread_mutex_lock(&dctx_cache_lock);
+	if (dctx_cache_nr < XLOG_DCTX_CACHE_MAX) {
+		dctx_cache[dctx_cache_nr++] = *dctx;
+		dctx = NULL;
+	}
+	pthread_mutex_unlock(&dctx_cache_lock);
+
+	if (dctx)
+		dctx_free(dctx);
+}
+
+void xlog_dctx_cache_fini(void)
+{
+	while (dctx_cache_nr)
+		dctx_free(&dctx_cache[--dctx_cache_nr]);
+}
+
+static int dctx_reserve(struct xlog_dctx *dctx, size_t size)
+{
+	size_t new_size = dctx->zbuf_size ? : XLOG_ZBUF_SIZE_MIN;
+	char *buf;
+
+	if (size <= dctx->zbuf_size)
+		return 0;
+
+	if (size > IPROTO_BODY_LEN_MAX) {
+		pr_err("zstd: too large block (%zu while max %zu)\n",
+		       size, (size_t)IPROTO_BODY_LEN_MAX);
+		return -1;
+	}
+
+	while (new_size < size)
+		new_size *= 2;
+
+	buf = realloc(dctx->zbuf, new_size);
+	if (!buf) {
+		pr_perror("Can't allocate decompression buffer");
+		return -1;
+	}
+	dctx->zbuf = buf;
+	dctx->zbuf_size = new_size;
+	return 0;
+}
+
+static int dctx_zdctx(struct xlog_dctx *dctx)
+{
+	if (!dctx->zdctx) {
+		dctx->zdctx = ZSTD_createDCtx();
+		if (!dctx->zdctx) {
+			pr_err("Can't create decompression context\n");
 			return -1;
 		}
 	}
-	return output.pos;
+	return 0;
 }
 
-static int parse_data(xlog_ctx_t *ctx)
+/*
+ * Decompress a block into the buffer of @dctx. A frame which
+ * tells its content size is decompressed at once, otherwise
+ * it is streamed growing the buffer when it gets full.
+ */
+static ssize_t decompress(struct xlog_dctx *dctx, const char *src, size_t src_size)
 {
-	struct xlog_fixheader xhdr;
-	struct xrow_header hdr;
+	unsigned long long size = ZSTD_getFrameContentSize(src, src_size);
+	ZSTD_inBuffer input = {
+		.src	= src,
+		.size	= src_size,
+		.pos	= 0,
+	};
+	ZSTD_outBuffer output;
+	size_t rc;
 
-	const char *pos = ctx->meta_end;
-	const char *rows, *rows_end;
-	static char buf[IPROTO_BODY_LEN_MAX];
+	if (size == ZSTD_CONTENTSIZE_ERROR) {
+		pr_err("zstd: no frame found\n");
+		return -1;
+	}
+
+	if (dctx_zdctx(dctx))
+		return -1;
 
-	int rc = -1;
+	if (size != ZSTD_CONTENTSIZE_UNKNOWN) {
+		if (dctx_reserve(dctx, size))
+			return -1;
 
-	/*
-	 * We don't verify Vynil files since system
-	 * spaces are sitting in xlog\snap files.
-	 */
-	if (ctx->file_type != WAL_TYPE_SNAP &&
-	    ctx->file_type != WAL_TYPE_XLOG) {
-		pr_info("vynil files are not verified\n");
-		return 0;
+		rc = ZSTD_decompressDCtx(dctx->zdctx, dctx->zbuf, size, src, src_size);
+		if (!ZSTD_isError(rc))
+			return rc;
+
+		/* More frames follow the first one */
+		if (ZSTD_getErrorCode(rc) != ZSTD_error_dstSize_tooSmall) {
+			pr_err("zstd: decompression failed %s\n", ZSTD_getErrorName(rc));
+			return -1;
+		}
 	}
 
-	while (pos < ctx->end) {
-		size_t size = ctx->end - pos;
+	if (dctx_reserve(dctx, src_size * 4))
+		return -1;
+
+	ZSTD_DCtx_reset(dctx->zdctx, ZSTD_reset_session_only);
+	output.dst = dctx->zbuf;
+	output.size = dctx->zbuf_size;
+	output.pos = 0;
 
-		if (parse_fixheader(&xhdr, &pos, &size))
+	for (;;) {
+		rc = ZSTD_decompressStream(dctx->zdctx, &output, &input);
+		if (ZSTD_isError(rc)) {
+			pr_err("zstd: decompression failed %s\n", ZSTD_getErrorName(rc));
 			return -1;
-		else if (xhdr.magic == eof_marker)
-			return 0;
+		}
 
-		emit_xlog_fixheader(&xhdr);
+		if (rc == 0 && input.pos == input.size)
+			return output.pos;
 
-		if (xhdr.magic == zrow_marker) {
-			ssize_t len = decompress(ctx->zdctx,
-						 buf, sizeof(buf),
-						 pos, xhdr.len);
-			if (len < 0)
+		if (output.pos == output.size) {
+			if (dctx_reserve(dctx, output.size + 1))
 				return -1;
-			rows = buf;
-			rows_end = buf + len;
-		} else if (xhdr.magic == row_marker) {
-			rows = pos;
-			rows_end = pos + xhdr.len;
-		} else {
-			pr_err("Unknown header magic: %#x\n", xhdr.magic);
+			output.dst = dctx->zbuf;
+			output.size = dctx->zbuf_size;
+		} else if (input.pos == input.size) {
+			pr_err("zstd: truncated frame\n");
 			return -1;
 		}
+	}
+}
 
-		do {
-			if (xrow_header_decode(&hdr, (const char **)&rows, rows_end, false))
-				return -1;
+/*
+ * Fetch the next block at @off. Returns 1 and the block
+ * payload in @data, 0 on eof marker or end of file and
+ * -1 on error. The payload is valid until the next
+ * reader access only.
+ */
+static int next_block(xlog_ctx_t *ctx, off_t *off,
+		      struct xlog_fixheader *xhdr, const char **data)
+{
+	size_t size, avail, hdr_len;
+	const char *pos;
 
-			emit_xlog_header(&hdr);
-			for (size_t i = 0; i < hdr.bodycnt; i++) {
-				emit_xlog_data(ctx, hdr.body[0].iov_base,
-					       hdr.body[0].iov_base + hdr.body[0].iov_len);
-			}
-		} while (rows < rows_end);
-		emit_hr();
+	if (*off >= (off_t)ctx->size)
+		return 0;
 
-		pos += xhdr.len;
+	pos = reader_peek(ctx->rd, *off, XLOG_FIXHEADER_SIZE, &avail);
+	if (!pos)
+		return -1;
+
+	size = avail;
+	if (parse_fixheader(xhdr, &pos, &size))
+		return -1;
+	else if (xhdr->magic == eof_marker)
+		return 0;
+
+	/*
+	 * Fetch the whole block, the fixheader
+	 * pointer is not valid after that.
+	 */
+	hdr_len = avail - size;
+	pos = reader_peek(ctx->rd, *off, hdr_len + xhdr->len, &avail);
+	if (!pos)
+		return -1;
+	if (avail < hdr_len + xhdr->len) {
+		pr_err("Truncated block at %lld (need %zu while %zu)\n",
+		       (long long)*off, hdr_len + xhdr->len, avail);
+		return -1;
 	}
 
-	return 0;
+	*data = pos + hdr_len;
+	*off += hdr_len + xhdr->len;
+	return 1;
 }
 
-static const char *get_meta_end(const char *addr, size_t size)
+/* Unlike parse_fixheader() this one is quiet about garbage */
+static bool fixheader_written(const char *pos)
 {
-	const char *end = memmem(addr, size, "\n\n", 2);
-	if (end == NULL) {
-		pr_err("No meta end found\n");
-		return NULL;
+	const char *end = pos + XLOG_FIXHEADER_SIZE;
+
+	pos += sizeof(log_magic_t);
+	for (int i = 0; i < 3; i++) {
+		if (mp_typeof(*pos) != MP_UINT || mp_check(&pos, end))
+			return false;
 	}
-	return end + 2;
+	if (pos == end)
+		return true;
+	return mp_typeof(*pos) == MP_STR && !mp_check(&pos, end) && pos == end;
 }
 
-static int parse_meta(xlog_ctx_t *ctx)
+/*
+ * Whether a block ending before @end starts at @off: the
+ * fixheader must be sane and the payload must match its
+ * checksum, marker bytes within a payload are not taken.
+ * When recovering the eof marker is taken at the end of
+ * the file and a zero checksum, one the writer has not
+ * maintained, is trusted.
+ */
+static int block_at(xlog_ctx_t *ctx, off_t off, off_t end, bool recover)
 {
-	const char *data = ctx->meta;
-	const char *end = ctx->meta_end;
-	ssize_t size = end - data - 1;
-	char *copy = malloc(size+1);
+	size_t avail, len;
+	const char *pos, *p;
+	uint64_t crc;
 
-	assert(size > 0);
-
-	if (!copy) {
-		pr_perror("Can't allocate meta");
+	pos = reader_peek(ctx->rd, off, XLOG_FIXHEADER_SIZE, &avail);
+	if (!pos)
 		return -1;
-	}
+	if (recover && avail == sizeof(log_magic_t) && end == (off_t)ctx->size)
+		return load_u32(pos) == eof_marker;
+	if (avail < XLOG_FIXHEADER_SIZE ||
+	    (load_u32(pos) != row_marker && load_u32(pos) != zrow_marker) ||
+	    !fixheader_written(pos))
+		return 0;
 
-	memcpy(copy, data, size);
-	copy[size] = '\0';
+	p = pos + sizeof(log_magic_t);
+	len = mp_decode_uint(&p);
+	mp_next(&p);
+	crc = mp_decode_uint(&p);
+	if (len > IPROTO_BODY_LEN_MAX ||
+	    (off_t)(XLOG_FIXHEADER_SIZE + len) > end - off)
+		return 0;
+	if (recover && !crc)
+		return 1;
 
-	for (char *tok = strtok(copy, "\n");
-	     tok; tok = strtok(NULL, "\n")) {
-		//pr_info("meta: '%s'\n", tok);
+	pos = reader_peek(ctx->rd, off, XLOG_FIXHEADER_SIZE + len, &avail);
+	if (!pos)
+		return -1;
+	return crc32c(0, pos + XLOG_FIXHEADER_SIZE, len) == crc;
+}
 
-		const char *pos = strchr(tok, ':');
+/* Find the first block starting in [@off, @end) */
+static int resync(xlog_ctx_t *ctx, off_t *off, off_t end, bool recover)
+{
+	off_t o = *off, at;
+	size_t avail, len;
+	const char *pos, *m;
+	int ret;
+
+	while (o < end) {
+		pos = reader_peek(ctx->rd, o, XLOG_RESYNC_WINDOW, &avail);
 		if (!pos)
-			continue;
+			return -1;
 
-		for (size_t i = 0; i < ARRAY_SIZE(meta_keys); i++) {
-			size_t key_len = strlen(meta_keys[i]);
-			if (!strncmp(tok, meta_keys[i], key_len)) {
-				size_t len = strlen(&pos[2]);
-				if (len > sizeof(ctx->meta_values[0])) {
-					pr_err("Too long meta value\n");
-					return -1;
-				}
+		len = avail;
+		if ((off_t)len > end - o)
+			len = end - o;
 
-				strcpy(ctx->meta_values[i], &pos[2]);
+		m = marker_find(pos, pos + len);
+		if (!m) {
+			/* A marker may straddle the window */
+			if (len <= 3)
 				break;
-			}
+			o += len - 3;
+			continue;
 		}
-	}
 
-	for (size_t i = 0; i < ARRAY_SIZE(meta_keys); i++) {
-		if (ctx->meta_values[i][0]) {
-			pr_info("meta: %-20s: '%s'\n", meta_keys[i],
-				ctx->meta_values[i]);
+		at = o + (m - pos);
+		ret = block_at(ctx, at, end, recover);
+		if (ret < 0)
+			return -1;
+		if (ret > 0) {
+			*off = at;
+			return 1;
 		}
+		o = at + 1;
 	}
+	return 0;
+}
 
-	free(copy);
+/* Get rows of a block decompressing them if needed */
+static int block_rows(struct xlog_dctx *dctx, const struct xlog_fixheader *xhdr,
+		      const char *pos, const char **rows, const char **rows_end)
+{
+	if (xhdr->magic == zrow_marker) {
+		ssize_t len = decompress(dctx, pos, xhdr->len);
+		if (len < 0)
+			return -1;
+		*rows = dctx->zbuf;
+		*rows_end = dctx->zbuf + len;
+	} else if (xhdr->magic == row_marker) {
+		*rows = pos;
+		*rows_end = pos + xhdr->len;
+	} else {
+		pr_err("Unknown header magic: %#x\n", xhdr->magic);
+		return -1;
+	}
 	return 0;
 }
 
-int parse_file(xlog_ctx_t *ctx)
+/* Check a decoded page of a vinyl run against its page info */
+static int check_page(xlog_ctx_t *ctx, const struct vy_page_info *page,
+		      const char *rows, const char *rows_end)
 {
-	if (ctx->size < sizeof(log_magic_t)) {
-		pr_err("The size is too small %zd\n", ctx->size);
+	uint64_t nr_rows = 0;
+	bool has_index = false;
+	struct xrow_header hdr;
+	const char *start = rows;
+
+	if ((uint64_t)(rows_end - rows) != page->unpacked_size) {
+		pr_err("%s: page at %llu: unpacked size %zu while %llu expected\n",
+		       ctx->path, (unsigned long long)page->offset,
+		       (size_t)(rows_end - rows),
+		       (unsigned long long)page->unpacked_size);
 		return -1;
 	}
 
-	for (int i = 0; i < (int)ARRAY_SIZE(wal_signatures); i++) {
-		int slen = strlen(wal_signatures[i]);
-		if (!strncmp(ctx->data, wal_signatures[i], slen)) {
-			ctx->file_type = i;
-			break;
-		}
+	while (rows < rows_end) {
+		if ((uint64_t)(rows - start) == page->row_index_offset)
+			has_index = true;
+		if (xrow_header_decode(&hdr, &rows, rows_end, false))
+			return -1;
+		if (hdr.type != VY_RUN_ROW_INDEX)
+			nr_rows++;
 	}
 
-	if (ctx->file_type == WAL_TYPE_MAX) {
-		pr_err("Signature mismatch\n");
+	if (nr_rows != page->row_count || !has_index) {
+		pr_err("%s: page at %llu: %llu rows and %s row index "
+		       "while %llu rows expected\n",
+		       ctx->path, (unsigned long long)page->offset,
+		       (unsigned long long)nr_rows, has_index ? "a" : "no",
+		       (unsigned long long)page->row_count);
 		return -1;
 	}
+	return 0;
+}
 
-	ctx->meta_end = get_meta_end(ctx->meta, ctx->size);
-	if (!ctx->meta_end)
-		return -1;
-	if (ctx->meta_end >= ctx->end) {
-		pr_err("No data without marker\n");
+/*
+ * Rows of a large compressed block are decoded as they come
+ * out of the zstd stream, the buffer of the dctx is used as
+ * a window which holds the row being decoded only.
+ */
+struct zrow_stream {
+	struct xlog_dctx	*dctx;
+	ZSTD_inBuffer		in;
+	/* Unconsumed data of the window */
+	size_t			pos;
+	size_t			len;
+	/* Zero once the frame is over */
+	size_t			rc;
+};
+
+static bool zrow_stream_wanted(const struct xlog_fixheader *xhdr, const char *pos)
+{
+	unsigned long long size = ZSTD_getFrameContentSize(pos, xhdr->len);
+
+	/* The size is not known to frames written by Tarantool */
+	if (size == ZSTD_CONTENTSIZE_UNKNOWN)
+		return true;
+	return size != ZSTD_CONTENTSIZE_ERROR && size >= XLOG_ZSTREAM_MIN;
+}
+
+static int zrow_stream_init(struct zrow_stream *zs, struct xlog_dctx *dctx,
+			    const char *src, size_t size)
+{
+	if (dctx_zdctx(dctx) || dctx_reserve(dctx, XLOG_ZBUF_SIZE_MIN))
 		return -1;
+	ZSTD_DCtx_reset(dctx->zdctx, ZSTD_reset_session_only);
+
+	zs->dctx = dctx;
+	zs->in.src = src;
+	zs->in.size = size;
+	zs->in.pos = 0;
+	zs->pos = 0;
+	zs->len = 0;
+	zs->rc = 1;
+	return 0;
+}
+
+static bool zrow_stream_over(const struct zrow_stream *zs)
+{
+	return zs->rc == 0 && zs->in.pos == zs->in.size;
+}
+
+/* Move the unconsumed data to the window start and decompress more */
+static int zrow_stream_fill(struct zrow_stream *zs)
+{
+	struct xlog_dctx *dctx = zs->dctx;
+	ZSTD_outBuffer out;
+
+	if (zs->pos) {
+		memmove(dctx->zbuf, dctx->zbuf + zs->pos, zs->len - zs->pos);
+		zs->len -= zs->pos;
+		zs->pos = 0;
 	}
 
-	if (parse_meta(ctx))
+	/* The window is full */
+	if (zs->len == dctx->zbuf_size && dctx_reserve(dctx, zs->len + 1))
 		return -1;
 
-	return parse_data(ctx);
+	out.dst = dctx->zbuf;
+	out.size = dctx->zbuf_size;
+	out.pos = zs->len;
+
+	zs->rc = ZSTD_decompressStream(dctx->zdctx, &out, &zs->in);
+	if (ZSTD_isError(zs->rc)) {
+		pr_err("zstd: decompression failed %s\n", ZSTD_getErrorName(zs->rc));
+		return -1;
+	}
+	if (out.pos == zs->len && zs->in.pos == zs->in.size && zs->rc) {
+		pr_err("zstd: truncated frame\n");
+		return -1;
+	}
+
+	zs->len = out.pos;
+	return 0;
+}
+
+/* Request type of a header which is known to be valid msgpack */
+static uint64_t xrow_peek_type(const char *pos)
+{
+	uint32_t size;
+
+	if (mp_typeof(*pos) != MP_MAP)
+		return 0;
+
+	size = mp_decode_map(&pos);
+	for (uint32_t i = 0; i < size; i++) {
+		if (mp_typeof(*pos) != MP_UINT) {
+			mp_next(&pos);
+		} else if (mp_decode_uint(&pos) == IPROTO_REQUEST_TYPE) {
+			if (mp_typeof(*pos) != MP_UINT)
+				return 0;
+			return mp_decode_uint(&pos);
+		}
+		mp_next(&pos);
+	}
+	return 0;
+}
+
+/*
+ * The end of the row at @pos, NULL if it's not complete
+ * yet. A body follows a header unless it's the end of the
+ * data or a NOP request, same as xrow_header_decode() has.
+ */
+static const char *xrow_frame(const char *pos, const char *end)
+{
+	const char *hdr = pos;
+
+	if (mp_check(&pos, end) || pos == end)
+		return NULL;
+	if (xrow_peek_type(hdr) == IPROTO_NOP)
+		return pos;
+	if (mp_check(&pos, end))
+		return NULL;
+	return pos;
+}
+
+/*
+ * Get the next rows of the stream, one framed row or all
+ * the rest once the stream is over. Returns 1 and the rows
+ * which are valid until the next call, 0 when the stream
+ * is over and -1 on error.
+ */
+static int zrow_stream_next(struct zrow_stream *zs, const char **rows,
+			    const char **rows_end)
+{
+	for (;;) {
+		const char *pos = zs->dctx->zbuf + zs->pos;
+		const char *end = zs->dctx->zbuf + zs->len;
+		bool last = zrow_stream_over(zs);
+		const char *next = NULL;
+
+		if (pos == end && last)
+			return 0;
+
+		/*
+		 * Small blocks are decompressed as a whole and not
+		 * framed, broken data is left to the decoder too.
+		 */
+		if (last)
+			next = end;
+		else if (zs->pos || zs->len >= XLOG_ZSTREAM_MIN)
+			next = pos < end ? xrow_frame(pos, end) : NULL;
+
+		if (next) {
+			*rows = pos;
+			*rows_end = next;
+			zs->pos = next - zs->dctx->zbuf;
+			return 1;
+		}
+
+		if (zrow_stream_fill(zs))
+			return -1;
+	}
+}
+
+static void emit_row(struct obuf *out, xlog_ctx_t *ctx,
+		     const struct xrow_header *hdr)
+{
+	ctx->em->row_header(out, ctx, hdr);
+	for (size_t i = 0; i < hdr->bodycnt; i++) {
+		ctx->em->body(out, ctx, hdr, hdr->body[0].iov_base,
+			      hdr->body[0].iov_base + hdr->body[0].iov_len);
+	}
+	ctx->em->end_row(out, ctx);
+}
+
+static void emit_tx(struct obuf *out, xlog_ctx_t *ctx, struct xtx *tx,
+		    int status)
+{
+	tx->status = status;
+	ctx->em->begin_tx(out, ctx, tx);
+	obuf_write(out, tx->out.buf, tx->out.len);
+	ctx->em->end_tx(out, ctx);
+}
+
+/*
+ * Rows are kept formatted until the commit row of their
+ * transaction. Transactions with no row passing the filter
+ * are not shown, yet the commit closes them anyway.
+ */
+static int decode_tx_row(struct obuf *out, xlog_ctx_t *ctx,
+			 const struct xrow_header *hdr, size_t size, bool shown)
+{
+	struct xtx_set *s = ctx->txs;
+	struct xtx *tx = xtx_find(s, hdr);
+	size_t was;
+
+	if (!tx && hdr->is_commit) {
+		struct xtx one;
+
+		/* Single statement ones are not buffered */
+		if (!shown)
+			return 0;
+		xtx_start(&one, hdr);
+		xtx_account(&one, hdr, size);
+		one.nr_shown = 1;
+		ctx->em->begin_tx(out, ctx, &one);
+		emit_row(out, ctx, hdr);
+		ctx->em->end_tx(out, ctx);
+		return 0;
+	}
+
+	if (!tx && !(tx = xtx_open(s, hdr)))
+		return -1;
+
+	xtx_account(tx, hdr, size);
+	if (shown) {
+		was = tx->out.size;
+		emit_row(&tx->out, ctx, hdr);
+		s->mem += tx->out.size - was;
+		tx->nr_shown++;
+		if (tx->out.error)
+			return -1;
+	}
+
+	if (hdr->is_commit) {
+		if (tx->nr_shown || tx->continued)
+			emit_tx(out, ctx, tx, XTX_COMMITTED);
+		xtx_close(s, tx);
+	}
+
+	/* The oldest transactions are shown as is to stay in bounds */
+	for (size_t i = 0; s->mem > XTX_MEM_MAX && i < s->nr; i++) {
+		if (!s->txs[i]->nr_shown)
+			continue;
+		emit_tx(out, ctx, s->txs[i], XTX_PARTIAL);
+		xtx_cut(s, s->txs[i]);
+	}
+	return 0;
+}
+
+/* Transactions left open by the end of the file */
+static void flush_txs(struct obuf *out, xlog_ctx_t *ctx)
+{
+	struct xtx_set *s = ctx->txs;
+
+	for (size_t i = 0; i < s->nr; i++) {
+		if (s->txs[i]->nr_shown || s->txs[i]->continued)
+			emit_tx(out, ctx, s->txs[i], XTX_UNFINISHED);
+	}
+}
+
+static int decode_row(struct obuf *out, xlog_ctx_t *ctx,
+		      const struct xlog_fixheader *xhdr, const char **rows,
+		      const char *rows_end, size_t *nr_rows)
+{
+	const char *row = *rows;
+	struct xrow_header hdr;
+	bool shown;
+
+	if (xrow_header_decode(&hdr, rows, rows_end, false))
+		return -1;
+
+	shown = !opts.filter.enabled ||
+		(filter_row(&opts.filter, &hdr) &&
+		 filter_row_space(&opts.filter, hdr.bodycnt ?
+				  hdr.body[0].iov_base : NULL, *rows));
+
+	/* Counters are there, decode_block() has made them */
+	if (opts.stats) {
+		stats_row(stats_get(), &hdr, *rows - row, shown);
+		return 0;
+	}
+	if (ctx->writer)
+		return writer_filter_row(ctx->writer, &hdr, shown);
+	if (ctx->txs)
+		return decode_tx_row(out, ctx, &hdr, *rows - row, shown);
+	if (!shown)
+		return 0;
+
+	/* Blocks without matching rows are not shown at all */
+	if (!(*nr_rows)++)
+		ctx->em->begin_block(out, ctx, xhdr);
+
+	emit_row(out, ctx, &hdr);
+	return 0;
+}
+
+static int decode_zrow_stream(struct obuf *out, xlog_ctx_t *ctx,
+			      struct xlog_dctx *dctx,
+			      const struct xlog_fixheader *xhdr, const char *pos)
+{
+	const char *rows, *rows_end;
+	struct zrow_stream zs;
+	size_t nr_rows = 0;
+	int ret;
+
+	if (zrow_stream_init(&zs, dctx, pos, xhdr->len))
+		return -1;
+
+	while ((ret = zrow_stream_next(&zs, &rows, &rows_end)) > 0) {
+		do {
+			if (decode_row(out, ctx, xhdr, &rows, rows_end, &nr_rows))
+				return -1;
+		} while (rows < rows_end);
+	}
+	if (nr_rows)
+		ctx->em->end_block(out, ctx);
+
+	return ret;
+}
+
+static int decode_block(struct obuf *out, xlog_ctx_t *ctx, struct xlog_dctx *dctx,
+			const struct xlog_fixheader *xhdr,
+			const struct vy_page_info *page, const char *pos)
+{
+	const char *rows, *rows_end;
+	size_t nr_rows = 0;
+
+	if (opts.stats) {
+		struct stats *st = stats_get();
+
+		if (!st)
+			return -1;
+		stats_block(st, xhdr->magic == zrow_marker, xhdr->len);
+	}
+
+	/* Pages are checked as a whole */
+	if (xhdr->magic == zrow_marker && !page && zrow_stream_wanted(xhdr, pos))
+		return decode_zrow_stream(out, ctx, dctx, xhdr, pos);
+
+	if (block_rows(dctx, xhdr, pos, &rows, &rows_end))
+		return -1;
+
+	if (page && check_page(ctx, page, rows, rows_end))
+		return -1;
+
+	do {
+		if (decode_row(out, ctx, xhdr, &rows, rows_end, &nr_rows))
+			return -1;
+	} while (rows < rows_end);
+	if (nr_rows)
+		ctx->em->end_block(out, ctx);
+
+	return 0;
+}
+
+/* Blocks to decode: a range of the file or pages of a vinyl run */
+struct xlog_iter {
+	off_t				off;
+	off_t				end;
+	const struct vy_page_info	*pages;
+	size_t				nr_pages;
+	size_t				page;
+};
+
+static int xlog_iter_next(xlog_ctx_t *ctx, struct xlog_iter *it,
+			  struct xlog_fixheader *xhdr, const char **data,
+			  const struct vy_page_info **page)
+{
+	const struct vy_page_info *p;
+	off_t off;
+	int ret;
+
+	*page = NULL;
+	if (!it->pages)
+		return it->off < it->end ? next_block(ctx, &it->off, xhdr, data) : 0;
+
+	if (it->page == it->nr_pages)
+		return 0;
+
+	p = &it->pages[it->page++];
+	off = p->offset;
+	ret = next_block(ctx, &off, xhdr, data);
+	if (ret == 0) {
+		pr_err("%s: no page at %llu\n", ctx->path,
+		       (unsigned long long)p->offset);
+		return -1;
+	} else if (ret > 0 && (uint64_t)(off - p->offset) != p->size) {
+		pr_err("%s: page at %llu: size %llu while %llu expected\n",
+		       ctx->path, (unsigned long long)p->offset,
+		       (unsigned long long)(off - p->offset),
+		       (unsigned long long)p->size);
+		return -1;
+	}
+
+	*page = p;
+	return ret;
+}
+
+static void summary_row(struct xlog_summary *sum, const struct xrow_header *hdr,
+			size_t size)
+{
+	if (!sum->rows || hdr->lsn < sum->min_lsn)
+		sum->min_lsn = hdr->lsn;
+	if (!sum->rows || hdr->lsn > sum->max_lsn)
+		sum->max_lsn = hdr->lsn;
+	if (hdr->tm > 0 && (!sum->min_tm || hdr->tm < sum->min_tm))
+		sum->min_tm = hdr->tm;
+	if (hdr->tm > sum->max_tm)
+		sum->max_tm = hdr->tm;
+	sum->rows++;
+	sum->bytes += size;
+}
+
+/* Count the rows of a block, nothing is formatted */
+static int summary_block(struct xlog_summary *sum, struct xlog_dctx *dctx,
+			 const struct xlog_fixheader *xhdr, const char *data)
+{
+	const char *rows, *rows_end, *row;
+	struct xrow_header hdr;
+
+	sum->blocks++;
+	sum->disk_bytes += xhdr->len;
+	if (xhdr->magic == zrow_marker)
+		sum->zblocks++;
+
+	if (block_rows(dctx, xhdr, data, &rows, &rows_end))
+		return -1;
+
+	while (rows < rows_end) {
+		row = rows;
+		if (xrow_header_scan(&hdr, &rows, rows_end))
+			return -1;
+		if (opts.filter.enabled &&
+		    (!filter_row(&opts.filter, &hdr) ||
+		     !filter_row_space(&opts.filter, hdr.bodycnt ?
+				       hdr.body[0].iov_base : NULL, rows)))
+			continue;
+		summary_row(sum, &hdr, rows - row);
+	}
+	return 0;
+}
+
+static void summary_merge(struct xlog_summary *dst, const struct xlog_summary *src)
+{
+	if (!src->rows) {
+		dst->blocks += src->blocks;
+		dst->zblocks += src->zblocks;
+		dst->disk_bytes += src->disk_bytes;
+		return;
+	}
+
+	if (!dst->rows || src->min_lsn < dst->min_lsn)
+		dst->min_lsn = src->min_lsn;
+	if (!dst->rows || src->max_lsn > dst->max_lsn)
+		dst->max_lsn = src->max_lsn;
+	if (src->min_tm > 0 && (!dst->min_tm || src->min_tm < dst->min_tm))
+		dst->min_tm = src->min_tm;
+	if (src->max_tm > dst->max_tm)
+		dst->max_tm = src->max_tm;
+	dst->blocks += src->blocks;
+	dst->zblocks += src->zblocks;
+	dst->disk_bytes += src->disk_bytes;
+	dst->rows += src->rows;
+	dst->bytes += src->bytes;
+}
+
+struct xlog_block {
+	struct xlog_fixheader	xhdr;
+	const struct vy_page_info *page;
+	char			*data;
+	size_t			data_size;
+	struct obuf		out;
+	int			rc;
+};
+
+struct xlog_pool_arg {
+	xlog_ctx_t		*ctx;
+	struct xlog_dctx	*dctx;
+	struct xlog_summary	*sums;
+};
+
+static void xlog_block_work(void *item, int worker, void *arg)
+{
+	struct xlog_pool_arg *pa = arg;
+	struct xlog_block *b = item;
+
+	if (!b->out.buf && obuf_init(&b->out, -1, XLOG_BLOCK_OBUF_SIZE)) {
+		b->rc = -1;
+		return;
+	}
+
+	b->out.len = 0;
+	if (pa->sums)
+		b->rc = summary_block(&pa->sums[worker], &pa->dctx[worker],
+				      &b->xhdr, b->data);
+	else
+		b->rc = decode_block(&b->out, pa->ctx, &pa->dctx[worker],
+				     &b->xhdr, b->page, b->data);
+	if (b->out.error)
+		b->rc = -1;
+}
+
+static int xlog_block_done(void *item, void *arg)
+{
+	struct xlog_pool_arg *pa = arg;
+	struct xlog_block *b = item;
+
+	obuf_write(pa->ctx->out, b->out.buf, b->out.len);
+	return b->rc;
+}
+
+static void xlog_block_free(void *item)
+{
+	struct xlog_block *b = item;
+
+	free(b->data);
+	obuf_fini(&b->out);
+}
+
+/*
+ * Blocks are read sequentially and handed to the
+ * worker threads which decompress, decode and format
+ * them, the output is flushed in the file order. With
+ * @sum the workers only summarize the rows.
+ */
+static int parse_data_parallel(xlog_ctx_t *ctx, struct xlog_iter *it,
+			       int nr_workers, struct xlog_summary *sum)
+{
+	struct xlog_pool_arg pa = { .ctx = ctx, };
+	const struct vy_page_info *page;
+	struct xlog_fixheader xhdr;
+	struct pool *pool;
+	const char *data;
+	int ret = -1;
+
+	pa.dctx = calloc(nr_workers, sizeof(pa.dctx[0]));
+	if (!pa.dctx) {
+		pr_perror("Can't allocate decompression contexts");
+		return -1;
+	}
+
+	for (int i = 0; i < nr_workers; i++)
+		xlog_dctx_create(&pa.dctx[i]);
+
+	if (sum) {
+		pa.sums = calloc(nr_workers, sizeof(pa.sums[0]));
+		if (!pa.sums) {
+			pr_perror("Can't allocate summaries");
+			goto out;
+		}
+	}
+
+	pool = pool_create(nr_workers, nr_workers * 4, sizeof(struct xlog_block),
+			   xlog_block_work, xlog_block_done, &pa);
+	if (!pool)
+		goto out;
+
+	while ((ret = xlog_iter_next(ctx, it, &xhdr, &data, &page)) > 0) {
+		struct xlog_block *b = pool_next(pool);
+		if (!b)
+			break;
+
+		if (xhdr.len > b->data_size) {
+			char *buf = realloc(b->data, xhdr.len);
+			if (!buf) {
+				pr_perror("Can't allocate block");
+				ret = -1;
+				break;
+			}
+			b->data = buf;
+			b->data_size = xhdr.len;
+		}
+
+		memcpy(b->data, data, xhdr.len);
+		b->xhdr = xhdr;
+		b->page = page;
+		pool_submit(pool);
+	}
+
+	if (pool_wait(pool))
+		ret = -1;
+	pool_for_each_item(pool, xlog_block_free);
+	pool_destroy(pool);
+out:
+	for (int i = 0; i < nr_workers; i++) {
+		if (pa.sums)
+			summary_merge(sum, &pa.sums[i]);
+		xlog_dctx_destroy(&pa.dctx[i]);
+	}
+	free(pa.sums);
+	free(pa.dctx);
+	return ret;
+}
+
+/* Whether every row of a block decodes, nothing is shown */
+static int check_block(struct xlog_dctx *dctx, const struct xlog_fixheader *xhdr,
+		       const char *data)
+{
+	const char *rows, *rows_end;
+	struct xrow_header hdr;
+
+	if (block_rows(dctx, xhdr, data, &rows, &rows_end))
+		return -1;
+
+	while (rows < rows_end) {
+		if (xrow_header_decode(&hdr, &rows, rows_end, false))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Decode what is left of a damaged file: a block which
+ * can't be read or decoded is skipped up to the next one
+ * found by its marker. Blocks are checked before any row
+ * is shown, written or counted, so a block is either kept
+ * or skipped as a whole. Returns 1 if anything is skipped.
+ */
+static int recover_data(xlog_ctx_t *ctx, struct xlog_iter *it,
+			struct xlog_summary *sum)
+{
+	unsigned long long nr_bytes = 0, nr_ranges = 0;
+	struct xlog_fixheader xhdr;
+	struct xlog_summary bsum;
+	const char *data;
+	char msg[128];
+	off_t off;
+	int ret;
+
+	while (it->off < it->end) {
+		off = it->off;
+		ret = next_block(ctx, &it->off, &xhdr, &data);
+		if (ret == 0)
+			break;
+		if (ret > 0)
+			ret = check_block(&ctx->dctx, &xhdr, data);
+		if (ret == 0 && sum) {
+			/* Rows of a block skipped are not counted */
+			memset(&bsum, 0, sizeof(bsum));
+			ret = summary_block(&bsum, &ctx->dctx, &xhdr, data);
+			if (!ret) {
+				summary_merge(sum, &bsum);
+				continue;
+			}
+		} else if (ret == 0) {
+			ret = decode_block(ctx->out, ctx, &ctx->dctx, &xhdr,
+					   NULL, data);
+			if (!ret)
+				continue;
+		}
+
+		it->off = off + 1;
+		ret = resync(ctx, &it->off, it->end, true);
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			it->off = it->end;
+
+		snprintf(msg, sizeof(msg), "skipped %lld bytes at %lld",
+			 (long long)(it->off - off), (long long)off);
+		ctx->em->notice(ctx->out, ctx, msg);
+		nr_bytes += it->off - off;
+		nr_ranges++;
+	}
+
+	if (!nr_ranges)
+		return 0;
+	pr_err("%s: %llu bytes skipped in %llu ranges\n",
+	       ctx->path, nr_bytes, nr_ranges);
+	return 1;
+}
+
+static int summary_data(xlog_ctx_t *ctx, struct xlog_iter *it)
+{
+	const struct vy_page_info *page;
+	struct xlog_summary sum = { };
+	struct xlog_fixheader xhdr;
+	const char *data;
+	int ret;
+
+	if (opts.recover) {
+		ret = recover_data(ctx, it, &sum);
+	} else if (ctx->jobs > 1) {
+		ret = parse_data_parallel(ctx, it, ctx->jobs, &sum);
+	} else {
+		while ((ret = xlog_iter_next(ctx, it, &xhdr, &data, &page)) > 0) {
+			if (summary_block(&sum, &ctx->dctx, &xhdr, data)) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if (ret >= 0)
+		ctx->em->summary(ctx->out, ctx, &sum);
+	return ret;
+}
+
+/*
+ * Check crc32c of every block payload and the crc32p chain,
+ * the latter is zero when not maintained by the writer.
+ */
+static int verify_data(xlog_ctx_t *ctx)
+{
+	struct xlog_fixheader xhdr;
+	off_t off = ctx->data_off, prev_off = 0;
+	unsigned long nr_blocks = 0, nr_bad = 0;
+	uint32_t prev_crc32c = 0;
+	const char *data;
+	int ret;
+
+	for (;;) {
+		off_t block_off = off;
+
+		ret = next_block(ctx, &off, &xhdr, &data);
+		if (ret <= 0)
+			break;
+		nr_blocks++;
+
+		uint32_t crc = crc32c(0, data, xhdr.len);
+		if (crc != xhdr.crc32c) {
+			obuf_printf(ctx->out, "%s: block at %lld: crc32c mismatch %#x (expected %#x)\n",
+				    ctx->path, (long long)block_off, crc, xhdr.crc32c);
+			nr_bad++;
+		}
+
+		if (xhdr.crc32p && nr_blocks > 1 && xhdr.crc32p != prev_crc32c) {
+			obuf_printf(ctx->out, "%s: block at %lld: crc32p %#x doesn't match "
+				    "crc32c %#x of block at %lld\n",
+				    ctx->path, (long long)block_off, xhdr.crc32p,
+				    prev_crc32c, (long long)prev_off);
+			nr_bad++;
+		}
+
+		prev_crc32c = xhdr.crc32c;
+		prev_off = block_off;
+	}
+
+	obuf_printf(ctx->out, "%s: %lu blocks verified, %lu mismatches\n",
+		    ctx->path, nr_blocks, nr_bad);
+	if (ret < 0)
+		return -1;
+	return nr_bad ? -1 : 0;
+}
+
+/* Summarize every block of the file for the index */
+static int build_index(xlog_ctx_t *ctx, struct xindex *idx)
+{
+	struct xlog_fixheader xhdr;
+	off_t off = ctx->data_off;
+	const char *data;
+	int ret;
+
+	for (;;) {
+		struct xindex_entry e = {
+			.off		= off,
+			.min_lsn	= INT64_MAX,
+			.max_lsn	= INT64_MIN,
+			.min_tm		= INFINITY,
+			.max_tm		= -INFINITY,
+		};
+		const char *rows, *rows_end;
+		struct xrow_header hdr;
+
+		ret = next_block(ctx, &off, &xhdr, &data);
+		if (ret <= 0)
+			break;
+
+		if (block_rows(&ctx->dctx, &xhdr, data, &rows, &rows_end))
+			return -1;
+
+		e.len = xhdr.len;
+		e.raw_len = rows_end - rows;
+		while (rows < rows_end) {
+			if (xrow_header_decode(&hdr, &rows, rows_end, false))
+				return -1;
+			if (hdr.lsn < e.min_lsn)
+				e.min_lsn = hdr.lsn;
+			if (hdr.lsn > e.max_lsn)
+				e.max_lsn = hdr.lsn;
+			if (hdr.tm < e.min_tm)
+				e.min_tm = hdr.tm;
+			if (hdr.tm > e.max_tm)
+				e.max_tm = hdr.tm;
+			e.nr_rows++;
+		}
+
+		if (xindex_add(idx, &e))
+			return -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Narrow [@off, @end) down to the blocks which may
+ * have rows within the LSN and time bounds of the
+ * filter, the index is built on the first use.
+ */
+static int seek_index(xlog_ctx_t *ctx, off_t *off, off_t *end)
+{
+	struct xindex idx;
+	size_t first, last;
+	int ret;
+
+	if (xindex_open(&idx, ctx->path, ctx->rd->fd,
+			ctx->data_off, opts.index_dir))
+		return -1;
+
+	ret = xindex_load(&idx);
+	if (ret > 0) {
+		ret = build_index(ctx, &idx);
+		if (!ret && xindex_save(&idx)) {
+			pr_err("Index is not saved, using it for this run only\n");
+			if (!idx.bounds)
+				ret = -1;
+		}
+	}
+
+	if (!ret) {
+		xindex_range(&idx, &opts.filter, &first, &last);
+		if (last < idx.nr)
+			*end = idx.entries[last].off;
+		*off = first < idx.nr ? (off_t)idx.entries[first].off : *end;
+	}
+
+	xindex_close(&idx);
+	return ret;
+}
+
+/* Call @cb for every row of the file */
+static int scan_rows(xlog_ctx_t *ctx, xlog_row_cb cb, void *arg)
+{
+	const char *data, *rows, *rows_end;
+	struct xlog_fixheader xhdr;
+	struct xrow_header hdr;
+	off_t off = ctx->data_off;
+	int ret;
+
+	while ((ret = next_block(ctx, &off, &xhdr, &data)) > 0) {
+		if (block_rows(&ctx->dctx, &xhdr, data, &rows, &rows_end))
+			return -1;
+
+		while (rows < rows_end) {
+			if (xrow_header_decode(&hdr, &rows, rows_end, false) ||
+			    cb(&hdr, arg))
+				return -1;
+		}
+	}
+	return ret;
+}
+
+static int replay_vylog_row(const struct xrow_header *hdr, void *arg)
+{
+	struct vy_log_record rec;
+
+	if (!hdr->bodycnt) {
+		pr_err("vylog record without body\n");
+		return -1;
+	}
+
+	if (vy_log_record_decode(&rec, hdr->body[0].iov_base))
+		return -1;
+	return vy_recovery_process(arg, &rec);
+}
+
+/* Replay the vylog and show what vinyl would recover */
+static int parse_vylog_layout(xlog_ctx_t *ctx)
+{
+	struct vy_recovery r;
+	struct vy_layout l;
+	int ret;
+
+	vy_recovery_init(&r);
+	ret = scan_rows(ctx, replay_vylog_row, &r);
+	if (!ret && vy_layout_create(&l, &r))
+		ret = -1;
+	if (!ret) {
+		ctx->em->layout(ctx->out, ctx, &l);
+		vy_layout_destroy(&l);
+		if (r.nr_errors)
+			ret = -1;
+	}
+	vy_recovery_fini(&r);
+	return ret;
+}
+
+/*
+ * Without an index xlogs are bisected on the keys of the
+ * blocks met at arbitrary offsets, which takes them to
+ * grow along the file. Times do, LSNs do for the rows of
+ * one replica only, so LSN bounds are used when --replica
+ * leaves a single one, and probes skip blocks without its
+ * rows. The probes are checked against each other, the
+ * file is scanned as a whole if they don't agree.
+ */
+enum {
+	/** Probes kept to be checked, two bisections of 2^63 */
+	BISECT_PROBES_MAX	= 128,
+};
+
+/* Keys of blocks probed and where the next one starts */
+struct bisect_probe {
+	off_t		off;
+	off_t		next;
+	/** No rows of the replica up to the end of the range */
+	bool		empty;
+	int64_t		min_lsn;
+	int64_t		max_lsn;
+	double		min_tm;
+	double		max_tm;
+};
+
+struct bisect {
+	/** Whether LSN bounds are used, for rows of this replica */
+	bool			lsn;
+	uint32_t		replica_id;
+	struct bisect_probe	probes[BISECT_PROBES_MAX];
+	size_t			nr_probes;
+};
+
+/* Keys of the block at @off, or of the first one having rows to compare */
+static int bisect_probe(xlog_ctx_t *ctx, struct bisect *b, off_t off,
+			off_t end, struct bisect_probe *p)
+{
+	const char *data, *rows, *rows_end;
+	struct xlog_fixheader xhdr;
+	struct xrow_header hdr;
+	int ret;
+
+	p->empty = true;
+	p->min_lsn = INT64_MAX;
+	p->max_lsn = INT64_MIN;
+	p->min_tm = INFINITY;
+	p->max_tm = -INFINITY;
+
+	while (p->empty && off < end) {
+		ret = next_block(ctx, &off, &xhdr, &data);
+		if (ret <= 0) {
+			if (ret < 0)
+				return -1;
+			break;
+		}
+		if (block_rows(&ctx->dctx, &xhdr, data, &rows, &rows_end))
+			return -1;
+
+		while (rows < rows_end) {
+			if (xrow_header_scan(&hdr, &rows, rows_end))
+				return -1;
+
+			if (hdr.tm < p->min_tm)
+				p->min_tm = hdr.tm;
+			if (hdr.tm > p->max_tm)
+				p->max_tm = hdr.tm;
+			if (b->lsn && hdr.replica_id != b->replica_id)
+				continue;
+
+			p->empty = false;
+			if (hdr.lsn < p->min_lsn)
+				p->min_lsn = hdr.lsn;
+			if (hdr.lsn > p->max_lsn)
+				p->max_lsn = hdr.lsn;
+		}
+	}
+
+	p->off = off;
+	p->next = off;
+	if (!p->empty && b->nr_probes < BISECT_PROBES_MAX)
+		b->probes[b->nr_probes++] = *p;
+	return 0;
+}
+
+/* Whether LSNs or times of the blocks probed grow along the file */
+static bool bisect_sorted(const struct bisect *b, bool lsn)
+{
+	for (size_t i = 0; i < b->nr_probes; i++) {
+		const struct bisect_probe *x = &b->probes[i];
+
+		for (size_t j = 0; j < b->nr_probes; j++) {
+			const struct bisect_probe *y = &b->probes[j];
+
+			if (x->off >= y->off)
+				continue;
+			if (lsn ? x->max_lsn > y->min_lsn : x->max_tm > y->min_tm)
+				return false;
+		}
+	}
+	return true;
+}
+
+static int bisect_range(xlog_ctx_t *ctx, struct bisect *b,
+			off_t *off, off_t *end)
+{
+	const struct filter *f = &opts.filter;
+	int64_t from_lsn = b->lsn ? f->from_lsn : INT64_MIN;
+	int64_t to_lsn = b->lsn ? f->to_lsn : INT64_MAX;
+	struct bisect_probe p;
+	off_t lo, hi, at;
+	int ret;
+
+	/* The first block having rows at or past the lower bounds */
+	lo = *off;
+	hi = *end;
+	while (lo < hi && (from_lsn != INT64_MIN || f->from_tm != -INFINITY)) {
+		at = lo + (hi - lo) / 2;
+		ret = resync(ctx, &at, hi, false);
+		if (ret <= 0) {
+			if (ret < 0)
+				return -1;
+			break;
+		}
+		if (bisect_probe(ctx, b, at, hi, &p))
+			return -1;
+		if (p.empty)
+			hi = at;
+		else if (p.max_lsn < from_lsn || p.max_tm < f->from_tm)
+			lo = p.next;
+		else
+			hi = at;
+	}
+	*off = lo;
+
+	/* The first block having rows past the upper bounds only */
+	hi = *end;
+	while (lo < hi && (to_lsn != INT64_MAX || f->to_tm != INFINITY)) {
+		at = lo + (hi - lo) / 2;
+		ret = resync(ctx, &at, hi, false);
+		if (ret <= 0) {
+			if (ret < 0)
+				return -1;
+			break;
+		}
+		if (bisect_probe(ctx, b, at, hi, &p))
+			return -1;
+		if (p.empty || p.min_lsn > to_lsn || p.min_tm > f->to_tm)
+			hi = at;
+		else
+			lo = p.next;
+	}
+	*end = hi;
+	return 0;
+}
+
+/*
+ * Narrow [@off, @end) down to the blocks which may have
+ * rows within the LSN and time bounds of the filter.
+ */
+static int seek_bisect(xlog_ctx_t *ctx, off_t *off, off_t *end)
+{
+	const struct filter *f = &opts.filter;
+	bool tm = f->from_tm != -INFINITY || f->to_tm != INFINITY;
+	bool lsn = (f->from_lsn != INT64_MIN || f->to_lsn != INT64_MAX) &&
+		   f->replica_ids.nr == 1;
+	size_t bufsize = ctx->rd->bufsize;
+	struct bisect *b;
+	off_t o = *off, e = *end;
+	int ret;
+
+	/* LSNs of several replicas interleave, these are scanned through */
+	if (!lsn && !tm)
+		return 0;
+
+	b = calloc(1, sizeof(*b));
+	if (!b) {
+		pr_perror("Can't allocate bisection");
+		return -1;
+	}
+	b->lsn = lsn;
+	if (lsn)
+		b->replica_id = f->replica_ids.ids[0];
+
+	/* Probes are far apart, don't fill a whole buffer for each */
+	ctx->rd->bufsize = XLOG_RESYNC_WINDOW;
+	ret = bisect_range(ctx, b, &o, &e);
+	ctx->rd->bufsize = bufsize;
+
+	if (!ret && ((tm && !bisect_sorted(b, false)) ||
+		     (lsn && !bisect_sorted(b, true)))) {
+		o = *off;
+		e = *end;
+	}
+	free(b);
+
+	if (ret)
+		return -1;
+	*off = o;
+	*end = e;
+	return 0;
+}
+
+/*
+ * Whether a live xlog has a complete block or the eof marker
+ * at @off. The writer may be in the middle of a block and the
+ * space past the data may be preallocated and zeroed, so a
+ * block is taken once its checksum matches.
+ */
+static int tail_ready(xlog_ctx_t *ctx, off_t off)
+{
+	struct xlog_fixheader xhdr;
+	size_t avail, size;
+	const char *pos;
+
+	if (off >= (off_t)ctx->size)
+		return 0;
+
+	pos = reader_peek(ctx->rd, off, XLOG_FIXHEADER_SIZE, &avail);
+	if (!pos)
+		return -1;
+	if (avail < sizeof(log_magic_t) || load_u32(pos) == 0)
+		return 0;
+	if (load_u32(pos) == eof_marker)
+		return 1;
+	if (avail < XLOG_FIXHEADER_SIZE || !fixheader_written(pos))
+		return 0;
+
+	size = avail;
+	if (parse_fixheader(&xhdr, &pos, &size))
+		return -1;
+
+	size = avail - size + xhdr.len;
+	pos = reader_peek(ctx->rd, off, size, &avail);
+	if (!pos)
+		return -1;
+	if (avail < size)
+		return 0;
+
+	return crc32c(0, pos + size - xhdr.len, xhdr.len) == xhdr.crc32c;
+}
+
+/*
+ * Decode blocks as they are written until the eof marker,
+ * or until the next xlog appears while this one stays as
+ * is, which happens when the writer is restarted.
+ */
+static int follow_data(xlog_ctx_t *ctx, struct xlog_iter *it)
+{
+	const struct vy_page_info *page;
+	struct xlog_fixheader xhdr;
+	bool has_next = false;
+	const char *data;
+	int ret;
+
+	for (;;) {
+		ret = tail_ready(ctx, it->off);
+		if (ret < 0)
+			return -1;
+		if (ret > 0) {
+			ret = xlog_iter_next(ctx, it, &xhdr, &data, &page);
+			if (ret <= 0)
+				return ret;
+			if (decode_block(ctx->out, ctx, &ctx->dctx, &xhdr, page, data))
+				return -1;
+			continue;
+		}
+
+		if (has_next) {
+			pr_err("%s: no eof marker at %lld, going to the next xlog\n",
+			       ctx->path, (long long)it->off);
+			return 0;
+		}
+
+		ret = follow_next(ctx->follow, NULL);
+		if (ret < 0)
+			return -1;
+		has_next = ret > 0;
+
+		if (!has_next) {
+			if (obuf_flush(ctx->out) || follow_wait(ctx->follow))
+				return -1;
+		}
+
+		if (reader_update(ctx->rd))
+			return -1;
+		ctx->size = ctx->rd->size;
+		it->end = ctx->size;
+	}
+}
+
+static int parse_data(xlog_ctx_t *ctx)
+{
+	struct xlog_iter it = {
+		.off	= ctx->data_off,
+		.end	= ctx->size,
+	};
+	const struct vy_page_info *page;
+	struct xlog_fixheader xhdr;
+	struct vy_run_pages rp;
+	struct xtx_set txs;
+	const char *data;
+	int ret;
+
+	if (opts.verify)
+		return verify_data(ctx);
+
+	if (opts.layout) {
+		if (ctx->file_type != WAL_TYPE_VY_XLOG) {
+			pr_err("%s: layout is replayed from vylog files only\n",
+			       ctx->path);
+			return -1;
+		}
+		return parse_vylog_layout(ctx);
+	}
+
+	/*
+	 * Pages of a run are taken from its index if there
+	 * is one, they are checked against the page info.
+	 * A damaged run is read block by block instead.
+	 */
+	if (ctx->file_type == WAL_TYPE_VY_RUN && !opts.recover) {
+		ret = vy_run_pages_load(&rp, ctx->path);
+		if (ret < 0)
+			return -1;
+		if (ret == 0) {
+			it.pages = rp.pages;
+			it.nr_pages = rp.nr;
+		}
+	}
+
+	if (!it.pages && !ctx->follow && filter_has_bounds(&opts.filter)) {
+		if (opts.index)
+			ret = seek_index(ctx, &it.off, &it.end);
+		else if (ctx->file_type == WAL_TYPE_XLOG)
+			ret = seek_bisect(ctx, &it.off, &it.end);
+		else
+			ret = 0;
+		if (ret)
+			return -1;
+	}
+
+	/* Transactions span blocks, these are decoded in order */
+	if (opts.tx) {
+		xtx_set_init(&txs);
+		ctx->txs = &txs;
+	}
+
+	if (opts.summary) {
+		ret = summary_data(ctx, &it);
+	} else if (opts.recover) {
+		ret = recover_data(ctx, &it, NULL);
+	} else if (ctx->follow) {
+		ret = follow_data(ctx, &it);
+	} else if (ctx->jobs > 1 && !ctx->txs) {
+		ret = parse_data_parallel(ctx, &it, ctx->jobs, NULL);
+	} else {
+		while ((ret = xlog_iter_next(ctx, &it, &xhdr, &data, &page)) > 0) {
+			if (decode_block(ctx->out, ctx, &ctx->dctx, &xhdr, page, data)) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if (ctx->txs) {
+		if (ret >= 0)
+			flush_txs(ctx->out, ctx);
+		xtx_set_fini(&txs);
+		ctx->txs = NULL;
+	}
+
+	if (it.pages)
+		vy_run_pages_fini(&rp);
+	return ret ? -1 : 0;
+}
+
+static const char *get_meta_end(const char *addr, size_t size)
+{
+	const char *end = memmem(addr, size, "\n\n", 2);
+	if (end == NULL) {
+		pr_err("No meta end found\n");
+		return NULL;
+	}
+	return end + 2;
+}
+
+static int parse_meta(xlog_ctx_t *ctx, const char *data, const char *end)
+{
+	ssize_t size = end - data - 1;
+	char *copy = malloc(size+1);
+	char *saveptr;
+
+	assert(size > 0);
+
+	if (!copy) {
+		pr_perror("Can't allocate meta");
+		return -1;
+	}
+
+	memcpy(copy, data, size);
+	copy[size] = '\0';
+
+	for (char *tok = strtok_r(copy, "\n", &saveptr);
+	     tok; tok = strtok_r(NULL, "\n", &saveptr)) {
+		//pr_info("meta: '%s'\n", tok);
+
+		const char *pos = strchr(tok, ':');
+		if (!pos)
+			continue;
+
+		for (size_t i = 0; i < ARRAY_SIZE(xlog_meta_keys); i++) {
+			size_t key_len = strlen(xlog_meta_keys[i]);
+			if (!strncmp(tok, xlog_meta_keys[i], key_len)) {
+				size_t len = strlen(&pos[2]);
+				if (len > sizeof(ctx->meta_values[0])) {
+					pr_err("Too long meta value\n");
+					return -1;
+				}
+
+				strcpy(ctx->meta_values[i], &pos[2]);
+				break;
+			}
+		}
+	}
+
+	free(copy);
+	return 0;
+}
+
+/* Check the signature and read meta, data follows it */
+int parse_header(xlog_ctx_t *ctx)
+{
+	const char *meta, *meta_end;
+	size_t avail;
+
+	if (ctx->size < sizeof(log_magic_t)) {
+		pr_err("The size is too small %zd\n", ctx->size);
+		return -1;
+	}
+
+	meta = reader_peek(ctx->rd, 0, XLOG_META_LEN_MAX, &avail);
+	if (!meta)
+		return -1;
+
+	for (int i = 0; i < (int)ARRAY_SIZE(wal_signatures); i++) {
+		int slen = strlen(wal_signatures[i]);
+		if (!strncmp(meta, wal_signatures[i], slen)) {
+			ctx->file_type = i;
+			break;
+		}
+	}
+
+	if (ctx->file_type == WAL_TYPE_MAX) {
+		pr_err("Signature mismatch\n");
+		return -1;
+	}
+
+	meta_end = get_meta_end(meta, avail);
+	if (!meta_end)
+		return -1;
+	/* A live xlog has no blocks until the first write */
+	if (meta_end >= meta + ctx->size && !ctx->follow) {
+		pr_err("No data without marker\n");
+		return -1;
+	}
+
+	if (parse_meta(ctx, meta, meta_end))
+		return -1;
+
+	ctx->data_off = meta_end - meta;
+	return 0;
+}
+
+int parse_file(xlog_ctx_t *ctx)
+{
+	if (parse_header(ctx))
+		return -1;
+
+	if (opts.stats) {
+		struct stats *st = stats_get();
+
+		if (!st)
+			return -1;
+		stats_file(st);
+	} else if (!opts.summary && !ctx->writer)
+		ctx->em->meta(ctx->out, ctx);
+	return parse_data(ctx);
+}
+
+/*
+ * Call @cb for every row of a file of @file_type,
+ * for service files like a vinyl .index.
+ */
+int xlog_scan(const char *path, int file_type, xlog_row_cb cb, void *arg)
+{
+	struct reader rd;
+	xlog_ctx_t ctx;
+	int ret = -1;
+
+	if (reader_open(&rd, path, opts.reader, opts.bufsize))
+		return -1;
+
+	xlog_ctx_create(&ctx);
+	ctx.path = path;
+	ctx.rd = &rd;
+	ctx.size = rd.size;
+
+	if (parse_header(&ctx))
+		goto out;
+
+	if (ctx.file_type != file_type) {
+		pr_err("%s: unexpected file type\n", path);
+		goto out;
+	}
+
+	ret = scan_rows(&ctx, cb, arg);
+out:
+	xlog_ctx_destroy(&ctx);
+	reader_close(&rd);
+	return ret;
 }
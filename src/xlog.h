@@ -9,9 +9,26 @@
 #include <zstd.h>
 
 #include "constants.h"
+#include "reader.h"
+#include "obuf.h"
 
 typedef uint32_t log_magic_t;
 
+enum {
+	/** Maximal length of a text meta header */
+	XLOG_META_LEN_MAX	= 16384,
+	/** Initial size of a per block output buffer */
+	XLOG_BLOCK_OBUF_SIZE	= 64u << 10,
+	/** Initial size of a decompression buffer */
+	XLOG_ZBUF_SIZE_MIN	= 64u << 10,
+	/** Blocks of this decompressed size and more are streamed */
+	XLOG_ZSTREAM_MIN	= 1u << 20,
+	/** Number of decompression contexts kept for reuse */
+	XLOG_DCTX_CACHE_MAX	= 64,
+	/** Bytes scanned at once looking for a block marker */
+	XLOG_RESYNC_WINDOW	= 64u << 10,
+};
+
 enum {
 	XLOG_META_INSTANCE_UUID_KEY,
 	XLOG_META_INSTANCE_INSTANCE_UUID_KEY_V12,
@@ -22,33 +39,56 @@ enum {
 	XLOG_META_MAX,
 };
 
-typedef struct {
+/*
+ * Decompression state, one per decoding thread. Both the
+ * context and the buffer are allocated on the first use,
+ * the buffer is as large as the largest block seen.
+ */
+struct xlog_dctx {
 	ZSTD_DCtx	*zdctx;
+	char		*zbuf;
+	size_t		zbuf_size;
+};
+
+extern void xlog_dctx_create(struct xlog_dctx *dctx);
+extern void xlog_dctx_destroy(struct xlog_dctx *dctx);
+extern void xlog_dctx_cache_fini(void);
+
+struct emitter;
+struct follow;
+struct xtx_set;
+struct writer;
+
+typedef struct {
+	struct xlog_dctx dctx;
+	const struct emitter *em;
 
 	char		meta_values[XLOG_META_MAX][128];
 
 	const char	*path;
-	const char	*data;
-	const char	*end;
+	struct reader	*rd;
+	struct obuf	*out;
 	size_t		size;
 
-	const char	*meta;
-	const char	*meta_end;
+	off_t		data_off;
 	int		file_type;
+	int		jobs;
+	struct follow	*follow;
+	struct xtx_set	*txs;
+	struct writer	*writer;
 } xlog_ctx_t;
 
 static inline void xlog_ctx_create(xlog_ctx_t *ctx)
 {
 	memset(ctx, 0, sizeof(*ctx));
 
-	ctx->zdctx = ZSTD_createDCtx();
+	xlog_dctx_create(&ctx->dctx);
 	ctx->file_type = WAL_TYPE_MAX;
 }
 
 static inline void xlog_ctx_destroy(xlog_ctx_t *ctx)
 {
-	if (ctx->zdctx)
-		ZSTD_freeDCtx(ctx->zdctx);
+	xlog_dctx_destroy(&ctx->dctx);
 }
 
 struct xrow_header {
@@ -60,6 +100,8 @@ struct xrow_header {
 	double		tm;
 	int64_t		tsn;
 	bool		is_commit;
+	/** IPROTO_FLAGS as they are, for rows written back */
+	uint32_t	flags;
 	int		bodycnt;
 	uint32_t	schema_version;
 	struct iovec	body[XROW_BODY_IOVMAX];
@@ -72,6 +114,26 @@ struct xlog_fixheader {
 	uint32_t	len;
 };
 
+/* What a header only scan finds in a file */
+struct xlog_summary {
+	uint64_t	blocks;
+	uint64_t	zblocks;
+	uint64_t	disk_bytes;
+	uint64_t	rows;
+	uint64_t	bytes;
+	int64_t		min_lsn;
+	int64_t		max_lsn;
+	double		min_tm;
+	double		max_tm;
+};
+
+extern const char *xlog_meta_keys[XLOG_META_MAX];
+extern const char *xlog_type_name(int file_type);
+
+typedef int (*xlog_row_cb)(const struct xrow_header *hdr, void *arg);
+
+extern int parse_header(xlog_ctx_t *ctx);
 extern int parse_file(xlog_ctx_t *ctx);
+extern int xlog_scan(const char *path, int file_type, xlog_row_cb cb, void *arg);
 
 #endif /* XLOG_H__ */